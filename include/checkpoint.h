@@ -0,0 +1,107 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "constant.h"
+
+// Checkpoints of the whole world, written by server every checkpointPeriod
+// seconds and read by master --restore. The file is a small header and the
+// WorldState as it is in shared memory up to the drone history, which is not
+// kept: the copy is taken with worldRead, which only holds the lock for a
+// memcpy (and never blocks a writer in the threaded build), and written from
+// that private copy to a temporary file. The file is synced and renamed over
+// the old one, then the directory is synced, so that neither a reader nor a
+// crash ever sees half a checkpoint.
+
+#define CHECKPOINT_PATH "log/checkpoint.bin"
+#define checkpointMagic 0x54504b43     // "CKPT"
+#define checkpointVersion 3
+#define checkpointPeriod 1.0
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stateSize;        // worldStateSize, another layout is refused
+    uint32_t checksum;         // FNV-1a of the state
+} CheckpointHeader;
+
+static inline uint32_t checkpointChecksum(const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Make a rename in the directory of path durable, -1 on error
+static inline int checkpointSyncDirectory(const char *path) {
+    char directory[256];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char *slash = strrchr(directory, '/');
+    if (slash == NULL) {
+        snprintf(directory, sizeof(directory), ".");
+    } else if (slash == directory) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Replace the checkpoint at path with state, -1 on error
+static inline int checkpointSave(const WorldState *state, const char *path) {
+    char temporary[256];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    CheckpointHeader header = {.magic = checkpointMagic,
+                               .version = checkpointVersion,
+                               .stateSize = worldStateSize,
+                               .checksum = checkpointChecksum(state, worldStateSize)};
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(state, worldStateSize, 1, file) == 1 &&
+                  fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !written) {
+        remove(temporary);
+        return -1;
+    }
+    if (rename(temporary, path) == -1) {
+        return -1;
+    }
+    return checkpointSyncDirectory(path);
+}
+
+// Read the checkpoint at path into state, -1 if it is missing, of another
+// layout or damaged. The history of state is left alone, and on error the
+// rest of it may be overwritten.
+static inline int checkpointLoad(WorldState *state, const char *path) {
+    CheckpointHeader header;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    int read = fread(&header, sizeof(header), 1, file) == 1 && header.magic == checkpointMagic &&
+               header.version == checkpointVersion && header.stateSize == worldStateSize &&
+               fread(state, worldStateSize, 1, file) == 1;
+    fclose(file);
+    if (!read || header.checksum != checkpointChecksum(state, worldStateSize)) {
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -5,13 +5,17 @@
 #include <bits/sigaction.h>
 #define _POSIX_C_SOURCE 200809L
 #include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "history.h"
 
 
 #define maxMsgLength 400
 
 #define SEM_PATH "/sem_path"
 #define SHM_PATH "/shm_path"
-#define SHM_SIZE sizeof(struct Position)
+#define SHM_SIZE sizeof(WorldState)
 #define NUM_OBSTACLES 5
 #define NUM_TARGETS 5
 
@@ -28,6 +32,18 @@
 
 #define counterThresold 6
 
+// Supervision: a failed component is restarted alone, at most maxRestarts times
+// inside restartWindow seconds, waiting restartBackoffMs (doubled on every
+// consecutive restart, capped at restartBackoffMaxMs) before relaunching it
+#define maxRestarts 5
+#define restartWindow 60
+#define restartBackoffMs 10
+#define restartBackoffMaxMs 2000
+
+// Extra argument appended by master when relaunching a component, so that it
+// reattaches to the running world instead of initialising it
+#define restartFlag "restart"
+
 #define windowWidth 1.00
 #define scoreboardWinHeight 0.20
 #define windowHeight 0.80
@@ -40,6 +56,27 @@ typedef struct {
 } Point;
 
 
+// Layout of the shared world segment. The first 48 bytes are the historical
+// segment: the last three drone positions, with the obstacle (-1) and target
+// (1..10) hit flags written over position[0].
+typedef struct {
+    double position[6];
+    uint64_t generation;       // Incremented by every write
+    uint64_t droneSteps;       // Incremented by droneDynamics for every physics step
+    Point obstacles[NUM_OBSTACLES];
+    Point targets[NUM_TARGETS];
+    int score;                 // Target values reached minus 2 per obstacle hit
+    int obstacleHits;
+    int targetHits;
+    int autopilot;             // 1 while the autopilot flies the drone, toggled with 'a'
+    int forceField;            // simFieldRepel and simFieldAttract bits, set by master --field
+    History history;           // Timestamped drone samples, written lock-free by droneDynamics
+} WorldState;
+
+// What a copy of the whole state takes: everything but the history, which is
+// read lock-free with worldHistory and would only be copied torn
+#define worldStateSize offsetof(WorldState, history)
+
 typedef struct {
     double row;
     double col;
@@ -49,7 +86,7 @@ typedef struct {
 } Character;
 
 
-void handleSignal(int signo, siginfo_t *siginfo, void *context) {
+static inline void handleSignal(int signo, siginfo_t *siginfo, void *context) {
     if (signo == SIGINT) {
         exit(1);
     }
@@ -59,4 +96,9 @@ void handleSignal(int signo, siginfo_t *siginfo, void *context) {
     }
 }
 
+// True when master relaunched this component after a failure
+static inline bool isRestart(int argc, char *argv[]) {
+    return argc > 2 && strcmp(argv[2], restartFlag) == 0;
+}
+
 #endif
\ No newline at end of file
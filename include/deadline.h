@@ -0,0 +1,111 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <math.h>
+#include "metrics.h"
+
+// Watchdog deadlines learned from the loop periods of each component. The
+// watchdog reads the start of the current iteration and the iteration count
+// from the component's metrics block; every time they advance, the time
+// between two starts is one period. Periods go into a histogram of
+// deadlineBucketsPerOctave buckets per doubling that decays at every sample,
+// so the deadline follows a component whose rate is raised or lowered: it is
+// deadlineMargin times the deadlineQuantile of the recent periods, clamped to
+// [deadlineMin, deadlineMax]. A component waiting on an empty channel is idle,
+// not late, and the time it spent waiting is not taken as a period. Until
+// deadlineWarmup periods have been seen the caller's fallback applies.
+
+#define deadlineBase 0.001                 // Upper bound of the first bucket, seconds
+#define deadlineBucketsPerOctave 8
+#define deadlineBuckets 160                // Up to about 17 minutes
+#define deadlineDecay 0.98                 // About the last 50 periods count
+#define deadlineQuantile 0.99
+#define deadlineMargin 3.0
+#define deadlineMin 0.5
+#define deadlineMax 30.0
+#define deadlineWarmup 20
+
+typedef struct {
+    double histogram[deadlineBuckets];
+    double weight;                         // Sum of the decayed histogram
+    uint64_t periods;                      // Periods seen since the watchdog started
+    uint64_t lastIterations;
+    double lastStart;                      // Start of the last iteration seen, 0 before the first
+    double lastProgress;                   // When the component last made progress or was idle
+    int idle;                              // Waited on a channel since lastStart
+} Deadline;
+
+static inline int deadlineBucket(double period) {
+    if (period <= deadlineBase) {
+        return 0;
+    }
+    int bucket = (int)ceil(log2(period / deadlineBase) * deadlineBucketsPerOctave);
+    return bucket < deadlineBuckets ? bucket : deadlineBuckets - 1;
+}
+
+static inline void deadlineAddPeriod(Deadline *deadline, double period) {
+    for (int i = 0; i < deadlineBuckets; i++) {
+        deadline->histogram[i] *= deadlineDecay;
+    }
+    deadline->histogram[deadlineBucket(period)] += 1;
+    deadline->weight = deadline->weight * deadlineDecay + 1;
+    deadline->periods++;
+}
+
+// Upper bound of the bucket holding the given quantile of the recent periods
+static inline double deadlinePeriodQuantile(const Deadline *deadline, double quantile) {
+    double seen = 0;
+    for (int i = 0; i < deadlineBuckets; i++) {
+        seen += deadline->histogram[i];
+        if (seen >= quantile * deadline->weight) {
+            return deadlineBase * exp2((double)i / deadlineBucketsPerOctave);
+        }
+    }
+    return deadlineMax;
+}
+
+// Seconds a component may go without progress
+static inline double deadlineSeconds(const Deadline *deadline, double fallback) {
+    if (deadline->periods < deadlineWarmup) {
+        return fallback;
+    }
+    double seconds = deadlineMargin * deadlinePeriodQuantile(deadline, deadlineQuantile);
+    return fmin(deadlineMax, fmax(deadlineMin, seconds));
+}
+
+// Forget where the component was, after it has been restarted
+static inline void deadlineRestart(Deadline *deadline, double now) {
+    deadline->lastStart = 0;
+    deadline->lastIterations = 0;
+    deadline->lastProgress = now;
+    deadline->idle = 0;
+}
+
+// Look at the component's metrics block and return for how long it has made
+// no progress
+static inline double deadlineObserve(Deadline *deadline, const ComponentMetrics *component, double now) {
+    uint64_t iterations = __atomic_load_n(&component->iterations, __ATOMIC_RELAXED);
+    double start;
+    __atomic_load(&component->loopStart, &start, __ATOMIC_RELAXED);
+
+    if (deadline->lastProgress == 0 || iterations < deadline->lastIterations) {
+        deadlineRestart(deadline, now);
+    }
+    if (iterations != deadline->lastIterations && start > deadline->lastStart) {
+        if (deadline->lastStart > 0 && !deadline->idle) {
+            deadlineAddPeriod(deadline, (start - deadline->lastStart) / (double)(iterations - deadline->lastIterations));
+        }
+        deadline->lastStart = start;
+        deadline->lastIterations = iterations;
+        deadline->lastProgress = fmax(start, deadline->lastProgress);
+        deadline->idle = 0;
+    }
+    if (__atomic_load_n(&component->blocked, __ATOMIC_RELAXED)) {
+        deadline->lastProgress = now;
+        deadline->idle = 1;
+    }
+    return now - deadline->lastProgress;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef DRONESIM_H
+#define DRONESIM_H
+
+#include <stdint.h>
+
+// libdronesim (bin/libdronesim.a): the simulation without processes, pipes,
+// shared memory or sleeps, for offline runs. A DroneSim holds any number of
+// independent environments (drone, obstacles, targets, score), each with its
+// own random seed; droneSimStep advances them all by one physics step and
+// writes their states and hit events to buffers the caller owns. Memory is
+// only allocated by droneSimCreate.
+
+#define droneSimMaxObstacles 32
+#define droneSimMaxTargets 32
+
+typedef struct {
+    double mass;               // M
+    double friction;           // K
+    double timeStep;           // T
+    double radius;             // RADIUS, distance at which a point is hit
+    int numObstacles;          // Up to droneSimMaxObstacles
+    int numTargets;            // Up to droneSimMaxTargets
+    int obstacleSteps;         // Steps between obstacle placements, 0 to keep them
+    double obstacleSpeed;      // Top obstacle speed in board units per step, 0 for still ones
+    double spacing;            // Minimum distance between entities and the drone when placed
+} DroneSimConfig;
+
+typedef struct {
+    int x;
+    int y;
+} DroneSimForce;
+
+typedef struct {
+    double x;
+    double y;
+    int value;                 // Target value, 0 for obstacles
+} DroneSimPoint;
+
+typedef struct {
+    double x;
+    double y;
+    uint64_t steps;
+    double distance;           // Path length so far
+    int score;                 // Target values reached minus 2 per obstacle entered
+    int obstacleHits;
+    int targetHits;
+} DroneSimState;
+
+enum {
+    droneSimObstacleHit = 1,
+    droneSimTargetHit = 2
+};
+
+typedef struct {
+    int env;
+    int type;
+    int index;                 // Obstacle or target hit
+    int value;                 // Score change
+} DroneSimEvent;
+
+typedef struct DroneSim DroneSim;
+
+// The defaults of constant.h
+void droneSimDefaultConfig(DroneSimConfig *config);
+
+// count environments, environment i drawing from stream i of seed. NULL when
+// the configuration is invalid (errno EINVAL, also for a negative or NaN
+// friction) or out of memory.
+DroneSim *droneSimCreate(const DroneSimConfig *config, int count, unsigned int seed);
+void droneSimDestroy(DroneSim *sim);
+int droneSimCount(const DroneSim *sim);
+
+// Start one environment over on stream env of seed, -1 if env is out of range
+int droneSimReset(DroneSim *sim, int env, unsigned int seed);
+
+// Advance environments 0..n-1 by one step, forces[i] driving environment i.
+// states (n entries) may be NULL. Up to maxEvents hit events are written to
+// events; the return value is the number that happened, which is larger when
+// some did not fit, or -1 with errno EINVAL if n is out of range or forces
+// (events, with maxEvents > 0) is NULL.
+int droneSimStep(DroneSim *sim, const DroneSimForce *forces, int n, DroneSimState *states,
+                 DroneSimEvent *events, int maxEvents);
+
+// Current state and entities of one environment. obstacles and targets may be
+// NULL, otherwise they receive numObstacles and numTargets points.
+int droneSimObserve(const DroneSim *sim, int env, DroneSimState *state, DroneSimPoint *obstacles,
+                    DroneSimPoint *targets);
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef DSTAR_H
+#define DSTAR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+// D* Lite (Koenig and Likhachev) on an 8-connected occupancy grid. The search
+// runs backwards from the goal, so when the start moves or cells become free
+// or blocked only the part of the search they affect is redone: a replan
+// costs a few expansions around the changed cells instead of a new search.
+// A new goal starts a new search; the per-cell values are reset lazily, by
+// epoch, so that costs nothing on large grids either.
+//
+// Cells are indices y * width + x. Moving into a blocked cell costs infinity,
+// except into the goal, which stays reachable even when something covers it.
+// Costs are whole thousandths of a cell, so that sums are exact and keys that
+// should tie do tie; otherwise rounding can stop a replan too early.
+
+#define dstarStraight 1000.0
+#define dstarDiagonal 1414.0
+
+typedef struct {
+    double k1, k2;
+    int cell;
+} DStarEntry;
+
+typedef struct {
+    int width, height;
+    uint8_t *blocked;
+    double *g, *rhs;
+    uint32_t *epochs;              // Epoch in which g and rhs were last set
+    int32_t *heapIndex;            // Position in the queue, -1 when not queued
+    DStarEntry *heap;
+    int heapSize;
+    uint32_t epoch;
+    int start, last, goal;         // goal is -1 until the first dstarSetGoal
+    double km;
+    uint64_t expansions;           // Cells expanded since creation
+} DStar;
+
+static inline void dstarDestroy(DStar *dstar) {
+    if (dstar != NULL) {
+        free(dstar->blocked);
+        free(dstar->g);
+        free(dstar->rhs);
+        free(dstar->epochs);
+        free(dstar->heapIndex);
+        free(dstar->heap);
+        free(dstar);
+    }
+}
+
+// An empty width x height grid, NULL when out of memory
+static inline DStar *dstarCreate(int width, int height) {
+    DStar *dstar = calloc(1, sizeof(DStar));
+    if (dstar == NULL) {
+        return NULL;
+    }
+    size_t cells = (size_t)width * height;
+    dstar->width = width;
+    dstar->height = height;
+    dstar->blocked = calloc(cells, sizeof(uint8_t));
+    dstar->g = malloc(cells * sizeof(double));
+    dstar->rhs = malloc(cells * sizeof(double));
+    dstar->epochs = calloc(cells, sizeof(uint32_t));
+    dstar->heapIndex = malloc(cells * sizeof(int32_t));
+    dstar->heap = malloc(cells * sizeof(DStarEntry));
+    if (dstar->blocked == NULL || dstar->g == NULL || dstar->rhs == NULL || dstar->epochs == NULL ||
+        dstar->heapIndex == NULL || dstar->heap == NULL) {
+        dstarDestroy(dstar);
+        return NULL;
+    }
+    for (size_t i = 0; i < cells; i++) {
+        dstar->heapIndex[i] = -1;
+    }
+    dstar->goal = -1;
+    return dstar;
+}
+
+static inline int dstarCell(const DStar *dstar, int x, int y) {
+    return y * dstar->width + x;
+}
+
+// Octile distance, the cost of the shortest path on an empty grid
+static inline double dstarHeuristic(const DStar *dstar, int a, int b) {
+    int dx = abs(a % dstar->width - b % dstar->width);
+    int dy = abs(a / dstar->width - b / dstar->width);
+    int low = dx < dy ? dx : dy;
+    return dstarStraight * (dx + dy) + (dstarDiagonal - 2 * dstarStraight) * low;
+}
+
+// Values of the current epoch, infinity for cells not reached yet
+static inline void dstarTouch(DStar *dstar, int cell) {
+    if (dstar->epochs[cell] != dstar->epoch) {
+        dstar->epochs[cell] = dstar->epoch;
+        dstar->g[cell] = INFINITY;
+        dstar->rhs[cell] = INFINITY;
+    }
+}
+
+static inline double dstarG(const DStar *dstar, int cell) {
+    return dstar->epochs[cell] == dstar->epoch ? dstar->g[cell] : INFINITY;
+}
+
+static inline int dstarKeyLess(double a1, double a2, double b1, double b2) {
+    return a1 < b1 || (a1 == b1 && a2 < b2);
+}
+
+// Binary min-heap on (k1, k2) with the position of every cell, so that a
+// queued cell can be moved or removed
+static inline void dstarHeapSet(DStar *dstar, int position, DStarEntry entry) {
+    dstar->heap[position] = entry;
+    dstar->heapIndex[entry.cell] = position;
+}
+
+static inline void dstarHeapUp(DStar *dstar, int position) {
+    DStarEntry entry = dstar->heap[position];
+    while (position > 0) {
+        int parent = (position - 1) / 2;
+        if (!dstarKeyLess(entry.k1, entry.k2, dstar->heap[parent].k1, dstar->heap[parent].k2)) {
+            break;
+        }
+        dstarHeapSet(dstar, position, dstar->heap[parent]);
+        position = parent;
+    }
+    dstarHeapSet(dstar, position, entry);
+}
+
+static inline void dstarHeapDown(DStar *dstar, int position) {
+    DStarEntry entry = dstar->heap[position];
+    for (;;) {
+        int child = 2 * position + 1;
+        if (child >= dstar->heapSize) {
+            break;
+        }
+        if (child + 1 < dstar->heapSize &&
+            dstarKeyLess(dstar->heap[child + 1].k1, dstar->heap[child + 1].k2, dstar->heap[child].k1,
+                         dstar->heap[child].k2)) {
+            child++;
+        }
+        if (!dstarKeyLess(dstar->heap[child].k1, dstar->heap[child].k2, entry.k1, entry.k2)) {
+            break;
+        }
+        dstarHeapSet(dstar, position, dstar->heap[child]);
+        position = child;
+    }
+    dstarHeapSet(dstar, position, entry);
+}
+
+// Queue a cell with a key, or move it if already queued
+static inline void dstarHeapPut(DStar *dstar, int cell, double k1, double k2) {
+    DStarEntry entry = {k1, k2, cell};
+    int position = dstar->heapIndex[cell];
+    if (position == -1) {
+        position = dstar->heapSize++;
+        dstarHeapSet(dstar, position, entry);
+        dstarHeapUp(dstar, position);
+    } else {
+        dstarHeapSet(dstar, position, entry);
+        dstarHeapUp(dstar, position);
+        dstarHeapDown(dstar, dstar->heapIndex[cell]);
+    }
+}
+
+static inline void dstarHeapRemove(DStar *dstar, int cell) {
+    int position = dstar->heapIndex[cell];
+    if (position == -1) {
+        return;
+    }
+    dstar->heapIndex[cell] = -1;
+    if (--dstar->heapSize == position) {
+        return;
+    }
+    int moved = dstar->heap[dstar->heapSize].cell;
+    dstarHeapSet(dstar, position, dstar->heap[dstar->heapSize]);
+    dstarHeapUp(dstar, position);
+    dstarHeapDown(dstar, dstar->heapIndex[moved]);
+}
+
+static inline void dstarKey(const DStar *dstar, int cell, double *k1, double *k2) {
+    double best = fmin(dstar->g[cell], dstar->rhs[cell]);
+    *k1 = best + dstarHeuristic(dstar, dstar->start, cell) + dstar->km;
+    *k2 = best;
+}
+
+// Cost of the move between two neighbouring cells
+static inline double dstarCost(const DStar *dstar, int from, int to) {
+    if (dstar->blocked[to] && to != dstar->goal) {
+        return INFINITY;
+    }
+    int diagonal = from % dstar->width != to % dstar->width && from / dstar->width != to / dstar->width;
+    return diagonal ? dstarDiagonal : dstarStraight;
+}
+
+// The up to 8 neighbours of a cell, returns how many
+static inline int dstarNeighbours(const DStar *dstar, int cell, int *neighbours) {
+    int x = cell % dstar->width, y = cell / dstar->width;
+    int count = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int nx = x + dx, ny = y + dy;
+            if ((dx != 0 || dy != 0) && nx >= 0 && nx < dstar->width && ny >= 0 && ny < dstar->height) {
+                neighbours[count++] = dstarCell(dstar, nx, ny);
+            }
+        }
+    }
+    return count;
+}
+
+static inline void dstarUpdateVertex(DStar *dstar, int cell) {
+    dstarTouch(dstar, cell);
+    if (cell != dstar->goal) {
+        int neighbours[8];
+        int count = dstarNeighbours(dstar, cell, neighbours);
+        double best = INFINITY;
+        for (int i = 0; i < count; i++) {
+            best = fmin(best, dstarCost(dstar, cell, neighbours[i]) + dstarG(dstar, neighbours[i]));
+        }
+        dstar->rhs[cell] = best;
+    }
+    if (dstar->g[cell] != dstar->rhs[cell]) {
+        double k1, k2;
+        dstarKey(dstar, cell, &k1, &k2);
+        dstarHeapPut(dstar, cell, k1, k2);
+    } else {
+        dstarHeapRemove(dstar, cell);
+    }
+}
+
+// Start a new search towards goal from start
+static inline void dstarSetGoal(DStar *dstar, int goal, int start) {
+    for (int i = 0; i < dstar->heapSize; i++) {
+        dstar->heapIndex[dstar->heap[i].cell] = -1;
+    }
+    dstar->heapSize = 0;
+    dstar->epoch++;
+    dstar->goal = goal;
+    dstar->start = dstar->last = start;
+    dstar->km = 0;
+    dstarTouch(dstar, goal);
+    dstar->rhs[goal] = 0;
+    dstarHeapPut(dstar, goal, dstarHeuristic(dstar, start, goal), 0);
+}
+
+// The drone has moved to start
+static inline void dstarMoveStart(DStar *dstar, int start) {
+    dstar->km += dstarHeuristic(dstar, dstar->last, start);
+    dstar->start = dstar->last = start;
+}
+
+// Mark a cell free or blocked, the moves into it change cost
+static inline void dstarSetBlocked(DStar *dstar, int cell, int blocked) {
+    if (dstar->blocked[cell] == (uint8_t)blocked) {
+        return;
+    }
+    dstar->blocked[cell] = (uint8_t)blocked;
+    if (dstar->goal == -1) {
+        return;
+    }
+    int neighbours[8];
+    int count = dstarNeighbours(dstar, cell, neighbours);
+    for (int i = 0; i < count; i++) {
+        dstarUpdateVertex(dstar, neighbours[i]);
+    }
+}
+
+// Bring the search up to date, returns 0 when the goal can be reached from
+// the start and -1 otherwise
+static inline int dstarPlan(DStar *dstar) {
+    if (dstar->goal == -1) {
+        return -1;
+    }
+    int start = dstar->start;
+    dstarTouch(dstar, start);
+
+    for (;;) {
+        double s1, s2;
+        dstarKey(dstar, start, &s1, &s2);
+        if (dstar->heapSize == 0 ||
+            (!dstarKeyLess(dstar->heap[0].k1, dstar->heap[0].k2, s1, s2) && dstar->rhs[start] == dstar->g[start])) {
+            break;
+        }
+        DStarEntry top = dstar->heap[0];
+        int cell = top.cell;
+        double k1, k2;
+        dstarKey(dstar, cell, &k1, &k2);
+        dstar->expansions++;
+
+        int neighbours[8];
+        int count = dstarNeighbours(dstar, cell, neighbours);
+        if (dstarKeyLess(top.k1, top.k2, k1, k2)) {
+            dstarHeapPut(dstar, cell, k1, k2);
+        } else if (dstar->g[cell] > dstar->rhs[cell]) {
+            dstar->g[cell] = dstar->rhs[cell];
+            dstarHeapRemove(dstar, cell);
+            for (int i = 0; i < count; i++) {
+                dstarUpdateVertex(dstar, neighbours[i]);
+            }
+        } else {
+            dstar->g[cell] = INFINITY;
+            dstarUpdateVertex(dstar, cell);
+            for (int i = 0; i < count; i++) {
+                dstarUpdateVertex(dstar, neighbours[i]);
+            }
+        }
+    }
+    return isinf(dstar->rhs[start]) ? -1 : 0;
+}
+
+// The neighbour to move to from cell on a shortest path, -1 if none
+static inline int dstarNext(const DStar *dstar, int cell) {
+    int neighbours[8];
+    int count = dstarNeighbours(dstar, cell, neighbours);
+    int next = -1;
+    double best = INFINITY;
+    for (int i = 0; i < count; i++) {
+        double cost = dstarCost(dstar, cell, neighbours[i]) + dstarG(dstar, neighbours[i]);
+        if (cost < best) {
+            best = cost;
+            next = neighbours[i];
+        }
+    }
+    return next;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "constant.h"
+
+// Occupancy heatmap of the board kept by server: how many physics steps the
+// drone spent in every cell and where the obstacle and target hits happened.
+// Every update is a counter increment, and the largest count of each layer is
+// kept up to date along the way. server writes the whole map to HEATMAP_PATH
+// every heatmapPeriod seconds (to a temporary file renamed over the old one,
+// so a reader never sees half a snapshot) and window overlays it with 'h'.
+
+#define HEATMAP_PATH "log/heatmap.bin"
+#define heatmapMagic 0x50414d48         // "HMAP"
+#define heatmapVersion 1
+#define heatmapCellSize 2               // World units per cell side
+#define heatmapSide (boardSize / heatmapCellSize)
+#define heatmapCells (heatmapSide * heatmapSide)
+#define heatmapPeriod 5.0
+
+enum {
+    heatmapVisits,
+    heatmapObstacleHits,
+    heatmapTargetHits,
+    heatmapLayers
+};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t side;
+    uint32_t cellSize;
+    uint32_t max[heatmapLayers];    // Largest count of each layer
+    uint64_t total[heatmapLayers];
+} HeatmapHeader;
+
+// Also the snapshot layout: the header, then the layers one after the other
+typedef struct {
+    HeatmapHeader header;
+    uint32_t counts[heatmapLayers][heatmapCells];
+} Heatmap;
+
+static inline void heatmapInit(Heatmap *heatmap) {
+    memset(heatmap, 0, sizeof(*heatmap));
+    heatmap->header.magic = heatmapMagic;
+    heatmap->header.version = heatmapVersion;
+    heatmap->header.side = heatmapSide;
+    heatmap->header.cellSize = heatmapCellSize;
+}
+
+// Cell of a world position, clamped to the board
+static inline int heatmapCell(double x, double y) {
+    int column = (int)(x / heatmapCellSize);
+    int row = (int)(y / heatmapCellSize);
+    column = column < 0 ? 0 : column >= heatmapSide ? heatmapSide - 1 : column;
+    row = row < 0 ? 0 : row >= heatmapSide ? heatmapSide - 1 : row;
+    return row * heatmapSide + column;
+}
+
+static inline void heatmapAdd(Heatmap *heatmap, int layer, double x, double y) {
+    uint32_t count = ++heatmap->counts[layer][heatmapCell(x, y)];
+    if (count > heatmap->header.max[layer]) {
+        heatmap->header.max[layer] = count;
+    }
+    heatmap->header.total[layer]++;
+}
+
+// Sum of a layer over the cells covering a world rectangle
+static inline uint32_t heatmapSum(const Heatmap *heatmap, int layer, double x0, double y0, double x1, double y1) {
+    int first = heatmapCell(x0, y0);
+    int last = heatmapCell(x1, y1);
+    uint32_t sum = 0;
+    for (int row = first / heatmapSide; row <= last / heatmapSide; row++) {
+        for (int column = first % heatmapSide; column <= last % heatmapSide; column++) {
+            sum += heatmap->counts[layer][row * heatmapSide + column];
+        }
+    }
+    return sum;
+}
+
+// Replace the snapshot at path, -1 on error
+static inline int heatmapSave(const Heatmap *heatmap, const char *path) {
+    char temporary[256];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t written = fwrite(heatmap, sizeof(*heatmap), 1, file);
+    if (fclose(file) != 0 || written != 1) {
+        remove(temporary);
+        return -1;
+    }
+    return rename(temporary, path);
+}
+
+// Read the snapshot at path, -1 if it is missing or of another layout
+static inline int heatmapLoad(Heatmap *heatmap, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t read = fread(heatmap, sizeof(*heatmap), 1, file);
+    fclose(file);
+    if (read != 1 || heatmap->header.magic != heatmapMagic || heatmap->header.version != heatmapVersion ||
+        heatmap->header.side != heatmapSide || heatmap->header.cellSize != heatmapCellSize) {
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Timestamped history of the drone, in the world segment next to the three
+// positions the physics needs. droneDynamics is the only producer and writes
+// every sample in place, outside the world lock: each slot has a sequence
+// that is odd while it is written, and head counts the samples pushed so far.
+// Readers go back from head without locking and stop at the first slot that
+// is being written or was overwritten while they copied it, so a reader never
+// holds up the physics step and never sees a torn sample. The depth is a
+// power of two fixed at compile time (-DhistoryDepth=N), the cost of a push
+// does not depend on it.
+
+#ifndef historyDepth
+#define historyDepth 64
+#endif
+#define historyTrail 16        // Samples drawn behind the drone by the window
+
+typedef struct {
+    uint64_t step;             // Index of the sample since the start
+    double time;               // CLOCK_MONOTONIC seconds
+    double x, y;
+} HistorySample;
+
+typedef struct {
+    atomic_uint sequence;      // Odd while the producer writes the sample
+    HistorySample sample;
+} HistorySlot;
+
+typedef struct {
+    atomic_uint_least64_t head;
+    HistorySlot slots[historyDepth];
+} History;
+
+_Static_assert((historyDepth & (historyDepth - 1)) == 0, "historyDepth must be a power of two");
+
+// Producer only
+static inline void historyPush(History *history, double time, double x, double y) {
+    uint64_t step = atomic_load_explicit(&history->head, memory_order_relaxed);
+    HistorySlot *slot = &history->slots[step & (historyDepth - 1)];
+    unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->sample = (HistorySample){step, time, x, y};
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+    atomic_store_explicit(&history->head, step + 1, memory_order_release);
+}
+
+// Copy up to count of the latest samples into samples, newest first, and
+// return how many were copied
+static inline int historyLatest(const History *history, HistorySample *samples, int count) {
+    uint64_t head = atomic_load_explicit(&history->head, memory_order_acquire);
+    int copied = 0;
+
+    while (copied < count && copied < historyDepth && (uint64_t)copied < head) {
+        uint64_t step = head - 1 - copied;
+        const HistorySlot *slot = &history->slots[step & (historyDepth - 1)];
+
+        unsigned int before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        samples[copied] = slot->sample;
+        atomic_thread_fence(memory_order_acquire);
+        unsigned int after = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+        if ((before & 1) || before != after || samples[copied].step != step) {
+            break;
+        }
+        copied++;
+    }
+    return copied;
+}
+
+// Velocity and acceleration from the latest samples (newest first), by finite
+// differences over their timestamps; 0 when there are not enough of them
+static inline void historyMotion(const HistorySample *samples, int count, double velocity[2],
+                                 double acceleration[2]) {
+    velocity[0] = velocity[1] = acceleration[0] = acceleration[1] = 0;
+    if (count < 2 || samples[0].time <= samples[1].time) {
+        return;
+    }
+    double dt = samples[0].time - samples[1].time;
+    velocity[0] = (samples[0].x - samples[1].x) / dt;
+    velocity[1] = (samples[0].y - samples[1].y) / dt;
+
+    if (count < 3 || samples[1].time <= samples[2].time) {
+        return;
+    }
+    double previous = samples[1].time - samples[2].time;
+    acceleration[0] = (velocity[0] - (samples[1].x - samples[2].x) / previous) / (0.5 * (dt + previous));
+    acceleration[1] = (velocity[1] - (samples[1].y - samples[2].y) / previous) / (0.5 * (dt + previous));
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+
+#include <stdio.h>
+#include <string.h>
+
+// Input scripts, shared by the sweep runner and the input driver: one
+// "<key> <steps>" per line, the key applied as the keyboard manager would
+// (simApplyKey) and held for that many steps. Lines starting with '#' and
+// lines that do not parse are skipped.
+
+#define inputScriptLines 4096
+
+// master --input hands the driver its source (a script, or "random") and its
+// rate in events per second in these
+#define INPUT_ENV "ARP_INPUT"
+#define INPUT_RATE_ENV "ARP_INPUT_RATE"
+
+typedef struct {
+    char name[64];
+    int count;
+    char keys[inputScriptLines];
+    int steps[inputScriptLines];
+} InputScript;
+
+// -1 when the file cannot be read
+static inline int inputScriptLoad(const char *path, InputScript *script) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    const char *slash = strrchr(path, '/');
+    snprintf(script->name, sizeof(script->name), "%s", slash != NULL ? slash + 1 : path);
+    script->count = 0;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL && script->count < inputScriptLines) {
+        char key;
+        int steps;
+        if (line[0] == '#' || sscanf(line, " %c %d", &key, &steps) != 2) {
+            continue;
+        }
+        script->keys[script->count] = key;
+        script->steps[script->count] = steps;
+        script->count++;
+    }
+    fclose(file);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "metrics.h"
+
+// Channels between components. In the normal build a channel is a pipe and
+// these are the plain system calls. With THREADED_MODE every component is a
+// thread of one process and a channel is a lock-free in-process queue, named
+// by the same integers, so the component code is identical in both builds.
+
+#ifndef THREADED_MODE
+
+static inline int ipcPipe(int fds[2]) {
+    return pipe(fds);
+}
+
+// The watchdog takes a component waiting here as idle rather than stalled
+static inline ssize_t ipcRead(int fd, void *buffer, size_t size) {
+    traceBegin("ipcRead");
+    if (metricsSelf != NULL) {
+        metricsSelf->blocked = 1;
+    }
+    ssize_t result = read(fd, buffer, size);
+    if (metricsSelf != NULL) {
+        metricsSelf->blocked = 0;
+    }
+    traceEnd("ipcRead");
+    return result;
+}
+
+static inline ssize_t ipcWrite(int fd, const void *buffer, size_t size) {
+    traceBegin("ipcWrite");
+    ssize_t result = write(fd, buffer, size);
+    traceEnd("ipcWrite");
+    return result;
+}
+
+static inline int ipcClose(int fd) {
+    return close(fd);
+}
+
+static inline int ipcSetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+#else
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// A channel is a bounded multi-producer, single-consumer queue of messages
+// (Vyukov's array queue). Every write is one message, split in slot sized
+// chunks when larger, and reads consume messages like bytes of a pipe.
+// Channel i is read through ipcChannelBase + 2i and written through
+// ipcChannelBase + 2i + 1, mirroring the two ends of a pipe.
+
+#define ipcChannelBase 1000
+#define ipcMaxQueues 32
+#define ipcSlots 256               // Power of two
+#define ipcSlotSize 256
+
+typedef struct {
+    atomic_size_t sequence;
+    size_t length;
+    unsigned char data[ipcSlotSize];
+} IpcSlot;
+
+typedef struct {
+    atomic_size_t enqueuePosition;
+    atomic_size_t dequeuePosition;
+    atomic_uint pushes;            // Futex words, bumped after every enqueue/dequeue
+    atomic_uint pops;
+    atomic_int readerWaiting;
+    atomic_int writersWaiting;
+    size_t readOffset;             // Bytes already consumed from the head message
+    int nonBlocking[2];            // Per end, like O_NONBLOCK on a pipe end
+    IpcSlot slots[ipcSlots];
+} IpcQueue;
+
+// Defined once, by the threaded master
+extern IpcQueue ipcQueues[ipcMaxQueues];
+extern atomic_int ipcNumQueues;
+
+static inline IpcQueue *ipcQueue(int fd, int *end) {
+    int index = (fd - ipcChannelBase) / 2;
+    if (fd < ipcChannelBase || index >= atomic_load(&ipcNumQueues)) {
+        return NULL;
+    }
+    if (end != NULL) {
+        *end = (fd - ipcChannelBase) % 2;
+    }
+    return &ipcQueues[index];
+}
+
+static inline void ipcFutexWait(atomic_uint *word, unsigned int seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static inline void ipcFutexWake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline int ipcPipe(int fds[2]) {
+    int index = atomic_fetch_add(&ipcNumQueues, 1);
+    if (index >= ipcMaxQueues) {
+        errno = EMFILE;
+        return -1;
+    }
+    IpcQueue *queue = &ipcQueues[index];
+    memset(queue, 0, sizeof(*queue));
+    for (size_t i = 0; i < ipcSlots; i++) {
+        atomic_store_explicit(&queue->slots[i].sequence, i, memory_order_relaxed);
+    }
+    fds[0] = ipcChannelBase + 2 * index;
+    fds[1] = ipcChannelBase + 2 * index + 1;
+    return 0;
+}
+
+// Enqueue one chunk, 0 when the queue is full
+static inline int ipcTryPush(IpcQueue *queue, const void *data, size_t length) {
+    size_t position = atomic_load_explicit(&queue->enqueuePosition, memory_order_relaxed);
+    IpcSlot *slot;
+
+    for (;;) {
+        slot = &queue->slots[position & (ipcSlots - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePosition, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = atomic_load_explicit(&queue->enqueuePosition, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&queue->pushes, 1, memory_order_release);
+    if (atomic_load_explicit(&queue->readerWaiting, memory_order_acquire)) {
+        ipcFutexWake(&queue->pushes);
+    }
+    return 1;
+}
+
+// Copy up to size bytes from the head message, 0 when the queue is empty.
+// Only the single reader of the channel calls it.
+static inline size_t ipcTryPop(IpcQueue *queue, unsigned char *buffer, size_t size) {
+    size_t position = atomic_load_explicit(&queue->dequeuePosition, memory_order_relaxed);
+    IpcSlot *slot = &queue->slots[position & (ipcSlots - 1)];
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != position + 1) {
+        return 0;
+    }
+
+    size_t available = slot->length - queue->readOffset;
+    size_t copied = size < available ? size : available;
+    memcpy(buffer, slot->data + queue->readOffset, copied);
+    queue->readOffset += copied;
+
+    if (queue->readOffset == slot->length) {
+        queue->readOffset = 0;
+        atomic_store_explicit(&queue->dequeuePosition, position + 1, memory_order_relaxed);
+        atomic_store_explicit(&slot->sequence, position + ipcSlots, memory_order_release);
+
+        atomic_fetch_add_explicit(&queue->pops, 1, memory_order_release);
+        if (atomic_load_explicit(&queue->writersWaiting, memory_order_acquire)) {
+            ipcFutexWake(&queue->pops);
+        }
+    }
+    return copied;
+}
+
+static inline ssize_t ipcRead(int fd, void *buffer, size_t size) {
+    int end;
+    IpcQueue *queue = ipcQueue(fd, &end);
+    if (queue == NULL || end != 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // Like a pipe: wait for the first byte, then take whatever is queued
+    size_t total = ipcTryPop(queue, buffer, size);
+    while (total == 0) {
+        if (queue->nonBlocking[0]) {
+            errno = EAGAIN;
+            return -1;
+        }
+        unsigned int seen = atomic_load_explicit(&queue->pushes, memory_order_acquire);
+        atomic_store(&queue->readerWaiting, 1);
+        if (metricsSelf != NULL) {
+            metricsSelf->blocked = 1;
+        }
+        total = ipcTryPop(queue, buffer, size);
+        if (total == 0) {
+            traceBegin("ipcRead");
+            ipcFutexWait(&queue->pushes, seen);
+            traceEnd("ipcRead");
+            total = ipcTryPop(queue, buffer, size);
+        }
+        atomic_store(&queue->readerWaiting, 0);
+        if (metricsSelf != NULL) {
+            metricsSelf->blocked = 0;
+        }
+    }
+    while (total < size) {
+        size_t copied = ipcTryPop(queue, (unsigned char *)buffer + total, size - total);
+        if (copied == 0) {
+            break;
+        }
+        total += copied;
+    }
+    return total;
+}
+
+static inline ssize_t ipcWrite(int fd, const void *buffer, size_t size) {
+    int end;
+    IpcQueue *queue = ipcQueue(fd, &end);
+    if (queue == NULL || end != 1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        size_t chunk = size - written < ipcSlotSize ? size - written : ipcSlotSize;
+        if (ipcTryPush(queue, (const unsigned char *)buffer + written, chunk)) {
+            written += chunk;
+            continue;
+        }
+        if (queue->nonBlocking[1]) {
+            if (written > 0) {
+                break;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        unsigned int seen = atomic_load_explicit(&queue->pops, memory_order_acquire);
+        atomic_fetch_add(&queue->writersWaiting, 1);
+        if (!ipcTryPush(queue, (const unsigned char *)buffer + written, chunk)) {
+            traceBegin("ipcWrite");
+            ipcFutexWait(&queue->pops, seen);
+            traceEnd("ipcWrite");
+        } else {
+            written += chunk;
+        }
+        atomic_fetch_sub(&queue->writersWaiting, 1);
+    }
+    return written;
+}
+
+// Channels live as long as the process, closing an end is a no-op
+static inline int ipcClose(int fd) {
+    return ipcQueue(fd, NULL) != NULL ? 0 : close(fd);
+}
+
+static inline int ipcSetNonBlocking(int fd) {
+    int end;
+    IpcQueue *queue = ipcQueue(fd, &end);
+    if (queue == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    queue->nonBlocking[end] = 1;
+    return 0;
+}
+
+#endif
+
+#endif
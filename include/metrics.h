@@ -0,0 +1,307 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "trace.h"
+
+// Runtime metrics: every component owns one block of a shared table that the
+// server turns into a text snapshot on METRICS_SOCKET_PATH
+
+#define METRICS_SHM_PATH "/shm_metrics"
+#define METRICS_SOCKET_PATH "/tmp/arp_metrics.sock"
+
+#define metricsBuckets 24      // Loop durations, bucket i counts loops of [2^i, 2^(i+1)) us
+#define metricsChannels 4
+#define metricsNameLength 24
+
+// Slot of each component in the table, same order as master's launch order
+enum {
+    slotServer,
+    slotWindow,
+    slotKeyboard,
+    slotDrone,
+    slotObstacles,
+    slotTargets,
+    slotWatchdog,
+    slotAutopilot,
+    slotInput,
+    metricsSlots
+};
+
+typedef struct {
+    char name[metricsNameLength];
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+} ChannelMetrics;
+
+typedef struct {
+    pid_t pid;
+    char name[metricsNameLength];
+    uint64_t iterations;
+    uint64_t loopHistogram[metricsBuckets];
+    double loopTotal;          // Seconds spent working inside the loop
+    double loopMax;
+    double loopStart;          // Start of the current iteration (CLOCK_MONOTONIC)
+    int blocked;               // Waiting on an empty channel, idle rather than stalled
+    uint64_t semWaits;
+    double semWaitTotal;       // Seconds blocked in sem_wait
+    double semWaitMax;
+    uint64_t wakeups;
+    uint64_t jitterHistogram[metricsBuckets];
+    double jitterTotal;        // Seconds woken up late, summed over all sleeps
+    double jitterMax;
+    ChannelMetrics channels[metricsChannels];
+    int numChannels;
+    double cpuUser;
+    double cpuSystem;
+    long rssKB;
+    long maxRssKB;
+    double lastUsageSample;
+} ComponentMetrics;
+
+typedef struct {
+    ComponentMetrics components[metricsSlots];
+} MetricsTable;
+
+// Block of the calling process, NULL until metricsAttach succeeds
+static ComponentMetrics *metricsSelf = NULL;
+
+static inline double metricsNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Map the shared table, creating it if this is the first process to start
+static inline MetricsTable *metricsOpenTable() {
+    int fd = shm_open(METRICS_SHM_PATH, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("shm_open metrics");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(MetricsTable)) == -1) {
+        perror("ftruncate metrics");
+        close(fd);
+        return NULL;
+    }
+    void *table = mmap(NULL, sizeof(MetricsTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        perror("mmap metrics");
+        return NULL;
+    }
+    return (MetricsTable *)table;
+}
+
+// Claim the block of a component; failures only disable the metrics. The
+// trace buffer of the component comes with it.
+static inline void metricsAttach(int slot, const char *name) {
+    traceAttach(name);
+    MetricsTable *table = metricsOpenTable();
+    if (table == NULL) {
+        return;
+    }
+    metricsSelf = &table->components[slot];
+    memset(metricsSelf, 0, sizeof(*metricsSelf));
+    snprintf(metricsSelf->name, sizeof(metricsSelf->name), "%s", name);
+#ifdef THREADED_MODE
+    metricsSelf->pid = gettid();
+#else
+    metricsSelf->pid = getpid();
+#endif
+}
+
+// Register a named channel and get the index used by metricsSent/metricsReceived
+static inline int metricsChannel(const char *name) {
+    if (metricsSelf == NULL || metricsSelf->numChannels == metricsChannels) {
+        return -1;
+    }
+    int index = metricsSelf->numChannels++;
+    snprintf(metricsSelf->channels[index].name, sizeof(metricsSelf->channels[index].name), "%s", name);
+    return index;
+}
+
+static inline void metricsSent(int channel, ssize_t bytes) {
+    if (metricsSelf != NULL && channel >= 0 && bytes > 0) {
+        metricsSelf->channels[channel].bytesSent += bytes;
+    }
+}
+
+static inline void metricsReceived(int channel, ssize_t bytes) {
+    if (metricsSelf != NULL && channel >= 0 && bytes > 0) {
+        metricsSelf->channels[channel].bytesReceived += bytes;
+    }
+}
+
+// CPU time from getrusage, current RSS from /proc (ru_maxrss is only the peak).
+// In the threaded build the CPU time is the thread's, the memory the process'.
+static inline void metricsSampleUsage() {
+    struct rusage usage;
+#ifdef THREADED_MODE
+    int who = RUSAGE_THREAD;
+#else
+    int who = RUSAGE_SELF;
+#endif
+    if (getrusage(who, &usage) == 0) {
+        metricsSelf->cpuUser = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+        metricsSelf->cpuSystem = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+        metricsSelf->maxRssKB = usage.ru_maxrss;
+    }
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        long pages, residentPages;
+        if (fscanf(statm, "%ld %ld", &pages, &residentPages) == 2) {
+            metricsSelf->rssKB = residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(statm);
+    }
+}
+
+// Histogram bucket of a duration in seconds, bucket i covers [2^i, 2^(i+1)) us
+static inline int metricsBucket(double seconds) {
+    int bucket = 0;
+    for (uint64_t us = (uint64_t)(seconds * 1e6); us > 1 && bucket < metricsBuckets - 1; us >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Upper bound in milliseconds of the bucket holding quantile q of a histogram,
+// never above the largest value actually observed
+static inline double metricsHistogramPercentile(const uint64_t *histogram, uint64_t count, double maxSeconds, double q) {
+    uint64_t rank = (uint64_t)(q * count), seen = 0;
+    double max = maxSeconds * 1000.0;
+    for (int i = 0; i < metricsBuckets; i++) {
+        seen += histogram[i];
+        if (seen > rank) {
+            double bound = (double)(2ULL << i) / 1000.0;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+static inline void metricsLoopBegin() {
+    if (metricsSelf != NULL) {
+        metricsSelf->loopStart = metricsNow();
+    }
+}
+
+// End of the useful work of an iteration, call it before the loop sleeps
+static inline void metricsLoopEnd() {
+    if (metricsSelf == NULL || metricsSelf->loopStart == 0) {
+        return;
+    }
+    double now = metricsNow();
+    double duration = now - metricsSelf->loopStart;
+
+    metricsSelf->loopHistogram[metricsBucket(duration)]++;
+    metricsSelf->iterations++;
+    metricsSelf->loopTotal += duration;
+    if (duration > metricsSelf->loopMax) {
+        metricsSelf->loopMax = duration;
+    }
+
+    if (now - metricsSelf->lastUsageSample >= 1.0) {
+        metricsSampleUsage();
+        metricsSelf->lastUsageSample = now;
+    }
+}
+
+// sem_wait that accounts for the time spent blocked
+static inline void metricsRecordSemWait(double waited) {
+    if (metricsSelf == NULL) {
+        return;
+    }
+    metricsSelf->semWaits++;
+    metricsSelf->semWaitTotal += waited;
+    if (waited > metricsSelf->semWaitMax) {
+        metricsSelf->semWaitMax = waited;
+    }
+}
+
+static inline int metricsSemWait(sem_t *sem) {
+    double start = metricsNow();
+    int result = sem_wait(sem);
+    metricsRecordSemWait(metricsNow() - start);
+    return result;
+}
+
+// Account how late a sleep with a deadline woke up
+static inline void metricsRecordWakeup(double late) {
+    if (metricsSelf == NULL) {
+        return;
+    }
+    if (late < 0) {
+        late = 0;
+    }
+    metricsSelf->wakeups++;
+    metricsSelf->jitterHistogram[metricsBucket(late)]++;
+    metricsSelf->jitterTotal += late;
+    if (late > metricsSelf->jitterMax) {
+        metricsSelf->jitterMax = late;
+    }
+}
+
+// Sleep of the component loops: resumes after a signal (the watchdog
+// heartbeat) instead of returning early, and records the wakeup jitter
+static inline void metricsSleep(double seconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    double target = deadline.tv_sec + deadline.tv_nsec * 1e-9 + seconds;
+    deadline.tv_sec = (time_t)target;
+    deadline.tv_nsec = (long)((target - (double)deadline.tv_sec) * 1e9);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+    metricsRecordWakeup(metricsNow() - target);
+}
+
+static inline double metricsPercentile(const ComponentMetrics *c, double q) {
+    return metricsHistogramPercentile(c->loopHistogram, c->iterations, c->loopMax, q);
+}
+
+// Write a human readable snapshot of the table, returns the length
+static inline int metricsFormat(const MetricsTable *table, char *buffer, size_t size) {
+    int length = snprintf(buffer, size,
+                          "%-16s %7s %9s %9s %9s %9s %9s %10s %10s %10s %8s %8s %8s\n",
+                          "component", "pid", "loops", "avg_ms", "p50_ms", "p99_ms", "max_ms",
+                          "semwait_ms", "jitter_p99", "jitter_max", "cpu_usr", "cpu_sys", "rss_kb");
+
+    for (int i = 0; i < metricsSlots && length < (int)size; i++) {
+        const ComponentMetrics *c = &table->components[i];
+        if (c->pid == 0) {
+            continue;
+        }
+        double average = c->iterations ? c->loopTotal / c->iterations * 1000.0 : 0;
+        length += snprintf(buffer + length, size - length,
+                           "%-16s %7d %9llu %9.3f %9.3f %9.3f %9.3f %10.3f %10.3f %10.3f %8.2f %8.2f %8ld\n",
+                           c->name, c->pid, (unsigned long long)c->iterations, average,
+                           metricsPercentile(c, 0.50), metricsPercentile(c, 0.99), c->loopMax * 1000.0,
+                           c->semWaitTotal * 1000.0,
+                           metricsHistogramPercentile(c->jitterHistogram, c->wakeups, c->jitterMax, 0.99),
+                           c->jitterMax * 1000.0, c->cpuUser, c->cpuSystem, c->rssKB);
+
+        for (int j = 0; j < c->numChannels && length < (int)size; j++) {
+            length += snprintf(buffer + length, size - length, "    %-20s sent %10llu B  received %10llu B\n",
+                               c->channels[j].name,
+                               (unsigned long long)c->channels[j].bytesSent,
+                               (unsigned long long)c->channels[j].bytesReceived);
+        }
+    }
+    return length < (int)size ? length : (int)size - 1;
+}
+
+#endif
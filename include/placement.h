@@ -0,0 +1,210 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "rng.h"
+
+// Placement of entities at least `spacing` apart, on a background grid of
+// cells spacing/sqrt(2) wide so that a distance check only looks at the 5x5
+// cells around a candidate. Points already there (the drone, the entities of
+// the other kind) are inserted first and block their neighbourhood.
+// placementSample throws darts over the whole area for a few entities spread
+// out; placementFill is Bridson's algorithm, which grows from the existing
+// points and packs the area with as many as fit, or finds the gaps left on a
+// board too crowded for the darts.
+
+#define placementAttempts 30       // Candidates per point before giving up
+#define placementTwoPi 6.283185307179586
+
+typedef struct {
+    double width, height;
+    double spacing;
+    double cellSize;
+    int columns, rows;
+    int32_t *cells;                // First point of every cell, -1 when empty
+    int32_t *next;                 // Next point in the same cell
+    int32_t *active;               // Bridson's points that may still grow
+    double *xs, *ys;
+    int count, capacity;
+} Placement;
+
+static inline void placementDestroy(Placement *placement) {
+    if (placement != NULL) {
+        free(placement->cells);
+        free(placement->next);
+        free(placement->active);
+        free(placement->xs);
+        free(placement->ys);
+        free(placement);
+    }
+}
+
+// Room for capacity points on a width x height area, NULL when out of memory
+static inline Placement *placementCreate(double width, double height, double spacing, int capacity) {
+    Placement *placement = calloc(1, sizeof(Placement));
+    if (placement == NULL || spacing <= 0) {
+        free(placement);
+        return NULL;
+    }
+    placement->width = width;
+    placement->height = height;
+    placement->spacing = spacing;
+    placement->cellSize = spacing / sqrt(2.0);
+    placement->columns = (int)ceil(width / placement->cellSize) + 1;
+    placement->rows = (int)ceil(height / placement->cellSize) + 1;
+    placement->capacity = capacity;
+    placement->cells = malloc((size_t)placement->columns * placement->rows * sizeof(int32_t));
+    placement->next = malloc(capacity * sizeof(int32_t));
+    placement->active = malloc(capacity * sizeof(int32_t));
+    placement->xs = malloc(capacity * sizeof(double));
+    placement->ys = malloc(capacity * sizeof(double));
+    if (placement->cells == NULL || placement->next == NULL || placement->active == NULL ||
+        placement->xs == NULL || placement->ys == NULL) {
+        placementDestroy(placement);
+        return NULL;
+    }
+    for (int i = 0; i < placement->columns * placement->rows; i++) {
+        placement->cells[i] = -1;
+    }
+    return placement;
+}
+
+static inline int placementCell(const Placement *placement, double x, double y) {
+    int column = (int)(x / placement->cellSize);
+    int row = (int)(y / placement->cellSize);
+    column = column < 0 ? 0 : column >= placement->columns ? placement->columns - 1 : column;
+    row = row < 0 ? 0 : row >= placement->rows ? placement->rows - 1 : row;
+    return row * placement->columns + column;
+}
+
+// Forget every point, only the cells in use are touched
+static inline void placementClear(Placement *placement) {
+    for (int i = 0; i < placement->count; i++) {
+        placement->cells[placementCell(placement, placement->xs[i], placement->ys[i])] = -1;
+    }
+    placement->count = 0;
+}
+
+// Add a point without checking the spacing, -1 when full
+static inline int placementInsert(Placement *placement, double x, double y) {
+    if (placement->count == placement->capacity) {
+        return -1;
+    }
+    int index = placement->count++;
+    int cell = placementCell(placement, x, y);
+    placement->xs[index] = x;
+    placement->ys[index] = y;
+    placement->next[index] = placement->cells[cell];
+    placement->cells[cell] = index;
+    return index;
+}
+
+// Whether (x, y) is at least spacing away from every point. Two points in the
+// same cell are always too close, so an occupied cell rejects at once; the
+// corners of the 5x5 block are a full spacing away and never need a look.
+static inline int placementFits(const Placement *placement, double x, double y) {
+    int column = (int)(x / placement->cellSize);
+    int row = (int)(y / placement->cellSize);
+    double limit = placement->spacing * placement->spacing;
+
+    if (column < 0 || column >= placement->columns || row < 0 || row >= placement->rows) {
+        return 0;
+    }
+    if (placement->cells[row * placement->columns + column] != -1) {
+        return 0;
+    }
+    for (int r = row - 2; r <= row + 2; r++) {
+        if (r < 0 || r >= placement->rows) {
+            continue;
+        }
+        int edge = r == row - 2 || r == row + 2;
+        for (int c = column - 2 + edge; c <= column + 2 - edge; c++) {
+            if (c < 0 || c >= placement->columns) {
+                continue;
+            }
+            for (int i = placement->cells[r * placement->columns + c]; i != -1; i = placement->next[i]) {
+                double dx = placement->xs[i] - x;
+                double dy = placement->ys[i] - y;
+                if (dx * dx + dy * dy < limit) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// Up to count new points spread over [0, xMax) x [0, yMax), each of them
+// uniform among the positions that fit. Returns how many were placed, fewer
+// when the area is too crowded.
+static inline int placementSample(Placement *placement, Rng *rng, int count, double xMax, double yMax) {
+    int placed = 0;
+    for (int n = 0; n < count; n++) {
+        for (int attempt = 0; attempt < placementAttempts; attempt++) {
+            double x = rngUniform(rng) * xMax;
+            double y = rngUniform(rng) * yMax;
+            if (placementFits(placement, x, y) && placementInsert(placement, x, y) != -1) {
+                placed++;
+                break;
+            }
+        }
+    }
+    return placed;
+}
+
+// Bridson's Poisson-disk sampling over [0, xMax) x [0, yMax): grow from the
+// points already there, or from a random one on an empty placement, and
+// retire a point once no candidate around it fits. The candidates are those
+// of Roberts' variant, evenly spread on a circle just over spacing from a
+// random start angle, which packs the area tighter than random ones in the
+// ring and needs a single sin/cos per point. Stops at maxCount new points or
+// when the area is full. Returns how many were added.
+static inline int placementFill(Placement *placement, Rng *rng, int maxCount, double xMax, double yMax) {
+    int numActive = 0, added = 0;
+    double radius = placement->spacing * (1.0 + 1e-6);
+    double stepCos = cos(placementTwoPi / placementAttempts);
+    double stepSin = sin(placementTwoPi / placementAttempts);
+
+    for (int i = 0; i < placement->count; i++) {
+        placement->active[numActive++] = i;
+    }
+    if (numActive == 0 && maxCount > 0 && placementSample(placement, rng, 1, xMax, yMax) == 1) {
+        placement->active[numActive++] = placement->count - 1;
+        added++;
+    }
+    while (numActive > 0 && added < maxCount) {
+        int slot = rngBelow(rng, numActive);
+        int point = placement->active[slot];
+        double angle = placementTwoPi * rngUniform(rng);
+        double dx = radius * cos(angle);
+        double dy = radius * sin(angle);
+        int grown = 0;
+
+        for (int attempt = 0; attempt < placementAttempts; attempt++) {
+            double x = placement->xs[point] + dx;
+            double y = placement->ys[point] + dy;
+            double rotated = dx * stepCos - dy * stepSin;
+            dy = dx * stepSin + dy * stepCos;
+            dx = rotated;
+            if (x < 0 || x >= xMax || y < 0 || y >= yMax || !placementFits(placement, x, y)) {
+                continue;
+            }
+            int index = placementInsert(placement, x, y);
+            if (index == -1) {
+                return added;
+            }
+            placement->active[numActive++] = index;
+            added++;
+            grown = 1;
+            break;
+        }
+        if (!grown) {
+            placement->active[slot] = placement->active[--numActive];
+        }
+    }
+    return added;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+// Launch policy of a component, from its topology options: CPU affinity,
+// scheduling class and priority, memory locking and pre-faulting of the world
+// segment. master applies the scheduling part to the new process (or thread).
+// The memory part only works from inside the component, so master passes it
+// in POLICY_ENV and worldAttach applies it once the segment is mapped.
+
+#define POLICY_ENV "ARP_MEMORY_POLICY"
+#define policyMaxCPUs 64
+
+enum {
+    policyLockMemory = 1,
+    policyPrefault = 2
+};
+
+typedef struct {
+    uint64_t cpuMask;          // Allowed CPUs, 0 to inherit master's
+    int policy;                // SCHED_OTHER or SCHED_FIFO
+    int priority;              // SCHED_FIFO priority
+    int nice;                  // SCHED_OTHER nice value
+    int memory;                // policyLockMemory | policyPrefault
+} ComponentPolicy;
+
+// Parse one topology option: 1 when it was a policy option, 0 when it is not
+// one, -1 when it is malformed
+static inline int policyParseOption(ComponentPolicy *policy, const char *option) {
+    int first, last, value;
+    char extra;
+
+    if (strncmp(option, "cpu=", 4) == 0) {
+        int fields = sscanf(option + 4, "%d-%d%c", &first, &last, &extra);
+        if (fields == 1) {
+            last = first;
+        } else if (fields != 2) {
+            return -1;
+        }
+        if (first < 0 || last < first || last >= policyMaxCPUs) {
+            return -1;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            policy->cpuMask |= 1ULL << cpu;
+        }
+        return 1;
+    }
+    if (strcmp(option, "sched=other") == 0) {
+        policy->policy = SCHED_OTHER;
+        return 1;
+    }
+    if (sscanf(option, "sched=fifo:%d%c", &value, &extra) == 1) {
+        if (value < sched_get_priority_min(SCHED_FIFO) || value > sched_get_priority_max(SCHED_FIFO)) {
+            return -1;
+        }
+        policy->policy = SCHED_FIFO;
+        policy->priority = value;
+        return 1;
+    }
+    if (sscanf(option, "nice=%d%c", &value, &extra) == 1) {
+        if (value < -20 || value > 19) {
+            return -1;
+        }
+        policy->nice = value;
+        return 1;
+    }
+    if (strcmp(option, "mlock") == 0) {
+        policy->memory |= policyLockMemory;
+        return 1;
+    }
+    if (strcmp(option, "prefault") == 0) {
+        policy->memory |= policyPrefault;
+        return 1;
+    }
+    return 0;
+}
+
+// Value of POLICY_ENV for a memory policy, "" when there is none
+static inline const char *policyMemoryString(int memory) {
+    switch (memory) {
+        case policyLockMemory: return "mlock";
+        case policyPrefault: return "prefault";
+        case policyLockMemory | policyPrefault: return "mlock,prefault";
+    }
+    return "";
+}
+
+// Memory policy master handed to this process
+static inline int policyMemoryFromEnv() {
+    const char *value = getenv(POLICY_ENV);
+    int memory = 0;
+    if (value != NULL) {
+        memory |= strstr(value, "mlock") != NULL ? policyLockMemory : 0;
+        memory |= strstr(value, "prefault") != NULL ? policyPrefault : 0;
+    }
+    return memory;
+}
+
+// Fault in a mapping now rather than on the first access in the loop, then
+// lock everything mapped so far. MCL_FUTURE is left out on purpose: with the
+// default RLIMIT_MEMLOCK it makes later allocations (ncurses, stdio) fail.
+static inline void policyApplyMemory(void *segment, size_t size, int memory) {
+    if (memory & policyPrefault) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)segment & ~(uintptr_t)(pageSize - 1);
+        size_t length = (uintptr_t)segment + size - start;
+#ifdef MADV_POPULATE_WRITE
+        if (madvise((void *)start, length, MADV_POPULATE_WRITE) == -1)
+#endif
+        {
+            // Older kernels: touch every page, a read of a shared page is enough
+            for (uintptr_t page = start; page < start + length; page += pageSize) {
+                (void)*(volatile char *)(page > (uintptr_t)segment ? page : (uintptr_t)segment);
+            }
+        }
+    }
+    if ((memory & policyLockMemory) && mlockall(MCL_CURRENT) == -1) {
+        perror("mlockall (raise RLIMIT_MEMLOCK to lock memory)");
+    }
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Seedable random numbers: xoshiro256** (Blackman and Vigna), 32 bytes of
+// state per generator. A generator is seeded with a run seed and a stream
+// number, so every component and every world draws from its own sequence and
+// the same seed replays the same run. master picks the run seed (--seed) and
+// hands it to the components in RNG_SEED_ENV.
+
+#define RNG_SEED_ENV "ARP_SEED"
+
+// Streams of the components seeded by master
+enum {
+    rngStreamObstacles = 1,
+    rngStreamTargets = 2,
+    rngStreamInput = 3
+};
+
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+static inline uint64_t rngRotate(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// splitmix64, only used to expand the seed into a full state
+static inline uint64_t rngSplitMix(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void rngSeed(Rng *rng, uint64_t seed, uint64_t stream) {
+    uint64_t streamMix = stream;
+    uint64_t x = seed ^ rngSplitMix(&streamMix);
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = rngSplitMix(&x);
+    }
+}
+
+static inline uint64_t rngNext(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rngRotate(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rngRotate(s[3], 45);
+    return result;
+}
+
+// Map 32 random bits to [0, bound) without the bias of %: multiply and keep
+// the high half, redrawing (rarely) when the low half lands in the short
+// interval (Lemire). Returns -1 when a redraw is needed.
+static inline int rngReduce(uint32_t bits, uint32_t bound, uint32_t *value) {
+    uint64_t product = (uint64_t)bits * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound && low < (uint32_t)(-bound) % bound) {
+        return -1;
+    }
+    *value = (uint32_t)(product >> 32);
+    return 0;
+}
+
+// Uniform integer in [0, bound), bound > 0
+static inline uint32_t rngBelow(Rng *rng, uint32_t bound) {
+    uint32_t value;
+    while (rngReduce((uint32_t)(rngNext(rng) >> 32), bound, &value) == -1) {
+    }
+    return value;
+}
+
+// Uniform double in [0, 1)
+static inline double rngUniform(Rng *rng) {
+    return (rngNext(rng) >> 11) * 0x1.0p-53;
+}
+
+// Bulk fill of doubles in [low, high)
+static inline void rngFillUniform(Rng *rng, double *values, int count, double low, double high) {
+    double range = high - low;
+    for (int i = 0; i < count; i++) {
+        values[i] = low + rngUniform(rng) * range;
+    }
+}
+
+// The run seed master handed down, 1 when started without master
+static inline uint64_t rngSeedFromEnv() {
+    const char *value = getenv(RNG_SEED_ENV);
+    return value != NULL ? strtoull(value, NULL, 10) : 1;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "metrics.h"
+
+// Periodic and one-shot tasks of a component, run from a single epoll_wait.
+// Timers sit on a hierarchical timer wheel of millisecond ticks: level l has
+// 64 slots of 64^l ticks, so adding or cancelling a timer is O(1), and a
+// timer moves down a level when the wheel reaches its slot. One timerfd is
+// armed, absolute on CLOCK_MONOTONIC, for the earliest expiry, and the epoll
+// set also holds the descriptors added with schedulerWatch: the component
+// wakes up only when something is due. Periods count from the first expiry,
+// so they do not drift with the time the tasks take; how late a task runs is
+// recorded as wakeup jitter in the component's metrics.
+
+#define schedulerTick 0.001
+#define schedulerLevels 4              // 64^4 ticks, about 4.6 hours ahead
+#define schedulerSlots 64
+#define schedulerSlotBits 6
+#define schedulerMaxTimers 16
+#define schedulerMaxWatches 8
+
+typedef void (*SchedulerTask)(void *argument);
+
+typedef struct {
+    SchedulerTask task;                // NULL for a free entry
+    void *argument;
+    uint64_t expiry;                   // Tick at which it is due
+    uint64_t period;                   // Ticks between runs, 0 for a one-shot
+    int next, prev;                    // Links of the slot list, -1 at the ends
+    int level, slot;
+} SchedulerTimer;
+
+typedef struct {
+    SchedulerTask task;
+    void *argument;
+    int fd;
+} SchedulerWatch;
+
+typedef struct {
+    int epollFD, timerFD;
+    double origin;                     // CLOCK_MONOTONIC time of tick 0
+    uint64_t now;                      // Last tick the wheel has reached
+    uint64_t armed;                    // Tick the timerfd is armed for, 0 if none
+    int slots[schedulerLevels][schedulerSlots];   // First timer of every slot, -1 when empty
+    SchedulerTimer timers[schedulerMaxTimers];
+    SchedulerWatch watches[schedulerMaxWatches];
+    int numWatches;
+    int running;
+} Scheduler;
+
+// Ticks elapsed since the scheduler was created
+static inline uint64_t schedulerClock(const Scheduler *scheduler) {
+    return (uint64_t)((metricsNow() - scheduler->origin) / schedulerTick + 1e-6);
+}
+
+static inline uint64_t schedulerTicks(double seconds) {
+    return seconds > 0 ? (uint64_t)(seconds / schedulerTick + 0.5) : 0;
+}
+
+// -1 when the timerfd or the epoll instance cannot be created
+static inline int schedulerCreate(Scheduler *scheduler) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    memset(scheduler->slots, -1, sizeof(scheduler->slots));
+    scheduler->origin = metricsNow();
+    scheduler->epollFD = epoll_create1(EPOLL_CLOEXEC);
+    scheduler->timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (scheduler->epollFD == -1 || scheduler->timerFD == -1) {
+        perror("scheduler");
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = 0};
+    if (epoll_ctl(scheduler->epollFD, EPOLL_CTL_ADD, scheduler->timerFD, &event) == -1) {
+        perror("scheduler epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+static inline void schedulerDestroy(Scheduler *scheduler) {
+    close(scheduler->timerFD);
+    close(scheduler->epollFD);
+}
+
+// Put a timer in the slot of its expiry: the lowest level at which it is
+// less than 64 slots ahead of the wheel
+static inline void schedulerLink(Scheduler *scheduler, int id) {
+    SchedulerTimer *timer = &scheduler->timers[id];
+    int level = 0;
+    while (level < schedulerLevels - 1 &&
+           (timer->expiry >> (schedulerSlotBits * level)) - (scheduler->now >> (schedulerSlotBits * level)) >=
+               schedulerSlots) {
+        level++;
+    }
+    int slot = (timer->expiry >> (schedulerSlotBits * level)) & (schedulerSlots - 1);
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = -1;
+    timer->next = scheduler->slots[level][slot];
+    if (timer->next != -1) {
+        scheduler->timers[timer->next].prev = id;
+    }
+    scheduler->slots[level][slot] = id;
+}
+
+static inline void schedulerUnlink(Scheduler *scheduler, int id) {
+    SchedulerTimer *timer = &scheduler->timers[id];
+    if (timer->prev != -1) {
+        scheduler->timers[timer->prev].next = timer->next;
+    } else {
+        scheduler->slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next != -1) {
+        scheduler->timers[timer->next].prev = timer->prev;
+    }
+}
+
+// Run task after delay seconds and then every period seconds (0 for once).
+// Returns the timer, or -1 when there are schedulerMaxTimers already.
+static inline int schedulerAdd(Scheduler *scheduler, double delay, double period, SchedulerTask task,
+                               void *argument) {
+    for (int id = 0; id < schedulerMaxTimers; id++) {
+        SchedulerTimer *timer = &scheduler->timers[id];
+        if (timer->task != NULL) {
+            continue;
+        }
+        timer->task = task;
+        timer->argument = argument;
+        timer->period = schedulerTicks(period);
+        timer->expiry = schedulerClock(scheduler) + schedulerTicks(delay);
+        if (timer->expiry <= scheduler->now) {
+            timer->expiry = scheduler->now + 1;
+        }
+        schedulerLink(scheduler, id);
+        return id;
+    }
+    return -1;
+}
+
+// Every period seconds, the first time right away
+static inline int schedulerEvery(Scheduler *scheduler, double period, SchedulerTask task, void *argument) {
+    return schedulerAdd(scheduler, 0, period, task, argument);
+}
+
+static inline int schedulerAfter(Scheduler *scheduler, double delay, SchedulerTask task, void *argument) {
+    return schedulerAdd(scheduler, delay, 0, task, argument);
+}
+
+static inline void schedulerCancel(Scheduler *scheduler, int id) {
+    if (id >= 0 && id < schedulerMaxTimers && scheduler->timers[id].task != NULL) {
+        schedulerUnlink(scheduler, id);
+        scheduler->timers[id].task = NULL;
+    }
+}
+
+// Run task whenever fd is readable, -1 when it cannot be watched
+static inline int schedulerWatch(Scheduler *scheduler, int fd, SchedulerTask task, void *argument) {
+    if (scheduler->numWatches == schedulerMaxWatches) {
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = scheduler->numWatches + 1};
+    if (epoll_ctl(scheduler->epollFD, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return -1;
+    }
+    scheduler->watches[scheduler->numWatches++] = (SchedulerWatch){task, argument, fd};
+    return 0;
+}
+
+// Move the timers of the slot the wheel has reached at level one down
+static inline void schedulerCascade(Scheduler *scheduler, int level) {
+    int slot = (scheduler->now >> (schedulerSlotBits * level)) & (schedulerSlots - 1);
+    int id = scheduler->slots[level][slot];
+    scheduler->slots[level][slot] = -1;
+    while (id != -1) {
+        int next = scheduler->timers[id].next;
+        schedulerLink(scheduler, id);
+        id = next;
+    }
+}
+
+// Run everything due up to tick target
+static inline void schedulerAdvance(Scheduler *scheduler, uint64_t target) {
+    while (scheduler->now < target) {
+        scheduler->now++;
+        for (int level = schedulerLevels - 1; level > 0; level--) {
+            if ((scheduler->now & ((1ULL << (schedulerSlotBits * level)) - 1)) == 0) {
+                schedulerCascade(scheduler, level);
+            }
+        }
+
+        int *slot = &scheduler->slots[0][scheduler->now & (schedulerSlots - 1)];
+        while (*slot != -1) {
+            int id = *slot;
+            SchedulerTimer *timer = &scheduler->timers[id];
+            SchedulerTask task = timer->task;
+            void *argument = timer->argument;
+
+            metricsRecordWakeup(metricsNow() - (scheduler->origin + timer->expiry * schedulerTick));
+            schedulerUnlink(scheduler, id);
+            if (timer->period > 0) {
+                // Skip the runs missed while the component was held up
+                do {
+                    timer->expiry += timer->period;
+                } while (timer->expiry <= scheduler->now);
+                schedulerLink(scheduler, id);
+            } else {
+                timer->task = NULL;
+            }
+            task(argument);
+        }
+    }
+}
+
+// Earliest expiry on the wheel, 0 when there is no timer. At every level the
+// first busy slot from the wheel's position holds that level's earliest.
+static inline uint64_t schedulerNext(const Scheduler *scheduler) {
+    uint64_t next = 0;
+    for (int level = 0; level < schedulerLevels; level++) {
+        int position = (scheduler->now >> (schedulerSlotBits * level)) & (schedulerSlots - 1);
+        for (int i = 0; i < schedulerSlots; i++) {
+            int id = scheduler->slots[level][(position + i) & (schedulerSlots - 1)];
+            if (id == -1) {
+                continue;
+            }
+            for (; id != -1; id = scheduler->timers[id].next) {
+                if (next == 0 || scheduler->timers[id].expiry < next) {
+                    next = scheduler->timers[id].expiry;
+                }
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+static inline void schedulerArm(Scheduler *scheduler) {
+    uint64_t next = schedulerNext(scheduler);
+    if (next == scheduler->armed) {
+        return;
+    }
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+    if (next != 0) {
+        double when = scheduler->origin + next * schedulerTick;
+        spec.it_value.tv_sec = (time_t)when;
+        spec.it_value.tv_nsec = (long)((when - (double)spec.it_value.tv_sec) * 1e9);
+    }
+    if (timerfd_settime(scheduler->timerFD, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+        scheduler->armed = next;
+    }
+}
+
+// Wait for and run the tasks until schedulerStop, -1 if epoll fails
+static inline int schedulerRun(Scheduler *scheduler) {
+    scheduler->running = 1;
+    while (scheduler->running) {
+        schedulerArm(scheduler);
+
+        struct epoll_event events[schedulerMaxWatches + 1];
+        int count = epoll_wait(scheduler->epollFD, events, schedulerMaxWatches + 1, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;      // The watchdog heartbeat
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            uint32_t source = events[i].data.u32;
+            if (source == 0) {
+                uint64_t expirations;
+                if (read(scheduler->timerFD, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                    perror("timerfd read");
+                }
+                scheduler->armed = 0;
+            } else {
+                SchedulerWatch *watch = &scheduler->watches[source - 1];
+                watch->task(watch->argument);
+            }
+        }
+        schedulerAdvance(scheduler, schedulerClock(scheduler));
+    }
+    return 0;
+}
+
+static inline void schedulerStop(Scheduler *scheduler) {
+    scheduler->running = 0;
+}
+
+#endif
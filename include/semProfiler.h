@@ -0,0 +1,178 @@
+#ifndef SEM_PROFILER_H
+#define SEM_PROFILER_H
+
+#include <errno.h>
+#include "metrics.h"
+
+// Contention profiler of the shared SEM_PATH lock. SEM_LOCK/SEM_UNLOCK replace
+// sem_wait/sem_post and record, per component and call site, how long the
+// caller waited for the lock and how long it held it. The statistics are only
+// updated while the lock is held, so they need no synchronisation of their
+// own. bin/semReport prints the table.
+
+#define SEMPROF_SHM_PATH "/shm_semprof"
+#define semProfSites 64
+#define semProfSiteLength 48
+
+typedef struct {
+    int used;
+    pid_t pid;
+    char component[metricsNameLength];
+    char site[semProfSiteLength];
+    uint64_t acquisitions;
+    uint64_t contended;        // Acquisitions that found the lock taken
+    uint64_t waitHistogram[metricsBuckets];
+    uint64_t holdHistogram[metricsBuckets];
+    double waitTotal;
+    double waitMax;
+    double holdTotal;
+    double holdMax;
+} SemProfSite;
+
+typedef struct {
+    double startTime;          // First attach (CLOCK_MONOTONIC)
+    int numSites;
+    pid_t holder;              // Process currently holding the lock, 0 when free
+    int holderSite;
+    SemProfSite sites[semProfSites];
+} SemProfTable;
+
+#define SEM_STRINGIFY_VALUE(x) #x
+#define SEM_STRINGIFY(x) SEM_STRINGIFY_VALUE(x)
+#define SEM_SITE __FILE__ ":" SEM_STRINGIFY(__LINE__)
+
+#define SEM_LOCK(sem) semProfLock((sem), SEM_SITE)
+#define SEM_UNLOCK(sem) semProfUnlock(sem)
+
+static SemProfTable *semProfTable = NULL;
+
+// Per-process cache from call site literal to table index
+static const char *semProfCacheKeys[semProfSites];
+static int semProfCacheValues[semProfSites];
+static int semProfCacheSize = 0;
+
+static int semProfHeldSite = -1;
+static double semProfAcquiredAt = 0;
+
+static inline SemProfTable *semProfOpenTable() {
+    int fd = shm_open(SEMPROF_SHM_PATH, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("shm_open semprof");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(SemProfTable)) == -1) {
+        perror("ftruncate semprof");
+        close(fd);
+        return NULL;
+    }
+    void *table = mmap(NULL, sizeof(SemProfTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        perror("mmap semprof");
+        return NULL;
+    }
+
+    double zero = 0, now = metricsNow();
+    __atomic_compare_exchange(&((SemProfTable *)table)->startTime, &zero, &now, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return (SemProfTable *)table;
+}
+
+// Table entry of a call site of this component, -1 when the table is full.
+// A restarted process finds the entries of its previous instance again.
+static inline int semProfSiteIndex(const char *site) {
+    for (int i = 0; i < semProfCacheSize; i++) {
+        if (semProfCacheKeys[i] == site) {
+            return semProfCacheValues[i];
+        }
+    }
+
+    const char *component = metricsSelf != NULL ? metricsSelf->name : "unknown";
+    int index = -1;
+    int count = __atomic_load_n(&semProfTable->numSites, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count && i < semProfSites; i++) {
+        SemProfSite *entry = &semProfTable->sites[i];
+        if (entry->used && strcmp(entry->component, component) == 0 && strcmp(entry->site, site) == 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1) {
+        index = __atomic_fetch_add(&semProfTable->numSites, 1, __ATOMIC_ACQ_REL);
+        if (index >= semProfSites) {
+            return -1;
+        }
+        SemProfSite *entry = &semProfTable->sites[index];
+        snprintf(entry->component, sizeof(entry->component), "%s", component);
+        snprintf(entry->site, sizeof(entry->site), "%s", site);
+        __atomic_store_n(&entry->used, 1, __ATOMIC_RELEASE);
+    }
+    semProfTable->sites[index].pid = getpid();
+
+    if (semProfCacheSize < semProfSites) {
+        semProfCacheKeys[semProfCacheSize] = site;
+        semProfCacheValues[semProfCacheSize] = index;
+        semProfCacheSize++;
+    }
+    return index;
+}
+
+// sem_wait that retries when a signal (the watchdog heartbeat) interrupts it
+// and records the wait of this call site
+static inline int semProfLock(sem_t *sem, const char *site) {
+    double start = metricsNow();
+    int contended = 0;
+    int result = sem_trywait(sem);
+
+    if (result == -1) {
+        contended = 1;
+        do {
+            result = sem_wait(sem);
+        } while (result == -1 && errno == EINTR);
+    }
+    if (result == -1) {
+        return result;
+    }
+
+    double acquired = metricsNow();
+    double waited = acquired - start;
+    metricsRecordSemWait(waited);
+
+    if (semProfTable == NULL) {
+        semProfTable = semProfOpenTable();
+    }
+    semProfHeldSite = semProfTable != NULL ? semProfSiteIndex(site) : -1;
+    semProfAcquiredAt = acquired;
+
+    if (semProfHeldSite >= 0) {
+        SemProfSite *entry = &semProfTable->sites[semProfHeldSite];
+        entry->acquisitions++;
+        entry->contended += contended;
+        entry->waitHistogram[metricsBucket(waited)]++;
+        entry->waitTotal += waited;
+        if (waited > entry->waitMax) {
+            entry->waitMax = waited;
+        }
+        semProfTable->holder = getpid();
+        semProfTable->holderSite = semProfHeldSite;
+    }
+    return result;
+}
+
+static inline int semProfUnlock(sem_t *sem) {
+    if (semProfHeldSite >= 0) {
+        double held = metricsNow() - semProfAcquiredAt;
+        SemProfSite *entry = &semProfTable->sites[semProfHeldSite];
+        entry->holdHistogram[metricsBucket(held)]++;
+        entry->holdTotal += held;
+        if (held > entry->holdMax) {
+            entry->holdMax = held;
+        }
+        semProfTable->holder = 0;
+        semProfHeldSite = -1;
+    }
+    return sem_post(sem);
+}
+
+#endif
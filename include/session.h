@@ -0,0 +1,94 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constant.h"
+
+// Sessions hosted by sessionServer. Every session is a private world (drone,
+// obstacles, targets, score) in its own shared-memory segment, named after
+// SESSION_SHM_PREFIX and the session number, next to the force its client
+// wants applied. The server publishes the world with a sequence lock, so a
+// client reads it without ever stopping the shard that steps it.
+
+#define SESSION_SHM_PREFIX "/shm_session_"
+#define sessionMaxSessions 4096
+
+typedef struct {
+    atomic_int force[2];           // Written by the client, applied at the next step
+    atomic_uint sequence;          // Odd while the server is publishing
+    WorldState state;
+} SessionSegment;
+
+static inline void sessionName(char *name, size_t size, int session) {
+    snprintf(name, size, SESSION_SHM_PREFIX "%d", session);
+}
+
+// Map the segment of a session, creating it (server only) or attaching to it.
+// NULL on error.
+static inline SessionSegment *sessionOpen(int session, int create) {
+    char name[64];
+    sessionName(name, sizeof(name), session);
+
+    int fd = shm_open(name, create ? O_CREAT | O_RDWR : O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if (create && ftruncate(fd, sizeof(SessionSegment)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    SessionSegment *segment = mmap(NULL, sizeof(SessionSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return segment == MAP_FAILED ? NULL : segment;
+}
+
+static inline void sessionClose(SessionSegment *segment) {
+    munmap(segment, sizeof(SessionSegment));
+}
+
+static inline void sessionUnlink(int session) {
+    char name[64];
+    sessionName(name, sizeof(name), session);
+    shm_unlink(name);
+}
+
+// Server side: the shard stepping a session is its only writer
+static inline void sessionPublish(SessionSegment *segment, const WorldState *state) {
+    unsigned int sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+    atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&segment->state, state, worldStateSize);
+    atomic_store_explicit(&segment->sequence, sequence + 2, memory_order_release);
+}
+
+// Client side: retry the copy until no publish ran during it
+static inline void sessionRead(SessionSegment *segment, WorldState *state) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(state, &segment->state, worldStateSize);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+static inline void sessionSetForce(SessionSegment *segment, int forceX, int forceY) {
+    atomic_store_explicit(&segment->force[0], forceX, memory_order_relaxed);
+    atomic_store_explicit(&segment->force[1], forceY, memory_order_relaxed);
+}
+
+#endif
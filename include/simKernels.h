@@ -0,0 +1,421 @@
+#ifndef SIM_KERNELS_H
+#define SIM_KERNELS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "constant.h"
+#include "rng.h"
+#include "placement.h"
+
+// The simulation itself, free of processes, pipes and shared memory: the drone
+// physics, the placement of obstacles and targets and the hit checks. The
+// components run them on the shared world, sessionServer on many private
+// ones. Random numbers come from the caller's generator (include/rng.h), so
+// independent worlds never share one. Obstacles and targets are placed at
+// least simSpacing from each other and from the drone (include/placement.h).
+
+// Physical constants of a world, simDefaultParams are those of constant.h
+typedef struct {
+    double mass;
+    double friction;
+    double timeStep;
+    double radius;             // Distance at which an obstacle or target is hit
+} SimParams;
+
+#define simDefaultParams {M, K, T, RADIUS}
+
+// Period of droneDynamics, one step of the physics
+#define simPhysicsPeriod 0.3
+
+// Obstacles drift at up to simObstacleSpeed board units per second and
+// bounce off the edges of [0, simObstacleBound]. Positions and velocities
+// are multiples of 1 / simObstacleQuantum, so a move is exact in doubles and
+// fits a 16-bit delta on the world stream.
+#define simObstacleSpeed 3.0
+#define simObstacleBound (boardSize - 5)
+#define simObstacleQuantum 1024.0
+
+// Change the force direction for a key of the keyboard layout (s/f left and
+// right, e/c up and down, w/r/x/v diagonals, d stops). Returns 0 for any
+// other key.
+static inline int simApplyKey(int key, int *forceDirection) {
+    switch ((char)key) {
+        case 's':
+            forceDirection[0]--; break;
+        case 'r':
+            forceDirection[0]++; forceDirection[1]--; break;
+        case 'e':
+            forceDirection[1]--; break;
+        case 'x':
+            forceDirection[0]--; forceDirection[1]++; break;
+        case 'd':
+            forceDirection[0] = 0; forceDirection[1] = 0; break;  // Stop (no movement)
+        case 'c':
+            forceDirection[1]++; break;
+        case 'w':
+            forceDirection[0]--; forceDirection[1]--; break;
+        case 'f':
+            forceDirection[0]++; break;
+        case 'v':
+            forceDirection[0]++; forceDirection[1]++; break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+// New position on one axis from the force and the last two positions (Euler)
+static inline double simComputePosition(const SimParams *params, double force, double x1, double x2) {
+    return x1 + (force * params->timeStep) -
+           ((params->mass * (x1 - x2)) / (params->mass + params->friction * params->timeStep));
+}
+
+// One physics step of the drone under the force (fx, fy): position holds the
+// last three (x, y) pairs, oldest first, and is shifted by one pair
+static inline void simStepForce(const SimParams *params, double *position, double fx, double fy) {
+    double newPositionX = simComputePosition(params, fx, position[4], position[2]);
+    double newPositionY = simComputePosition(params, fy, position[5], position[3]);
+
+    // Boundary conditions
+    newPositionX = fmax(0, fmin(newPositionX, boardSize));
+    newPositionY = fmax(0, fmin(newPositionY, boardSize));
+
+    memmove(position, position + 2, 4 * sizeof(double));
+    position[4] = newPositionX;
+    position[5] = newPositionY;
+}
+
+static inline void simStep(const SimParams *params, double *position, const int *forceDirection) {
+    simStepForce(params, position, forceDirection[0], forceDirection[1]);
+}
+
+// Potential field around the drone, added to the user's force when enabled
+// (WorldState.forceField): obstacles within simFieldCutoff push it away and,
+// with simFieldAttract, the nearest target pulls it in. The repulsion of an
+// obstacle at offset d is simFieldRepulsion * (1 - |d|^2 / cutoff^2)^2 * d /
+// |d|^2, which fades to nothing at the cutoff and needs no square root, so
+// the loop over the obstacles vectorizes.
+#define simFieldRepel 1
+#define simFieldAttract 2
+#define simFieldCutoff (4 * RADIUS)
+#define simFieldRepulsion 6.0
+#define simFieldAttraction 1.0
+#define simFieldSoftening (RADIUS * RADIUS / 4)   // Keeps the push finite on top of an obstacle
+
+// Repulsion of count obstacles at (x[i], y[i]) on the drone at (px, py),
+// added to (*fx, *fy)
+static inline void simFieldRepulse(const double *restrict x, const double *restrict y, int count, double px,
+                                   double py, double *fx, double *fy) {
+    double limit = 1.0 / (simFieldCutoff * simFieldCutoff);
+    double sumX = 0, sumY = 0;
+
+    for (int i = 0; i < count; ++i) {
+        double dx = px - x[i];
+        double dy = py - y[i];
+        double d2 = dx * dx + dy * dy;
+        double w = 1 - d2 * limit;
+        w = (w + fabs(w)) * 0.5;   // max(w, 0) without a branch
+        double scale = simFieldRepulsion * w * w / (d2 + simFieldSoftening);
+        sumX += scale * dx;
+        sumY += scale * dy;
+    }
+    *fx += sumX;
+    *fy += sumY;
+}
+
+// Obstacles bucketed by cells at least simFieldCutoff wide, stored cell by
+// cell as a structure of arrays. The cells that can be in reach of the drone
+// are the 3x3 block around its own, and the three cells of a row are stored
+// next to each other, so a lookup is three runs of simFieldRepulse over
+// consecutive obstacles whatever the number on the board.
+typedef struct {
+    double cellSize;
+    int columns;
+    int *start;                // Offset of every cell's first obstacle, columns^2 + 1 entries
+    int *cell;                 // Cell of every obstacle while building
+    double *x, *y;
+    int capacity;
+} SimGrid;
+
+// Room for capacity obstacles on a board of side extent, -1 when out of memory
+static inline int simGridAlloc(SimGrid *grid, int capacity, double extent) {
+    grid->columns = (int)(extent / simFieldCutoff) + 1;
+    grid->cellSize = extent / grid->columns > simFieldCutoff ? extent / grid->columns : simFieldCutoff;
+    grid->capacity = capacity;
+    size_t size = (capacity > 0 ? capacity : 1);
+    grid->start = malloc(((size_t)grid->columns * grid->columns + 1) * sizeof(int));
+    grid->cell = malloc(size * sizeof(int));
+    grid->x = malloc(size * sizeof(double));
+    grid->y = malloc(size * sizeof(double));
+    if (grid->start == NULL || grid->cell == NULL || grid->x == NULL || grid->y == NULL) {
+        free(grid->start);
+        free(grid->cell);
+        free(grid->x);
+        free(grid->y);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void simGridFree(SimGrid *grid) {
+    free(grid->start);
+    free(grid->cell);
+    free(grid->x);
+    free(grid->y);
+}
+
+static inline int simGridCoordinate(const SimGrid *grid, double value) {
+    int index = (int)(value / grid->cellSize);
+    return index < 0 ? 0 : index >= grid->columns ? grid->columns - 1 : index;
+}
+
+// Sort up to capacity obstacles into their cells (a counting sort)
+static inline void simGridBuild(SimGrid *grid, const Point *obstacles, int count) {
+    int cells = grid->columns * grid->columns;
+    count = count < grid->capacity ? count : grid->capacity;
+
+    memset(grid->start, 0, (cells + 1) * sizeof(int));
+    for (int i = 0; i < count; ++i) {
+        grid->cell[i] = simGridCoordinate(grid, obstacles[i].y) * grid->columns +
+                        simGridCoordinate(grid, obstacles[i].x);
+        grid->start[grid->cell[i] + 1]++;
+    }
+    for (int c = 0; c < cells; ++c) {
+        grid->start[c + 1] += grid->start[c];
+    }
+    // start[c + 1] is now the end of cell c; filling from the back moves it to
+    // the cell's first entry, one place too far up
+    for (int i = count - 1; i >= 0; --i) {
+        int slot = --grid->start[grid->cell[i] + 1];
+        grid->x[slot] = obstacles[i].x;
+        grid->y[slot] = obstacles[i].y;
+    }
+    memmove(grid->start, grid->start + 1, cells * sizeof(int));
+    grid->start[cells] = count;
+}
+
+// Field force on the drone at (px, py): the repulsion of the obstacles in
+// the grid and, with simFieldAttract in mode, the pull of the nearest target
+static inline void simFieldForce(const SimGrid *grid, const Point *targets, int numTargets, int mode, double px,
+                                 double py, double *fx, double *fy) {
+    *fx = *fy = 0;
+    if (mode & simFieldRepel) {
+        int column = simGridCoordinate(grid, px);
+        int row = simGridCoordinate(grid, py);
+        int first = column > 0 ? column - 1 : 0;
+        int last = column < grid->columns - 1 ? column + 1 : column;
+        for (int r = row - 1; r <= row + 1; ++r) {
+            if (r < 0 || r >= grid->columns) {
+                continue;
+            }
+            int begin = grid->start[r * grid->columns + first];
+            int end = grid->start[r * grid->columns + last + 1];
+            simFieldRepulse(grid->x + begin, grid->y + begin, end - begin, px, py, fx, fy);
+        }
+    }
+    if (mode & simFieldAttract) {
+        int nearest = -1;
+        double best = INFINITY;
+        for (int i = 0; i < numTargets; ++i) {
+            double d2 = (targets[i].x - px) * (targets[i].x - px) + (targets[i].y - py) * (targets[i].y - py);
+            if (targets[i].number > 0 && d2 < best) {
+                best = d2;
+                nearest = i;
+            }
+        }
+        if (nearest != -1 && best > 0) {
+            double distance = sqrt(best);
+            *fx += simFieldAttraction * (targets[nearest].x - px) / distance;
+            *fy += simFieldAttraction * (targets[nearest].y - py) / distance;
+        }
+    }
+}
+
+// Minimum distance between obstacles, targets and the drone when placed, so
+// that nothing is hit the moment it appears
+#define simSpacing (3 * RADIUS)
+
+// Capacity of a placement for one world: the drone, every entity and the
+// target that replaces a reached one
+#define simPlacementCapacity (2 + NUM_OBSTACLES + NUM_TARGETS)
+
+// Start a placement over with the drone at (droneX, droneY)
+static inline void simPlacementReset(Placement *placement, double droneX, double droneY) {
+    placementClear(placement);
+    placementInsert(placement, droneX, droneY);
+}
+
+// Points already in the world that new ones have to keep away from
+static inline void simPlacementKeep(Placement *placement, const Point *points, int count) {
+    for (int i = 0; i < count; ++i) {
+        placementInsert(placement, points[i].x, points[i].y);
+    }
+}
+
+// One point in [0, bound)^2 away from the others: a dart first, then the
+// gaps next to the points already there, and anywhere in it when the board is
+// full. The point is kept in the placement either way.
+static inline void simPlacePoint(Placement *placement, Point *point, double bound, Rng *rng) {
+    if (placementSample(placement, rng, 1, bound, bound) == 1 ||
+        placementFill(placement, rng, 1, bound, bound) == 1) {
+        point->x = placement->xs[placement->count - 1];
+        point->y = placement->ys[placement->count - 1];
+    } else {
+        point->x = rngUniform(rng) * bound;
+        point->y = rngUniform(rng) * bound;
+        placementInsert(placement, point->x, point->y);
+    }
+}
+
+static inline void simPlaceObstacles(Placement *placement, Point *obstacles, int count, Rng *rng) {
+    for (int i = 0; i < count; ++i) {
+        simPlacePoint(placement, &obstacles[i], boardSize - 5, rng);
+    }
+}
+
+static inline void simPlaceTarget(Placement *placement, Point *target, Rng *rng) {
+    simPlacePoint(placement, target, boardSize - 10, rng);
+    target->number = rngBelow(rng, 10) + 1;
+}
+
+static inline void simPlaceTargets(Placement *placement, Point *targets, int count, Rng *rng) {
+    for (int i = 0; i < count; ++i) {
+        simPlaceTarget(placement, &targets[i], rng);
+    }
+}
+
+// Moving obstacles as a structure of arrays, so that one loop moves those
+// of many worlds at once; world w owns the entries [w * count, (w + 1) * count)
+typedef struct {
+    double *x, *y;
+    double *vx, *vy;           // Board units per tick
+} SimMotion;
+
+// Room for count obstacles, -1 when out of memory
+static inline int simMotionAlloc(SimMotion *motion, int count) {
+    size_t size = (count > 0 ? count : 1) * sizeof(double);
+    motion->x = malloc(size);
+    motion->y = malloc(size);
+    motion->vx = malloc(size);
+    motion->vy = malloc(size);
+    if (motion->x == NULL || motion->y == NULL || motion->vx == NULL || motion->vy == NULL) {
+        free(motion->x);
+        free(motion->y);
+        free(motion->vx);
+        free(motion->vy);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void simMotionFree(SimMotion *motion) {
+    free(motion->x);
+    free(motion->y);
+    free(motion->vx);
+    free(motion->vy);
+}
+
+static inline double simQuantize(double value) {
+    return round(value * simObstacleQuantum) / simObstacleQuantum;
+}
+
+// Start count obstacles from their placed points in entries first.., in
+// random directions at up to maxSpeed board units per tick
+static inline void simLaunchObstacles(SimMotion *motion, int first, const Point *obstacles, int count,
+                                      double maxSpeed, Rng *rng) {
+    double *vx = motion->vx + first;
+    double *vy = motion->vy + first;
+
+    // The headings and speeds in one pass each, in the arrays they turn into
+    rngFillUniform(rng, vx, count, 0, placementTwoPi);
+    rngFillUniform(rng, vy, count, 0, maxSpeed);
+    for (int i = 0; i < count; ++i) {
+        double angle = vx[i];
+        double speed = vy[i];
+        motion->x[first + i] = simQuantize(obstacles[i].x);
+        motion->y[first + i] = simQuantize(obstacles[i].y);
+        vx[i] = simQuantize(speed * cos(angle));
+        vy[i] = simQuantize(speed * sin(angle));
+    }
+}
+
+// Move entries first.. by one tick, bouncing off the edges of [0, bound]
+// (steps shorter than bound). Branch-free so that the compiler turns the loop
+// into vector code: bound - |bound - |p|| mirrors p back from either edge,
+// exactly on the quantum grid.
+static inline void simMoveObstacles(SimMotion *motion, int first, int count, double bound) {
+    double *restrict x = motion->x + first;
+    double *restrict y = motion->y + first;
+    double *restrict vx = motion->vx + first;
+    double *restrict vy = motion->vy + first;
+    double half = bound / 2;
+
+    for (int i = 0; i < count; ++i) {
+        double nx = x[i] + vx[i];
+        double ny = y[i] + vy[i];
+        vx[i] = fabs(nx - half) > half ? -vx[i] : vx[i];
+        vy[i] = fabs(ny - half) > half ? -vy[i] : vy[i];
+        x[i] = bound - fabs(bound - fabs(nx));
+        y[i] = bound - fabs(bound - fabs(ny));
+    }
+}
+
+// Copy entries first.. to the points the world publishes
+static inline void simMotionToPoints(const SimMotion *motion, int first, Point *obstacles, int count) {
+    for (int i = 0; i < count; ++i) {
+        obstacles[i].x = motion->x[first + i];
+        obstacles[i].y = motion->y[first + i];
+        obstacles[i].number = 0;
+    }
+}
+
+// The obstacle among entries first.. that comes within radius of the drone,
+// at (x, y) and moving by (vx, vy) per tick, over the next horizon ticks: the
+// closest approach of their relative motion. The nearest one if several, -1
+// if none. Catches the obstacles the drone would pass through between checks.
+static inline int simPredictHit(const SimMotion *motion, int first, int count, double x, double y,
+                                double vx, double vy, double horizon, double radius) {
+    int hit = -1;
+    double closest = radius * radius;
+
+    for (int i = 0; i < count; ++i) {
+        double px = x - motion->x[first + i];
+        double py = y - motion->y[first + i];
+        double rx = vx - motion->vx[first + i];
+        double ry = vy - motion->vy[first + i];
+        double speed = rx * rx + ry * ry;
+        double t = speed > 0 ? fmax(0, fmin(horizon, -(px * rx + py * ry) / speed)) : 0;
+        double dx = px + rx * t;
+        double dy = py + ry * t;
+        if (dx * dx + dy * dy < closest) {
+            closest = dx * dx + dy * dy;
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+// Index of the first point within radius of (x, y), -1 if none
+static inline int simFindHit(const Point *points, int count, double x, double y, double radius) {
+    for (int i = 0; i < count; ++i) {
+        double dx = x - points[i].x;
+        double dy = y - points[i].y;
+        if (dx * dx + dy * dy < radius * radius) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Remove a reached target, shifting the others down and placing a new one
+// last, away from the points already in placement. Returns the value of the
+// removed target.
+static inline int simReplaceTarget(Placement *placement, Point *targets, int count, int reached, Rng *rng) {
+    int value = targets[reached].number;
+    memmove(&targets[reached], &targets[reached + 1], (count - reached - 1) * sizeof(Point));
+    simPlaceTarget(placement, &targets[count - 1], rng);
+    return value;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SIMLOG_H
+#define SIMLOG_H
+
+#include <stdio.h>
+#include <time.h>
+#include "constant.h"
+
+// The log lines of droneDynamics and targets, shared with kernelBench so that
+// log.drone and log.targets time what the components write. Every call is one
+// timestamp, the lines and a flush.
+
+static inline void simLogTimestamp(char *buffer, size_t size) {
+    time_t rawtime;
+    struct tm info;
+
+    time(&rawtime);
+    localtime_r(&rawtime, &info);
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &info);
+}
+
+// The drone before and after a physics step
+static inline void simLogDrone(FILE *logFile, const double *position) {
+    char buffer[80];
+
+    simLogTimestamp(buffer, sizeof(buffer));
+    fprintf(logFile, "[%s] Previous position: (%.2f, %.2f) | Updated Position: (%.2f, %.2f)\n", buffer,
+            position[2], position[3], position[4], position[5]);
+    fflush(logFile);
+}
+
+static inline void simLogTargets(FILE *logFile, const Point *targets, int count) {
+    char buffer[80];
+
+    simLogTimestamp(buffer, sizeof(buffer));
+    for (int i = 0; i < count; ++i) {
+        fprintf(logFile, "[%s] Target %d position: (%.2f, %.2f) | Generated Number: %d\n", buffer, i + 1,
+                targets[i].x, targets[i].y, targets[i].number);
+    }
+    fflush(logFile);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include <time.h>
+#include "metrics.h"
+
+// Readiness barrier: master creates the segment, every component announces
+// itself once it has attached to its pipes and shared memory, and waits until
+// master starts the simulation clock. A restarted component finds the clock
+// already running and goes straight to its loop.
+//
+// Every component also reports its own PID in the slot of its instance,
+// whose index master passes in COMPONENT_ENV, and the status it exits with
+// through exit(). For a component run inside konsole master only spawns
+// konsole: the slot is how it learns which process to supervise, and whether
+// the component quit or was killed.
+
+#define STARTUP_SHM_PATH "/shm_startup"
+#define startupMaxEntries 32
+#define startupTimeout 5.0
+#define startupRecheck 0.05         // Seconds between checks of the start flag
+#define COMPONENT_ENV "ARP_COMPONENT"
+
+typedef struct {
+    pid_t pid;                 // Reported by the component, 0 until then
+    int exited;                // The component returned through exit()
+    int status;                // Its exit status then
+} StartupSlot;
+
+typedef struct {
+    pid_t pid;
+    char name[metricsNameLength];
+    double readyAt;            // CLOCK_MONOTONIC
+} StartupEntry;
+
+typedef struct {
+    sem_t ready;               // Posted by every component once attached
+    sem_t start;               // Posted by master for every waiting component
+    int started;
+    int numReady;
+    double launchTime;
+    double startTime;
+    StartupEntry entries[startupMaxEntries];
+    StartupSlot slots[startupMaxEntries];
+} StartupBarrier;
+
+#ifndef THREADED_MODE
+static void startupExited(int status, void *argument) {
+    StartupSlot *slot = argument;
+    slot->status = status;
+    __atomic_store_n(&slot->exited, 1, __ATOMIC_RELEASE);
+}
+
+// Fill the slot master gave this instance; the mapping stays for the exit
+// handler
+static inline void startupReport(StartupBarrier *barrier) {
+    const char *index = getenv(COMPONENT_ENV);
+    if (index == NULL || atoi(index) < 0 || atoi(index) >= startupMaxEntries) {
+        return;
+    }
+    StartupSlot *slot = &barrier->slots[atoi(index)];
+    slot->exited = 0;
+    __atomic_store_n(&slot->pid, getpid(), __ATOMIC_RELEASE);
+    on_exit(startupExited, slot);
+}
+#endif
+
+// Announce that the caller is attached, then wait for the simulation clock.
+// Without a barrier segment (component started by hand) it returns at once.
+static inline void startupBarrier(const char *name) {
+    int fd = shm_open(STARTUP_SHM_PATH, O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return;
+    }
+    StartupBarrier *barrier = mmap(NULL, sizeof(StartupBarrier), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (barrier == MAP_FAILED) {
+        perror("mmap startup barrier");
+        return;
+    }
+#ifndef THREADED_MODE
+    startupReport(barrier);
+#endif
+
+    if (!__atomic_load_n(&barrier->started, __ATOMIC_ACQUIRE)) {
+        int index = __atomic_fetch_add(&barrier->numReady, 1, __ATOMIC_ACQ_REL);
+        if (index < startupMaxEntries) {
+            barrier->entries[index].pid = getpid();
+            snprintf(barrier->entries[index].name, sizeof(barrier->entries[index].name), "%s", name);
+            barrier->entries[index].readyAt = metricsNow();
+        }
+        sem_post(&barrier->ready);
+
+        // Master posts a token for every component registered when it
+        // starts the clock; one that registered just after only finds the
+        // flag set, so the wait is bounded and the flag checked again
+        while (!__atomic_load_n(&barrier->started, __ATOMIC_ACQUIRE)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)(startupRecheck * 1e9);
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (sem_timedwait(&barrier->start, &deadline) == 0) {
+                break;
+            }
+            if (errno != EINTR && errno != ETIMEDOUT) {
+                perror("sem_timedwait startup barrier");
+                break;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Drone telemetry kept by server. Every physics step published by
+// droneDynamics is a sample; samples are folded into 1 s aggregates, ten of
+// those into a 10 s aggregate and six of those into a 60 s one. The last
+// telemetryRingLength aggregates of each resolution stay in memory and every
+// closed aggregate is appended to TELEMETRY_PATH as a fixed-size record.
+
+#define TELEMETRY_PATH "log/telemetry.bin"
+#define telemetryMagic 0x4d4c4554      // "TELM"
+#define telemetryVersion 1
+#define telemetryPeriod 0.01           // Seconds between checks for a new step
+#define telemetryLevels 3
+#define telemetryRingLength 60
+
+static const uint32_t telemetryResolutions[telemetryLevels] = {1, 10, 60};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+} TelemetryFileHeader;
+
+// One aggregate, also the on-disk record
+typedef struct {
+    double start;              // CLOCK_MONOTONIC time the window opened
+    uint32_t resolution;       // Seconds covered
+    uint32_t samples;          // Physics steps seen
+    uint32_t missed;           // Steps published but overwritten before sampled
+    int32_t obstacleHits;
+    int32_t targetHits;
+    float minX, maxX, minY, maxY;
+    float meanX, meanY;
+    float meanSpeed;           // Over the samples that had a previous one
+    float maxSpeed;
+    float distance;            // Path length travelled
+} TelemetryAggregate;
+
+typedef struct {
+    TelemetryAggregate entries[telemetryRingLength];
+    int count;
+    int next;
+    TelemetryAggregate open;
+    int merged;                // Finer aggregates folded into open
+    uint32_t speedSamples;     // Samples behind open.meanSpeed
+} TelemetryRing;
+
+typedef struct {
+    TelemetryRing levels[telemetryLevels];
+    FILE *file;
+    int hasLast;
+    double lastX, lastY, lastTime;
+} Telemetry;
+
+static inline void telemetryReset(TelemetryAggregate *aggregate, double start, uint32_t resolution) {
+    memset(aggregate, 0, sizeof(*aggregate));
+    aggregate->start = start;
+    aggregate->resolution = resolution;
+}
+
+// Open the record file, appending after a restart. Returns -1 if it cannot be
+// opened, the aggregates are then only kept in memory.
+static inline int telemetryOpen(Telemetry *telemetry, const char *path, int append, double now) {
+    memset(telemetry, 0, sizeof(*telemetry));
+    for (int i = 0; i < telemetryLevels; i++) {
+        telemetryReset(&telemetry->levels[i].open, now, telemetryResolutions[i]);
+    }
+
+    telemetry->file = fopen(path, append ? "ab" : "wb");
+    if (telemetry->file == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (ftell(telemetry->file) == 0) {
+        TelemetryFileHeader header = {telemetryMagic, telemetryVersion, sizeof(TelemetryAggregate)};
+        fwrite(&header, sizeof(header), 1, telemetry->file);
+    }
+    return 0;
+}
+
+static inline void telemetryClose(Telemetry *telemetry) {
+    if (telemetry->file != NULL) {
+        fclose(telemetry->file);
+        telemetry->file = NULL;
+    }
+}
+
+// Fold a finer aggregate (or, for the 1 s level, a single sample) into another
+static inline void telemetryMerge(TelemetryAggregate *into, uint32_t *intoSpeedSamples,
+                                  const TelemetryAggregate *from, uint32_t fromSpeedSamples) {
+    if (from->samples > 0) {
+        if (into->samples == 0) {
+            into->minX = from->minX;
+            into->maxX = from->maxX;
+            into->minY = from->minY;
+            into->maxY = from->maxY;
+        } else {
+            into->minX = fminf(into->minX, from->minX);
+            into->maxX = fmaxf(into->maxX, from->maxX);
+            into->minY = fminf(into->minY, from->minY);
+            into->maxY = fmaxf(into->maxY, from->maxY);
+        }
+        uint32_t samples = into->samples + from->samples;
+        into->meanX += (from->meanX - into->meanX) * from->samples / samples;
+        into->meanY += (from->meanY - into->meanY) * from->samples / samples;
+        into->samples = samples;
+    }
+    if (fromSpeedSamples > 0) {
+        uint32_t speedSamples = *intoSpeedSamples + fromSpeedSamples;
+        into->meanSpeed += (from->meanSpeed - into->meanSpeed) * fromSpeedSamples / speedSamples;
+        *intoSpeedSamples = speedSamples;
+    }
+    into->maxSpeed = fmaxf(into->maxSpeed, from->maxSpeed);
+    into->distance += from->distance;
+    into->missed += from->missed;
+    into->obstacleHits += from->obstacleHits;
+    into->targetHits += from->targetHits;
+}
+
+// Record one physics step, missed counts the steps skipped since the last one
+static inline void telemetrySample(Telemetry *telemetry, double x, double y, double now, uint32_t missed) {
+    TelemetryAggregate sample;
+    telemetryReset(&sample, now, 0);
+    sample.samples = 1;
+    sample.minX = sample.maxX = sample.meanX = x;
+    sample.minY = sample.maxY = sample.meanY = y;
+    sample.missed = missed;
+
+    uint32_t speedSamples = 0;
+    if (telemetry->hasLast && now > telemetry->lastTime) {
+        double step = hypot(x - telemetry->lastX, y - telemetry->lastY);
+        sample.distance = step;
+        sample.meanSpeed = sample.maxSpeed = step / (now - telemetry->lastTime);
+        speedSamples = 1;
+    }
+    telemetry->hasLast = 1;
+    telemetry->lastX = x;
+    telemetry->lastY = y;
+    telemetry->lastTime = now;
+
+    TelemetryRing *ring = &telemetry->levels[0];
+    telemetryMerge(&ring->open, &ring->speedSamples, &sample, speedSamples);
+}
+
+static inline void telemetryHits(Telemetry *telemetry, int obstacleHits, int targetHits) {
+    telemetry->levels[0].open.obstacleHits += obstacleHits;
+    telemetry->levels[0].open.targetHits += targetHits;
+}
+
+// Close the open aggregate of a level: store it in the ring, append it to the
+// file and fold it into the next level, closing that one in turn when full
+static inline void telemetryCloseLevel(Telemetry *telemetry, int level) {
+    TelemetryRing *ring = &telemetry->levels[level];
+
+    ring->entries[ring->next] = ring->open;
+    ring->next = (ring->next + 1) % telemetryRingLength;
+    if (ring->count < telemetryRingLength) {
+        ring->count++;
+    }
+    if (telemetry->file != NULL) {
+        fwrite(&ring->open, sizeof(ring->open), 1, telemetry->file);
+    }
+
+    if (level + 1 < telemetryLevels) {
+        TelemetryRing *coarser = &telemetry->levels[level + 1];
+        telemetryMerge(&coarser->open, &coarser->speedSamples, &ring->open, ring->speedSamples);
+        coarser->merged++;
+        if (coarser->merged * telemetryResolutions[level] >= telemetryResolutions[level + 1]) {
+            telemetryCloseLevel(telemetry, level + 1);
+        }
+    }
+
+    telemetryReset(&ring->open, ring->open.start + ring->open.resolution, ring->open.resolution);
+    ring->merged = 0;
+    ring->speedSamples = 0;
+}
+
+// Close every 1 s window that has elapsed, seconds without steps included so
+// the coarser windows stay aligned. The file is flushed once per call.
+static inline void telemetryTick(Telemetry *telemetry, double now) {
+    int closed = 0;
+    while (now >= telemetry->levels[0].open.start + telemetryResolutions[0]) {
+        telemetryCloseLevel(telemetry, 0);
+        closed = 1;
+    }
+    if (closed && telemetry->file != NULL) {
+        fflush(telemetry->file);
+    }
+}
+
+// Most recent closed aggregate of a level, NULL if there is none yet
+static inline const TelemetryAggregate *telemetryLatest(const Telemetry *telemetry, int level) {
+    const TelemetryRing *ring = &telemetry->levels[level];
+    if (ring->count == 0) {
+        return NULL;
+    }
+    return &ring->entries[(ring->next + telemetryRingLength - 1) % telemetryRingLength];
+}
+
+static inline int telemetryFormatAggregate(const TelemetryAggregate *a, char *buffer, size_t size) {
+    return snprintf(buffer, size,
+                    "%4us %7u %6u %7.2f %7.2f %7.2f %7.2f %7.2f %7.2f %8.2f %8.2f %9.2f %5d %5d\n",
+                    a->resolution, a->samples, a->missed, a->minX, a->maxX, a->minY, a->maxY,
+                    a->meanX, a->meanY, a->meanSpeed, a->maxSpeed, a->distance,
+                    a->obstacleHits, a->targetHits);
+}
+
+static inline int telemetryFormatHeader(char *buffer, size_t size) {
+    return snprintf(buffer, size,
+                    "%5s %7s %6s %7s %7s %7s %7s %7s %7s %8s %8s %9s %5s %5s\n",
+                    "res", "samples", "missed", "min_x", "max_x", "min_y", "max_y", "mean_x", "mean_y",
+                    "speed", "max_spd", "distance", "obst", "targ");
+}
+
+// The latest closed aggregate of every resolution, for the metrics snapshot
+static inline int telemetryFormat(const Telemetry *telemetry, char *buffer, size_t size) {
+    int length = telemetryFormatHeader(buffer, size);
+    for (int i = 0; i < telemetryLevels && length < (int)size; i++) {
+        const TelemetryAggregate *latest = telemetryLatest(telemetry, i);
+        if (latest != NULL) {
+            length += telemetryFormatAggregate(latest, buffer + length, size - length);
+        }
+    }
+    return length < (int)size ? length : (int)size - 1;
+}
+
+#endif
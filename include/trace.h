@@ -0,0 +1,150 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Hot path tracing, compiled in with make TRACE=1 (TRACE_ENABLED) and to
+// nothing otherwise. Every component thread that calls metricsAttach gets a
+// buffer of its own, a file under TRACE_DIR mapped shared, and is the only
+// writer of it: recording an event is a copy into the next slot of the ring
+// and a release store of the head, with no lock and no system call, and the
+// buffer survives the process if it is killed. bin/traceMerge turns the
+// buffers into one Chrome/Perfetto trace with a track per component. Spans
+// (traceBegin/traceEnd) nest per thread; the names are copied and cut to
+// traceNameLength - 2 characters.
+
+#define TRACE_DIR "log/trace"
+#define traceMagic 0x45435254          // "TRCE"
+#define traceCapacity (1 << 16)        // Events per buffer, the oldest are overwritten
+#define traceNameLength 24
+
+enum {
+    traceSpanBegin = 'B',
+    traceSpanEnd = 'E',
+    traceCounterEvent = 'C',
+    traceInstantEvent = 'i'
+};
+
+typedef struct {
+    uint64_t time;                     // CLOCK_MONOTONIC nanoseconds, shared by every process
+    int64_t value;                     // Counters only
+    char type;
+    char name[traceNameLength - 1];
+} TraceEvent;
+
+typedef struct {
+    uint32_t magic;
+    int32_t pid, tid;
+    uint32_t capacity;
+    char component[traceNameLength];
+    atomic_uint_least64_t head;        // Events recorded so far
+    TraceEvent events[traceCapacity];
+} TraceBuffer;
+
+#ifdef TRACE_ENABLED
+
+static _Thread_local TraceBuffer *traceSelf = NULL;
+
+static inline uint64_t traceNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Map the buffer of the calling thread; failures only disable its tracing
+static inline void traceAttach(const char *component) {
+    int tid;
+#ifdef THREADED_MODE
+    tid = gettid();
+#else
+    tid = getpid();
+#endif
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s-%d.bin", TRACE_DIR, component, tid);
+    mkdir("log", 0755);
+    mkdir(TRACE_DIR, 0755);
+
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(TraceBuffer)) == -1) {
+        perror("trace buffer");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    TraceBuffer *buffer = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED) {
+        perror("mmap trace buffer");
+        return;
+    }
+    buffer->pid = getpid();
+    buffer->tid = tid;
+    buffer->capacity = traceCapacity;
+    snprintf(buffer->component, sizeof(buffer->component), "%s", component);
+    atomic_store_explicit(&buffer->head, 0, memory_order_relaxed);
+    buffer->magic = traceMagic;
+    traceSelf = buffer;
+}
+
+// The buffers of a previous run, master only
+static inline void traceReset() {
+    DIR *directory = opendir(TRACE_DIR);
+    if (directory == NULL) {
+        return;
+    }
+    char path[300];
+    for (struct dirent *entry = readdir(directory); entry != NULL; entry = readdir(directory)) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && strcmp(entry->d_name + length - 4, ".bin") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", TRACE_DIR, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(directory);
+}
+
+static inline void traceRecord(char type, const char *name, int64_t value) {
+    TraceBuffer *buffer = traceSelf;
+    if (buffer == NULL) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    TraceEvent *event = &buffer->events[head & (traceCapacity - 1)];
+    event->time = traceNow();
+    event->value = value;
+    event->type = type;
+    int i = 0;
+    for (; i < traceNameLength - 2 && name[i] != '\0'; i++) {
+        event->name[i] = name[i];
+    }
+    event->name[i] = '\0';
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+#define traceBegin(name) traceRecord(traceSpanBegin, (name), 0)
+#define traceEnd(name) traceRecord(traceSpanEnd, (name), 0)
+#define traceCounter(name, value) traceRecord(traceCounterEvent, (name), (int64_t)(value))
+#define traceInstant(name) traceRecord(traceInstantEvent, (name), 0)
+
+#else
+
+#define traceAttach(component) ((void)0)
+#define traceReset() ((void)0)
+#define traceBegin(name) ((void)0)
+#define traceEnd(name) ((void)0)
+#define traceCounter(name, value) ((void)0)
+#define traceInstant(name) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constant.h"
+#include "semProfiler.h"
+#include "policy.h"
+
+// Shared world state (a WorldState at SHM_PATH). Components copy it in and
+// out with worldRead/worldWrite, field by field with worldReadField/
+// worldWriteField, or change it in place with worldUpdate. In the normal build
+// that happens under the SEM_PATH lock, profiled per call site; with
+// THREADED_MODE the state is an in-process buffer published with a sequence
+// lock, so readers never block and writers only wait for each other. Every
+// write increments the generation.
+//
+// Every write also posts the eventfd master names in WORLD_NOTIFY_ENV, so a
+// reader that only cares about changes waits for it in poll or epoll rather
+// than copying the state on a timer.
+
+#define WORLD_NOTIFY_ENV "ARP_WORLD_NOTIFY"
+
+typedef void (*WorldUpdate)(WorldState *state, void *argument);
+
+// Master only, the components inherit the descriptor
+static inline int worldNotifyCreate() {
+    int fd = eventfd(0, EFD_NONBLOCK);
+    if (fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    char text[16];
+    snprintf(text, sizeof(text), "%d", fd);
+    setenv(WORLD_NOTIFY_ENV, text, 1);
+    return 0;
+}
+
+// -1 when the component runs without master
+static inline int worldNotifyFD() {
+    const char *value = getenv(WORLD_NOTIFY_ENV);
+    return value != NULL ? atoi(value) : -1;
+}
+
+// A full counter already means the reader has a change to look at
+static inline void worldNotify(int fd) {
+    if (fd != -1) {
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+#ifndef THREADED_MODE
+
+typedef struct {
+    sem_t *sem;
+    void *shm;
+    int notifyFD;
+} World;
+
+// Create the lock and the segment, master only
+static inline int worldCreate(const void *initial, size_t size) {
+    sem_unlink(SEM_PATH);
+    shm_unlink(SHM_PATH);
+
+    sem_t *sem = sem_open(SEM_PATH, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 1);
+    if (sem == SEM_FAILED) {
+        perror("sem_open");
+        return -1;
+    }
+    sem_close(sem);
+
+    int shmFD = shm_open(SHM_PATH, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (shmFD < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    if (ftruncate(shmFD, SHM_SIZE) == -1) {
+        perror("ftruncate");
+        close(shmFD);
+        return -1;
+    }
+    void *shm = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
+    close(shmFD);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    memcpy(shm, initial, size);
+    munmap(shm, SHM_SIZE);
+    return worldNotifyCreate();
+}
+
+static inline void worldDestroy() {
+    shm_unlink(SHM_PATH);
+    sem_unlink(SEM_PATH);
+}
+
+// Attach to the world created by master
+static inline int worldAttach(World *world) {
+    world->sem = sem_open(SEM_PATH, 0);
+    if (world->sem == SEM_FAILED) {
+        perror("sem_open");
+        return -1;
+    }
+    int shmFD = shm_open(SHM_PATH, O_RDWR, S_IRUSR | S_IWUSR);
+    if (shmFD < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    world->shm = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
+    close(shmFD);
+    if (world->shm == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    policyApplyMemory(world->shm, SHM_SIZE, policyMemoryFromEnv());
+    world->notifyFD = worldNotifyFD();
+    return 0;
+}
+
+static inline void worldDetach(World *world) {
+    munmap(world->shm, SHM_SIZE);
+    sem_close(world->sem);
+}
+
+static inline void worldReadAt(World *world, size_t offset, void *destination, size_t size, const char *site) {
+    traceBegin("worldRead");
+    semProfLock(world->sem, site);
+    memcpy(destination, (char *)world->shm + offset, size);
+    semProfUnlock(world->sem);
+    traceEnd("worldRead");
+}
+
+static inline void worldWriteAt(World *world, size_t offset, const void *source, size_t size, const char *site) {
+    traceBegin("worldWrite");
+    semProfLock(world->sem, site);
+    memcpy((char *)world->shm + offset, source, size);
+    ((WorldState *)world->shm)->generation++;
+    semProfUnlock(world->sem);
+    worldNotify(world->notifyFD);
+    traceEnd("worldWrite");
+}
+
+static inline void worldUpdateAt(World *world, WorldUpdate update, void *argument, const char *site) {
+    traceBegin("worldUpdate");
+    semProfLock(world->sem, site);
+    update((WorldState *)world->shm, argument);
+    ((WorldState *)world->shm)->generation++;
+    semProfUnlock(world->sem);
+    worldNotify(world->notifyFD);
+    traceEnd("worldUpdate");
+}
+
+#else
+
+#include <stdatomic.h>
+#include <sched.h>
+
+typedef struct {
+    atomic_uint sequence;      // Odd while a writer is copying
+    atomic_flag writerLock;
+    _Alignas(WorldState) unsigned char data[SHM_SIZE];
+} PublishedWorld;
+
+// Defined once, by the threaded master
+extern PublishedWorld publishedWorld;
+
+typedef struct {
+    PublishedWorld *published;
+    int notifyFD;
+} World;
+
+static inline int worldCreate(const void *initial, size_t size) {
+    atomic_store(&publishedWorld.sequence, 0);
+    atomic_flag_clear(&publishedWorld.writerLock);
+    memcpy(publishedWorld.data, initial, size);
+    return worldNotifyCreate();
+}
+
+static inline void worldDestroy() {
+}
+
+static inline int worldAttach(World *world) {
+    world->published = &publishedWorld;
+    world->notifyFD = worldNotifyFD();
+    return 0;
+}
+
+static inline void worldDetach(World *world) {
+    world->published = NULL;
+}
+
+// Retry the copy until no writer ran during it
+static inline void worldReadAt(World *world, size_t offset, void *destination, size_t size, const char *site) {
+    PublishedWorld *published = world->published;
+    unsigned int before, after;
+    (void)site;
+
+    traceBegin("worldRead");
+    do {
+        before = atomic_load_explicit(&published->sequence, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(destination, published->data + offset, size);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&published->sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    traceEnd("worldRead");
+}
+
+// Writers take turns, the odd sequence tells readers to retry
+static inline WorldState *worldBeginWrite(PublishedWorld *published) {
+    double start = metricsNow();
+    while (atomic_flag_test_and_set_explicit(&published->writerLock, memory_order_acquire)) {
+        sched_yield();
+    }
+    metricsRecordSemWait(metricsNow() - start);
+
+    unsigned int sequence = atomic_load_explicit(&published->sequence, memory_order_relaxed);
+    atomic_store_explicit(&published->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return (WorldState *)published->data;
+}
+
+static inline void worldEndWrite(PublishedWorld *published) {
+    ((WorldState *)published->data)->generation++;
+    unsigned int sequence = atomic_load_explicit(&published->sequence, memory_order_relaxed);
+    atomic_store_explicit(&published->sequence, sequence + 1, memory_order_release);
+    atomic_flag_clear_explicit(&published->writerLock, memory_order_release);
+}
+
+static inline void worldWriteAt(World *world, size_t offset, const void *source, size_t size, const char *site) {
+    (void)site;
+    traceBegin("worldWrite");
+    WorldState *state = worldBeginWrite(world->published);
+    memcpy((char *)state + offset, source, size);
+    worldEndWrite(world->published);
+    worldNotify(world->notifyFD);
+    traceEnd("worldWrite");
+}
+
+static inline void worldUpdateAt(World *world, WorldUpdate update, void *argument, const char *site) {
+    (void)site;
+    traceBegin("worldUpdate");
+    update(worldBeginWrite(world->published), argument);
+    worldEndWrite(world->published);
+    worldNotify(world->notifyFD);
+    traceEnd("worldUpdate");
+}
+
+#endif
+
+// The drone history sits in the world but is read and written without the
+// lock (include/history.h)
+static inline History *worldHistory(World *world) {
+#ifndef THREADED_MODE
+    return &((WorldState *)world->shm)->history;
+#else
+    return &((WorldState *)world->published->data)->history;
+#endif
+}
+
+#define worldRead(world, destination, size) worldReadAt((world), 0, (destination), (size), SEM_SITE)
+#define worldWrite(world, source, size) worldWriteAt((world), 0, (source), (size), SEM_SITE)
+#define worldReadField(world, field, destination) \
+    worldReadAt((world), offsetof(WorldState, field), (destination), sizeof(((WorldState *)0)->field), SEM_SITE)
+#define worldWriteField(world, field, source) \
+    worldWriteAt((world), offsetof(WorldState, field), (source), sizeof(((WorldState *)0)->field), SEM_SITE)
+#define worldUpdate(world, update, argument) worldUpdateAt((world), (update), (argument), SEM_SITE)
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef WORLD_STREAM_H
+#define WORLD_STREAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "constant.h"
+
+// Wire format of the world-state stream that server publishes on
+// WORLD_SOCKET_PATH. A subscriber connects and first receives a snapshot,
+// then a delta every time part of the world changes. A message is a
+// StreamHeader followed by the sections set in its mask, in bit order. A
+// subscriber that cannot keep up misses the intermediate messages and gets a
+// fresh snapshot as soon as its socket drains (drop-to-latest). Moving
+// obstacles go out as 16-bit steps from the last message when they fit
+// (sectionObstacleMoves), the full list otherwise.
+
+#define WORLD_SOCKET_PATH "/tmp/arp_world.sock"
+#define streamMagic 0x57505241     // "ARPW"
+#define streamPeriod 0.05          // Seconds between checks for a new generation
+#define streamMaxClients 64
+
+enum {
+    streamSnapshot = 1,
+    streamDelta = 2
+};
+
+enum {
+    sectionDrone = 1,              // double x, y
+    sectionObstacles = 2,          // Point[NUM_OBSTACLES]
+    sectionTargets = 4,            // Point[NUM_TARGETS]
+    sectionScore = 8,              // StreamScore
+    sectionAll = 15,               // A snapshot
+    sectionObstacleMoves = 16      // uint16_t count, then StreamMove[count]
+};
+
+// One obstacle moved by (dx, dy) / streamMoveQuantum
+typedef struct {
+    uint16_t index;
+    int16_t dx;
+    int16_t dy;
+} StreamMove;
+
+#define streamMoveQuantum 1024.0   // simObstacleQuantum, the grid of obstacle positions
+
+typedef struct {
+    int32_t score;
+    int32_t obstacleHits;
+    int32_t targetHits;
+} StreamScore;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t sections;
+    uint64_t generation;
+    uint32_t length;               // Payload bytes after the header
+    uint32_t dropped;              // Messages the subscriber has missed so far
+} StreamHeader;
+
+#define streamMaxPayload (2 * sizeof(double) + sizeof(Point) * (NUM_OBSTACLES + NUM_TARGETS) + sizeof(StreamScore))
+#define streamMaxMessage (sizeof(StreamHeader) + streamMaxPayload)
+
+// The step of one coordinate in quanta, -1 when it is off the grid or too
+// large for a StreamMove
+static inline int streamMoveStep(double before, double after, int16_t *step) {
+    double quanta = (after - before) * streamMoveQuantum;
+    if (quanta < -32768 || quanta > 32767 || quanta != (double)(int16_t)quanta) {
+        return -1;
+    }
+    *step = (int16_t)quanta;
+    return 0;
+}
+
+// Moves of the obstacles that changed between two states, their number or -1
+// when one of them cannot be sent as a move
+static inline int streamObstacleMoves(const WorldState *before, const WorldState *after, StreamMove *moves) {
+    int count = 0;
+    for (int i = 0; i < NUM_OBSTACLES; i++) {
+        const Point *from = &before->obstacles[i], *to = &after->obstacles[i];
+        if (from->x == to->x && from->y == to->y && from->number == to->number) {
+            continue;
+        }
+        if (from->number != to->number || streamMoveStep(from->x, to->x, &moves[count].dx) == -1 ||
+            streamMoveStep(from->y, to->y, &moves[count].dy) == -1) {
+            return -1;
+        }
+        moves[count++].index = i;
+    }
+    return count;
+}
+
+// Sections that differ between two states
+static inline int streamChangedSections(const WorldState *before, const WorldState *after) {
+    int sections = 0;
+    if (memcmp(&before->position[4], &after->position[4], 2 * sizeof(double)) != 0) {
+        sections |= sectionDrone;
+    }
+    if (memcmp(before->obstacles, after->obstacles, sizeof(before->obstacles)) != 0) {
+        StreamMove moves[NUM_OBSTACLES];
+        sections |= streamObstacleMoves(before, after, moves) == -1 ? sectionObstacles : sectionObstacleMoves;
+    }
+    if (memcmp(before->targets, after->targets, sizeof(before->targets)) != 0) {
+        sections |= sectionTargets;
+    }
+    if (before->score != after->score || before->obstacleHits != after->obstacleHits ||
+        before->targetHits != after->targetHits) {
+        sections |= sectionScore;
+    }
+    return sections;
+}
+
+// Write a message with the given sections of a state, returns its length.
+// before is the state of the last message, only used for obstacle moves.
+static inline size_t streamEncode(unsigned char *buffer, int type, int sections, const WorldState *before,
+                                  const WorldState *state, uint32_t dropped) {
+    unsigned char *payload = buffer + sizeof(StreamHeader);
+    size_t length = 0;
+
+    if (sections & sectionDrone) {
+        memcpy(payload + length, &state->position[4], 2 * sizeof(double));
+        length += 2 * sizeof(double);
+    }
+    if (sections & sectionObstacles) {
+        memcpy(payload + length, state->obstacles, sizeof(state->obstacles));
+        length += sizeof(state->obstacles);
+    }
+    if (sections & sectionTargets) {
+        memcpy(payload + length, state->targets, sizeof(state->targets));
+        length += sizeof(state->targets);
+    }
+    if (sections & sectionScore) {
+        StreamScore score = {state->score, state->obstacleHits, state->targetHits};
+        memcpy(payload + length, &score, sizeof(score));
+        length += sizeof(score);
+    }
+    if (sections & sectionObstacleMoves) {
+        StreamMove moves[NUM_OBSTACLES];
+        uint16_t count = (uint16_t)streamObstacleMoves(before, state, moves);
+        memcpy(payload + length, &count, sizeof(count));
+        memcpy(payload + length + sizeof(count), moves, count * sizeof(StreamMove));
+        length += sizeof(count) + count * sizeof(StreamMove);
+    }
+
+    StreamHeader header = {streamMagic, type, sections, state->generation, length, dropped};
+    memcpy(buffer, &header, sizeof(header));
+    return sizeof(header) + length;
+}
+
+// Apply the payload of a message to a subscriber's copy of the world,
+// -1 when the header does not describe a valid message
+static inline int streamDecode(const StreamHeader *header, const unsigned char *payload, WorldState *state) {
+    size_t length = 0;
+
+    if (header->magic != streamMagic || header->length > streamMaxPayload) {
+        return -1;
+    }
+    if (header->sections & sectionDrone) {
+        memcpy(&state->position[4], payload + length, 2 * sizeof(double));
+        length += 2 * sizeof(double);
+    }
+    if (header->sections & sectionObstacles) {
+        memcpy(state->obstacles, payload + length, sizeof(state->obstacles));
+        length += sizeof(state->obstacles);
+    }
+    if (header->sections & sectionTargets) {
+        memcpy(state->targets, payload + length, sizeof(state->targets));
+        length += sizeof(state->targets);
+    }
+    if (header->sections & sectionScore) {
+        StreamScore score;
+        memcpy(&score, payload + length, sizeof(score));
+        length += sizeof(score);
+        state->score = score.score;
+        state->obstacleHits = score.obstacleHits;
+        state->targetHits = score.targetHits;
+    }
+    if (header->sections & sectionObstacleMoves) {
+        uint16_t count;
+        memcpy(&count, payload + length, sizeof(count));
+        length += sizeof(count);
+        if (count > NUM_OBSTACLES || length + count * sizeof(StreamMove) > header->length) {
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            StreamMove move;
+            memcpy(&move, payload + length, sizeof(move));
+            length += sizeof(move);
+            if (move.index >= NUM_OBSTACLES) {
+                return -1;
+            }
+            state->obstacles[move.index].x += move.dx / streamMoveQuantum;
+            state->obstacles[move.index].y += move.dy / streamMoveQuantum;
+        }
+    }
+    state->generation = header->generation;
+    return length == header->length ? 0 : -1;
+}
+
+#endif
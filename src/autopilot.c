@@ -0,0 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <math.h>
+#include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/simKernels.h"
+#include "../include/dstar.h"
+#include "../include/scheduler.h"
+
+// Autopilot: while autopilot mode is on (key 'a' in the window, or master
+// --autopilot) it flies the drone to the targets. Every physics period it
+// marks the cells around the obstacles on an occupancy grid, brings the D*
+// Lite search towards the chosen target up to date and writes a force on the
+// keyboard->drone channel, as the keyboard manager does. A manual key turns
+// the mode off.
+
+#define autopilotCell 1.0                   // Board units per grid cell
+#define autopilotClearance (RADIUS + 2.0)   // Cells this close to an obstacle are blocked
+#define autopilotReach 10.0                 // Distance that halves the appeal of a target
+#define autopilotLookahead 3                // Cells ahead of the drone it steers for
+#define autopilotSpeed 2.0                  // Board units per step when cruising
+#define autopilotMaxForce 6
+#define autopilotLogPeriod 1.0
+
+static const SimParams simParams = simDefaultParams;
+
+static double getCurrentTimeInSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int clampCell(double value, int cells) {
+    int cell = (int)lround(value / autopilotCell);
+    return cell < 0 ? 0 : cell >= cells ? cells - 1 : cell;
+}
+
+static int cellOf(const DStar *planner, double x, double y) {
+    return dstarCell(planner, clampCell(x, planner->width), clampCell(y, planner->height));
+}
+
+// Add an obstacle to the cells whose centre is within its clearance (delta 1),
+// take it away (-1), or with 0 bring the grid up to date with the counts of
+// those cells. A cell is blocked while some obstacle covers it.
+static void coverObstacle(DStar *planner, uint16_t *coverage, const Point *obstacle, int delta) {
+    int reach = (int)ceil(autopilotClearance / autopilotCell);
+    int cx = clampCell(obstacle->x, planner->width);
+    int cy = clampCell(obstacle->y, planner->height);
+    for (int y = cy - reach; y <= cy + reach; ++y) {
+        for (int x = cx - reach; x <= cx + reach; ++x) {
+            double dx = x * autopilotCell - obstacle->x;
+            double dy = y * autopilotCell - obstacle->y;
+            if (x < 0 || x >= planner->width || y < 0 || y >= planner->height ||
+                dx * dx + dy * dy >= autopilotClearance * autopilotClearance) {
+                continue;
+            }
+            int cell = dstarCell(planner, x, y);
+            if (delta != 0) {
+                coverage[cell] += delta;
+            } else {
+                dstarSetBlocked(planner, cell, coverage[cell] > 0);
+            }
+        }
+    }
+}
+
+// Bring the grid up to date with the obstacles: only those that moved change
+// the coverage, around where they were and where they are now. The counts
+// settle first, so a cell that stays covered never reaches the planner.
+static void markObstacles(DStar *planner, uint16_t *coverage, const Point *before, const Point *after,
+                          bool marked) {
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < NUM_OBSTACLES; ++i) {
+            if (marked && before[i].x == after[i].x && before[i].y == after[i].y) {
+                continue;
+            }
+            if (marked) {
+                coverObstacle(planner, coverage, &before[i], pass == 0 ? -1 : 0);
+            }
+            coverObstacle(planner, coverage, &after[i], pass == 0 ? 1 : 0);
+        }
+    }
+}
+
+// The target worth the most for the way to it, -1 if there is none
+static int chooseTarget(const Point *targets, double x, double y) {
+    int best = -1;
+    double bestAppeal = 0;
+    for (int i = 0; i < NUM_TARGETS; ++i) {
+        if (targets[i].number <= 0) {
+            continue;
+        }
+        double appeal = targets[i].number / (1.0 + hypot(targets[i].x - x, targets[i].y - y) / autopilotReach);
+        if (appeal > bestAppeal) {
+            best = i;
+            bestAppeal = appeal;
+        }
+    }
+    return best;
+}
+
+// Force that brings the drone to the desired velocity in one step, from the
+// physics of simComputePosition
+static void steer(const double *position, double wantX, double wantY, int *force) {
+    double damping = simParams.mass / (simParams.mass + simParams.friction * simParams.timeStep);
+    double want[2] = {wantX, wantY};
+    for (int axis = 0; axis < 2; ++axis) {
+        double velocity = position[4 + axis] - position[2 + axis];
+        double value = (want[axis] + damping * velocity) / simParams.timeStep;
+        long rounded = lround(value);
+        force[axis] = rounded > autopilotMaxForce ? autopilotMaxForce
+                      : rounded < -autopilotMaxForce ? -autopilotMaxForce : (int)rounded;
+    }
+}
+
+// Velocity towards a few cells ahead on the planned path, or to stop
+static void follow(const DStar *planner, const double *position, const Point *target, bool planned, int *force) {
+    if (!planned) {
+        steer(position, 0, 0, force);
+        return;
+    }
+    int cell = planner->start;
+    for (int i = 0; i < autopilotLookahead && cell != planner->goal; ++i) {
+        int next = dstarNext(planner, cell);
+        if (next == -1) {
+            break;
+        }
+        cell = next;
+    }
+    double x = cell == planner->goal ? target->x : (cell % planner->width) * autopilotCell;
+    double y = cell == planner->goal ? target->y : (cell / planner->width) * autopilotCell;
+    double dx = x - position[4], dy = y - position[5];
+    double distance = hypot(dx, dy);
+    double speed = fmin(autopilotSpeed, distance);
+    steer(position, distance > 0 ? dx / distance * speed : 0, distance > 0 ? dy / distance * speed : 0, force);
+}
+
+// What the autopilot keeps between steps
+typedef struct {
+    int pipeDrone;
+    World world;
+    FILE *logFile;
+    int channelDrone, channelShm;
+    DStar *planner;
+    uint16_t *coverage;                // Obstacles covering each cell of the grid
+    Point marked[NUM_OBSTACLES];       // Obstacles as marked on the grid
+    bool markedAny;                    // Whether marked holds obstacles yet
+    Point goalTarget;
+    bool engaged;
+    int lastForce[2];
+    int replans;
+    double planTime, worstPlan;
+    uint64_t expansions;
+} Autopilot;
+
+typedef struct {
+    int pipeDrone;
+    const int *force;
+    ssize_t written;           // 0 when the autopilot was switched off meanwhile
+} ForceHandoff;
+
+// Send the force only if the autopilot is still on, under the world lock:
+// the keyboard manager clears the flag under the same lock before it sends
+// its manual force, so a stale force of ours can not arrive after it
+static void sendIfEngaged(WorldState *state, void *argument) {
+    ForceHandoff *handoff = argument;
+    handoff->written = state->autopilot ? ipcWrite(handoff->pipeDrone, handoff->force, 2 * sizeof(int)) : 0;
+}
+
+// One step, every physics period
+static void stepAutopilot(void *argument) {
+    Autopilot *autopilot = argument;
+    DStar *planner = autopilot->planner;
+
+    metricsLoopBegin();
+
+    WorldState state;
+    worldRead(&autopilot->world, &state, worldStateSize);
+    metricsReceived(autopilot->channelShm, worldStateSize);
+
+    double start = getCurrentTimeInSeconds();
+    int droneCell = cellOf(planner, state.position[4], state.position[5]);
+    if (state.autopilot && autopilot->engaged && planner->goal != -1 && droneCell != planner->start) {
+        // The drone moves first, then the cells that changed (D* Lite order)
+        dstarMoveStart(planner, droneCell);
+    }
+    markObstacles(planner, autopilot->coverage, autopilot->marked, state.obstacles, autopilot->markedAny);
+    memcpy(autopilot->marked, state.obstacles, sizeof(autopilot->marked));
+    autopilot->markedAny = true;
+
+    if (!state.autopilot) {
+        // Off: leave the channel to the keyboard manager
+        autopilot->engaged = false;
+        metricsLoopEnd();
+        return;
+    }
+
+    bool goalPresent = false;
+    for (int i = 0; i < NUM_TARGETS; ++i) {
+        if (state.targets[i].x == autopilot->goalTarget.x && state.targets[i].y == autopilot->goalTarget.y &&
+            state.targets[i].number == autopilot->goalTarget.number) {
+            goalPresent = true;
+        }
+    }
+
+    // A new target starts a new search, everything else is incremental
+    if (!autopilot->engaged || !goalPresent || planner->goal == -1) {
+        int target = chooseTarget(state.targets, state.position[4], state.position[5]);
+        if (target != -1) {
+            autopilot->goalTarget = state.targets[target];
+            dstarSetGoal(planner, cellOf(planner, autopilot->goalTarget.x, autopilot->goalTarget.y), droneCell);
+            fprintf(autopilot->logFile, "Target %d at (%.2f, %.2f), value %d\n", target + 1,
+                    autopilot->goalTarget.x, autopilot->goalTarget.y, autopilot->goalTarget.number);
+        }
+    }
+    bool planned = dstarPlan(planner) == 0;
+    double elapsed = getCurrentTimeInSeconds() - start;
+    autopilot->replans++;
+    autopilot->planTime += elapsed;
+    autopilot->worstPlan = fmax(autopilot->worstPlan, elapsed);
+
+    int force[2];
+    follow(planner, state.position, &autopilot->goalTarget, planned, force);
+    if (!autopilot->engaged || force[0] != autopilot->lastForce[0] || force[1] != autopilot->lastForce[1]) {
+        ForceHandoff handoff = {.pipeDrone = autopilot->pipeDrone, .force = force};
+        worldUpdate(&autopilot->world, sendIfEngaged, &handoff);
+        if (handoff.written < 0) {
+            perror("writing error");
+            exit(EXIT_FAILURE);
+        }
+        if (handoff.written == 0) {
+            autopilot->engaged = false;
+            metricsLoopEnd();
+            return;
+        }
+        metricsSent(autopilot->channelDrone, handoff.written);
+        memcpy(autopilot->lastForce, force, sizeof(force));
+    }
+    autopilot->engaged = true;
+    metricsLoopEnd();
+}
+
+// Replan statistics, every autopilotLogPeriod
+static void logReplans(void *argument) {
+    Autopilot *autopilot = argument;
+
+    if (autopilot->replans > 0) {
+        fprintf(autopilot->logFile, "Replans: %d, mean %.1f us, max %.1f us, %llu cells expanded\n",
+                autopilot->replans, autopilot->planTime / autopilot->replans * 1e6, autopilot->worstPlan * 1e6,
+                (unsigned long long)(autopilot->planner->expansions - autopilot->expansions));
+        fflush(autopilot->logFile);
+    }
+    autopilot->replans = 0;
+    autopilot->planTime = autopilot->worstPlan = 0;
+    autopilot->expansions = autopilot->planner->expansions;
+}
+
+int main(int argc, char *argv[]) {
+    // Signal handling for watchdog
+    struct sigaction signal_action;
+    signal_action.sa_sigaction = handleSignal;
+    signal_action.sa_flags = SA_SIGINFO;
+    sigaction(SIGINT, &signal_action, NULL);
+    sigaction(SIGUSR1, &signal_action, NULL);
+
+    // Pipes: the keyboard->drone channel, shared with the keyboard manager
+    int pipeKeyboardDrone[2];
+    sscanf(argv[1], "%d %d", &pipeKeyboardDrone[0], &pipeKeyboardDrone[1]);
+    ipcClose(pipeKeyboardDrone[0]);
+
+    Autopilot autopilot = {.pipeDrone = pipeKeyboardDrone[1]};
+
+    char logFilePath[100];
+    snprintf(logFilePath, sizeof(logFilePath), "log/autopilotLog.txt");
+    autopilot.logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
+    if (autopilot.logFile == NULL) {
+        perror("Error opening log file");
+        exit(EXIT_FAILURE);
+    }
+
+    if (worldAttach(&autopilot.world) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    metricsAttach(slotAutopilot, "autopilot");
+    autopilot.channelDrone = metricsChannel("keyboard->drone");
+    autopilot.channelShm = metricsChannel("shm");
+
+    int cells = (int)(boardSize / autopilotCell) + 1;
+    autopilot.planner = dstarCreate(cells, cells);
+    autopilot.coverage = calloc((size_t)cells * cells, sizeof(uint16_t));
+    if (autopilot.planner == NULL || autopilot.coverage == NULL) {
+        perror("Error allocating the autopilot grid");
+        exit(EXIT_FAILURE);
+    }
+
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    startupBarrier("autopilot");
+
+    schedulerEvery(&scheduler, simPhysicsPeriod, stepAutopilot, &autopilot);
+    schedulerAdd(&scheduler, autopilotLogPeriod, autopilotLogPeriod, logReplans, &autopilot);
+    schedulerRun(&scheduler);
+
+    schedulerDestroy(&scheduler);
+    dstarDestroy(autopilot.planner);
+    free(autopilot.coverage);
+    fclose(autopilot.logFile);
+    return 0;
+}
@@ -16,42 +16,101 @@
 #include <time.h>
 #include <math.h>
 #include "../include/constant.h"
-
-// Function for computing new position using Euler's Method
-double computePosition(double force, double x1, double x2) {
-    double newPosition = x1 + (force * T) - ((M * (x1 - x2)) / (M + K * T));
-    return newPosition;
+#include "../include/metrics.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/simKernels.h"
+#include "../include/simLog.h"
+#include "../include/scheduler.h"
+
+static const SimParams simParams = simDefaultParams;
+
+// Publish the new position as one more physics step
+static void publishStep(WorldState *state, void *argument) {
+    memcpy(state->position, argument, sizeof(state->position));
+    state->droneSteps++;
 }
 
-// Function to update the drone's position based on force direction
-double updatePosition(double *position, int *forceDirection) {
-    double newPositionX = computePosition(forceDirection[0], position[4], position[2]);
-    double newPositionY = computePosition(forceDirection[1], position[5], position[3]);
+// What the physics step keeps between runs
+typedef struct {
+    int pipeKeyboard;
+    int forceDirection[2];
+    double position[6];
+    int initial;
+    int sharedSegSize;
+    SimGrid grid;
+    World world;
+    FILE *logFile;
+    int channelKeyboard, channelShm;
+} Drone;
+
+// One physics step, every simPhysicsPeriod
+static void stepDrone(void *argument) {
+    Drone *drone = argument;
+    double *position = drone->position;
+    double field[2] = {0, 0};
+
+    metricsLoopBegin();
+
+    // Receive command force from keyboard_manager: every message is the whole
+    // force, so only the latest of those queued since the last step counts
+    int latest[2];
+    ssize_t readCommand = ipcRead(drone->pipeKeyboard, drone->forceDirection, sizeof(drone->forceDirection));
+    metricsReceived(drone->channelKeyboard, readCommand);
+    while (readCommand > 0 && ipcRead(drone->pipeKeyboard, latest, sizeof(latest)) > 0) {
+        memcpy(drone->forceDirection, latest, sizeof(latest));
+        metricsReceived(drone->channelKeyboard, sizeof(latest));
+    }
 
-    // Boundary conditions
-    newPositionX = fmax(0, fmin(newPositionX, boardSize));
-    newPositionY = fmax(0, fmin(newPositionY, boardSize));
+    // Wait until the user's initial input
+    if (drone->initial == 0) {
+        worldRead(&drone->world, position, drone->sharedSegSize); // Get the initial position of the drone from window.c
+        metricsReceived(drone->channelShm, drone->sharedSegSize);
 
-    // Updating position array
-    memmove(position, position + 2, 4 * sizeof(double));
-    position[4] = newPositionX;
-    position[5] = newPositionY;
+        if (readCommand < 0) {
+            if (errno != EAGAIN) {
+                perror("reading error");
+                exit(EXIT_FAILURE);
+            }
+        } else if (readCommand > 0) { // User's initial input
+            drone->initial++;
+        }
+    }
 
-    return *position;
-}
+    // Obstacle field on top of the user's force, from the nearby obstacles only
+    int forceField;
+    worldReadField(&drone->world, forceField, &forceField);
+    if (forceField != 0 && drone->initial > 0) {
+        traceBegin("field");
+        Point obstacles[NUM_OBSTACLES], targets[NUM_TARGETS];
+        worldReadField(&drone->world, obstacles, obstacles);
+        worldReadField(&drone->world, targets, targets);
+        metricsReceived(drone->channelShm, sizeof(obstacles) + sizeof(targets));
+        simGridBuild(&drone->grid, obstacles, NUM_OBSTACLES);
+        simFieldForce(&drone->grid, targets, NUM_TARGETS, forceField, position[4], position[5], &field[0], &field[1]);
+        traceEnd("field");
+    }
+
+    if (drone->initial > 0) {
+        traceBegin("updatePosition");
+        simStepForce(&simParams, position, drone->forceDirection[0] + field[0], drone->forceDirection[1] + field[1]);
+        traceEnd("updatePosition");
+        traceCounter("forceX", drone->forceDirection[0]);
+        traceCounter("forceY", drone->forceDirection[1]);
+    }
 
-// Logging function
-void logData(FILE *logFile, double *position) {
-    time_t rawtime;
-    struct tm *info;
-    char buffer[80];
+    // Sending updated drone position to window via shared memory
+    worldUpdate(&drone->world, publishStep, position);
+    metricsSent(drone->channelShm, drone->sharedSegSize);
 
-    time(&rawtime);
-    info = localtime(&rawtime);
+    // And to the history, in place and outside the lock
+    historyPush(worldHistory(&drone->world), metricsNow(), position[4], position[5]);
 
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
-    fprintf(logFile, "[%s] Previous position: (%.2f, %.2f) | Updated Position: (%.2f, %.2f)\n", buffer, position[2], position[3], position[4], position[5]);
-    fflush(logFile);
+    // Write to the log file
+    simLogDrone(drone->logFile, position);
+    metricsLoopEnd();
 }
 
 int main(int argc, char *argv[]) {
@@ -66,91 +125,65 @@ int main(int argc, char *argv[]) {
     int pipeKeyboardDrone[2], pipeWatchdogDrone[2];
     pid_t dronePID = getpid();
     sscanf(argv[1], "%d %d|%d %d", &pipeKeyboardDrone[0], &pipeKeyboardDrone[1], &pipeWatchdogDrone[0], &pipeWatchdogDrone[1]);
-    close(pipeKeyboardDrone[1]);
-    close(pipeWatchdogDrone[0]);  // Closing unnecessary pipes
-    write(pipeWatchdogDrone[1], &dronePID, sizeof(dronePID));
-    close(pipeWatchdogDrone[1]);
+    ipcClose(pipeKeyboardDrone[1]);
+    ipcClose(pipeWatchdogDrone[0]);  // Closing unnecessary pipes
+    ipcWrite(pipeWatchdogDrone[1], &dronePID, sizeof(dronePID));
+    ipcClose(pipeWatchdogDrone[1]);
 
     // Make the read non-blocking so the drone can move without user input
-    int flags = fcntl(pipeKeyboardDrone[0], F_GETFL);
-    fcntl(pipeKeyboardDrone[0], F_SETFL, flags | O_NONBLOCK);
-
-    int forceDirection[2]; 
-    double position[6];
-    int initial = 0;
+    ipcSetNonBlocking(pipeKeyboardDrone[0]);
 
-    // Shared memory setup
-    int sharedSegSize = (1 * sizeof(position));
-    sem_t *semaphoreID = sem_open(SEM_PATH, 0);
-    if (semaphoreID == SEM_FAILED) {
-        perror("sem_open");
-        exit(EXIT_FAILURE);
-    }
-
-    int shmFD = shm_open(SHM_PATH, O_RDWR, S_IRWXU | S_IRWXG);
-    if (shmFD < 0) {
-        perror("shm_open");
+    Drone drone = {.pipeKeyboard = pipeKeyboardDrone[0]};
+    if (simGridAlloc(&drone.grid, NUM_OBSTACLES, boardSize) == -1) {
+        perror("Error allocating the obstacle grid");
         exit(EXIT_FAILURE);
     }
 
-    void *shmPointer = mmap(NULL, sharedSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
-    if (shmPointer == MAP_FAILED) {
-        perror("mmap");
+    // Shared memory setup
+    drone.sharedSegSize = sizeof(drone.position);
+    if (worldAttach(&drone.world) == -1) {
         exit(EXIT_FAILURE);
     }
 
     // Open the log file
-    FILE *logFile;
     char logFilePath[100];
     snprintf(logFilePath, sizeof(logFilePath), "log/droneDynamicsLog.txt");
-    logFile = fopen(logFilePath, "w");
+    drone.logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
 
-    if (logFile == NULL) {
+    if (drone.logFile == NULL) {
         perror("Error opening log file");
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        // Receive command force from keyboard_manager
-        ssize_t readCommand = read(pipeKeyboardDrone[0], forceDirection, sizeof(forceDirection));
-
-        // Wait until the user's initial input
-        if (initial == 0) {
-            sem_wait(semaphoreID);
-            memcpy(position, shmPointer, sharedSegSize); // Get the initial position of the drone from window.c
-            sem_post(semaphoreID);
-
-            if (readCommand < 0) {
-                if (errno != EAGAIN) {
-                    perror("reading error");
-                    exit(EXIT_FAILURE);
-                }
-            } else if (readCommand > 0) { // User's initial input
-                updatePosition(position, forceDirection);
-                initial++;
-            }
-        } else { // For next inputs
-            updatePosition(position, forceDirection);
-        }
+    metricsAttach(slotDrone, "droneDynamics");
+    drone.channelKeyboard = metricsChannel("keyboard->drone");
+    drone.channelShm = metricsChannel("shm");
 
-        // Sending updated drone position to window via shared memory
-        sem_wait(semaphoreID);
-        memcpy(shmPointer, position, sharedSegSize);
-        sem_post(semaphoreID);
+    // After a restart resume from the position already in shared memory,
+    // the drone keeps flying without waiting for a new user input
+    if (isRestart(argc, argv)) {
+        worldRead(&drone.world, drone.position, drone.sharedSegSize);
+        drone.initial = 1;
+    }
 
-        // Write to the log file
-        logData(logFile, position);
-        usleep(300000);
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1) {
+        exit(EXIT_FAILURE);
     }
 
+    startupBarrier("droneDynamics");
+
+    schedulerEvery(&scheduler, simPhysicsPeriod, stepDrone, &drone);
+    schedulerRun(&scheduler);
+
     // Cleaning up
-    close(pipeKeyboardDrone[0]);
-    shm_unlink(SHM_PATH);
-    sem_close(semaphoreID);
-    sem_unlink(SEM_PATH);
+    schedulerDestroy(&scheduler);
+    simGridFree(&drone.grid);
+    ipcClose(pipeKeyboardDrone[0]);
+    worldDetach(&drone.world);
 
     // Closing the log file
-    fclose(logFile);
+    fclose(drone.logFile);
 
     return 0;
 }
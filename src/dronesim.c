@@ -0,0 +1,215 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include "../include/constant.h"
+#include "../include/simKernels.h"
+#include "../include/dronesim.h"
+
+// One environment, what droneDynamics, obstacles and targets keep between
+// them for the shared world
+typedef struct {
+    double position[6];
+    Point obstacles[droneSimMaxObstacles];
+    Point targets[droneSimMaxTargets];
+    Rng rng;
+    int insideObstacle;
+    DroneSimState state;
+} Environment;
+
+struct DroneSim {
+    DroneSimConfig config;
+    SimParams params;
+    Placement *placement;      // Shared by the environments, stepped one at a time
+    SimMotion motion;          // Obstacles of all the environments, moved in one pass
+    int count;
+    Environment *environments;
+};
+
+void droneSimDefaultConfig(DroneSimConfig *config) {
+    config->mass = M;
+    config->friction = K;
+    config->timeStep = T;
+    config->radius = RADIUS;
+    config->numObstacles = NUM_OBSTACLES;
+    config->numTargets = NUM_TARGETS;
+    config->obstacleSteps = 0;
+    config->obstacleSpeed = simObstacleSpeed * simPhysicsPeriod;
+    config->spacing = simSpacing;
+}
+
+DroneSim *droneSimCreate(const DroneSimConfig *config, int count, unsigned int seed) {
+    // Written so that a NaN fails every test
+    if (count < 1 || !(config->mass > 0) || !(config->friction >= 0) || !(config->timeStep > 0) ||
+        !(config->radius >= 0) || config->numObstacles < 0 || config->numObstacles > droneSimMaxObstacles ||
+        config->numTargets < 1 || config->numTargets > droneSimMaxTargets || config->obstacleSteps < 0 ||
+        !(config->obstacleSpeed >= 0) || !(config->spacing > 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    DroneSim *sim = malloc(sizeof(DroneSim));
+    if (sim == NULL) {
+        return NULL;
+    }
+    sim->environments = malloc(count * sizeof(Environment));
+    sim->placement = placementCreate(boardSize, boardSize, config->spacing,
+                                     2 + config->numObstacles + config->numTargets);
+    if (sim->environments == NULL || sim->placement == NULL ||
+        simMotionAlloc(&sim->motion, count * config->numObstacles) == -1) {
+        free(sim->environments);
+        placementDestroy(sim->placement);
+        free(sim);
+        return NULL;
+    }
+    sim->config = *config;
+    sim->params = (SimParams){config->mass, config->friction, config->timeStep, config->radius};
+    sim->count = count;
+
+    for (int i = 0; i < count; ++i) {
+        droneSimReset(sim, i, seed);
+    }
+    return sim;
+}
+
+void droneSimDestroy(DroneSim *sim) {
+    if (sim != NULL) {
+        free(sim->environments);
+        placementDestroy(sim->placement);
+        simMotionFree(&sim->motion);
+        free(sim);
+    }
+}
+
+int droneSimCount(const DroneSim *sim) {
+    return sim->count;
+}
+
+// Start the placed obstacles of an environment moving
+static void launchObstacles(DroneSim *sim, int env) {
+    Environment *environment = &sim->environments[env];
+    int first = env * sim->config.numObstacles;
+
+    simLaunchObstacles(&sim->motion, first, environment->obstacles, sim->config.numObstacles,
+                       sim->config.obstacleSpeed, &environment->rng);
+    simMotionToPoints(&sim->motion, first, environment->obstacles, sim->config.numObstacles);
+}
+
+int droneSimReset(DroneSim *sim, int env, unsigned int seed) {
+    if (env < 0 || env >= sim->count) {
+        return -1;
+    }
+    Environment *environment = &sim->environments[env];
+
+    memset(environment, 0, sizeof(*environment));
+    for (int i = 0; i < 6; ++i) {
+        environment->position[i] = boardSize / 2;
+    }
+    rngSeed(&environment->rng, seed, env);
+    simPlacementReset(sim->placement, environment->position[4], environment->position[5]);
+    simPlaceObstacles(sim->placement, environment->obstacles, sim->config.numObstacles, &environment->rng);
+    simPlaceTargets(sim->placement, environment->targets, sim->config.numTargets, &environment->rng);
+    launchObstacles(sim, env);
+    environment->state.x = environment->position[4];
+    environment->state.y = environment->position[5];
+    return 0;
+}
+
+static inline void addEvent(DroneSimEvent *events, int maxEvents, int *numEvents, int env, int type,
+                            int index, int value) {
+    if (*numEvents < maxEvents) {
+        events[*numEvents] = (DroneSimEvent){env, type, index, value};
+    }
+    (*numEvents)++;
+}
+
+int droneSimStep(DroneSim *sim, const DroneSimForce *forces, int n, DroneSimState *states,
+                 DroneSimEvent *events, int maxEvents) {
+    if (n < 0 || n > sim->count || (forces == NULL && n > 0) || (events == NULL && maxEvents > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const DroneSimConfig *config = &sim->config;
+    int numEvents = 0;
+
+    for (int env = 0; env < n; ++env) {
+        Environment *environment = &sim->environments[env];
+        DroneSimState *state = &environment->state;
+        int force[2] = {forces[env].x, forces[env].y};
+
+        simStep(&sim->params, environment->position, force);
+        state->steps++;
+        state->distance += hypot(environment->position[4] - state->x, environment->position[5] - state->y);
+        state->x = environment->position[4];
+        state->y = environment->position[5];
+
+        if (config->obstacleSteps > 0 && state->steps % config->obstacleSteps == 0) {
+            simPlacementReset(sim->placement, state->x, state->y);
+            simPlacementKeep(sim->placement, environment->targets, config->numTargets);
+            simPlaceObstacles(sim->placement, environment->obstacles, config->numObstacles, &environment->rng);
+            launchObstacles(sim, env);
+        }
+
+        // Obstacles the drone met on the way, from where it was before the
+        // step; they are moved below, once for all the environments
+        int obstacle = simPredictHit(&sim->motion, env * config->numObstacles, config->numObstacles,
+                                     environment->position[2], environment->position[3],
+                                     state->x - environment->position[2], state->y - environment->position[3],
+                                     1, config->radius);
+        if (obstacle != -1 && !environment->insideObstacle) {
+            state->obstacleHits++;
+            state->score -= 2;
+            addEvent(events, maxEvents, &numEvents, env, droneSimObstacleHit, obstacle, -2);
+        }
+        environment->insideObstacle = obstacle != -1;
+
+        int target = simFindHit(environment->targets, config->numTargets, state->x, state->y, config->radius);
+        if (target != -1) {
+            simPlacementReset(sim->placement, state->x, state->y);
+            simPlacementKeep(sim->placement, environment->obstacles, config->numObstacles);
+            simPlacementKeep(sim->placement, environment->targets, config->numTargets);
+            int value = simReplaceTarget(sim->placement, environment->targets, config->numTargets, target,
+                                         &environment->rng);
+            state->targetHits++;
+            state->score += value;
+            addEvent(events, maxEvents, &numEvents, env, droneSimTargetHit, target, value);
+        }
+
+        if (states != NULL) {
+            states[env] = *state;
+        }
+    }
+
+    if (config->obstacleSpeed > 0) {
+        simMoveObstacles(&sim->motion, 0, n * config->numObstacles, simObstacleBound);
+        for (int env = 0; env < n; ++env) {
+            simMotionToPoints(&sim->motion, env * config->numObstacles, sim->environments[env].obstacles,
+                              config->numObstacles);
+        }
+    }
+    return numEvents;
+}
+
+int droneSimObserve(const DroneSim *sim, int env, DroneSimState *state, DroneSimPoint *obstacles,
+                    DroneSimPoint *targets) {
+    if (env < 0 || env >= sim->count) {
+        return -1;
+    }
+    const Environment *environment = &sim->environments[env];
+
+    if (state != NULL) {
+        *state = environment->state;
+    }
+    for (int i = 0; obstacles != NULL && i < sim->config.numObstacles; ++i) {
+        obstacles[i] = (DroneSimPoint){environment->obstacles[i].x, environment->obstacles[i].y, 0};
+    }
+    for (int i = 0; targets != NULL && i < sim->config.numTargets; ++i) {
+        targets[i] = (DroneSimPoint){environment->targets[i].x, environment->targets[i].y,
+                                     environment->targets[i].number};
+    }
+    return 0;
+}
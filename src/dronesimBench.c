@@ -0,0 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/dronesim.h"
+
+// Offline throughput of libdronesim: N environments driven by random forces,
+// changed every forcePeriod steps, stepped as one batch
+#define forcePeriod 10
+#define maxEvents 4096
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    int numEnvs = 1024;
+    long numSteps = 10000;
+    unsigned int seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--envs") == 0) {
+            numEnvs = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--steps") == 0) {
+            numSteps = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned int)strtoul(argv[i + 1], NULL, 10);
+        }
+    }
+    if (argc % 2 == 0 || numEnvs < 1 || numSteps < 1) {
+        fprintf(stderr, "usage: %s [--envs N] [--steps N] [--seed N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    DroneSimConfig config;
+    droneSimDefaultConfig(&config);
+    DroneSim *sim = droneSimCreate(&config, numEnvs, seed);
+    DroneSimForce *forces = calloc(numEnvs, sizeof(DroneSimForce));
+    DroneSimState *states = calloc(numEnvs, sizeof(DroneSimState));
+    DroneSimEvent *events = calloc(maxEvents, sizeof(DroneSimEvent));
+    if (sim == NULL || forces == NULL || states == NULL || events == NULL) {
+        fprintf(stderr, "dronesimBench: cannot create %d environments\n", numEnvs);
+        return EXIT_FAILURE;
+    }
+
+    long totalEvents = 0;
+    double start = now();
+    for (long step = 0; step < numSteps; ++step) {
+        if (step % forcePeriod == 0) {
+            for (int i = 0; i < numEnvs; ++i) {
+                forces[i].x = rand_r(&seed) % 3 - 1;
+                forces[i].y = rand_r(&seed) % 3 - 1;
+            }
+        }
+        totalEvents += droneSimStep(sim, forces, numEnvs, states, events, maxEvents);
+    }
+    double elapsed = now() - start;
+
+    long score = 0;
+    for (int i = 0; i < numEnvs; ++i) {
+        score += states[i].score;
+    }
+    double envSteps = (double)numEnvs * numSteps;
+    printf("%d environments x %ld steps in %.3f s: %.2f million steps/s, %ld hits, mean score %.2f\n",
+           numEnvs, numSteps, elapsed, envSteps / elapsed / 1e6, totalEvents, (double)score / numEnvs);
+
+    droneSimDestroy(sim);
+    free(forces);
+    free(states);
+    free(events);
+    return 0;
+}
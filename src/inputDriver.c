@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/rng.h"
+#include "../include/simKernels.h"
+#include "../include/scheduler.h"
+#include "../include/inputScript.h"
+
+// Input driver: writes key presses on the window->keyboard channel in place
+// of a user, so that runs can be repeated and loaded (master --input). The
+// keys come from a script of include/inputScript.h, each held for its steps
+// at the rate, or from a random walk over the movement keys that stops the
+// drone ('d') whenever the force would go past inputMaxForce. Keys are due at
+// rate per second from the start; the scheduler tick is 1 ms, so at higher
+// rates every run writes the keys that fell due since the previous one. At
+// the end of a script it quits the simulation with 'q'.
+
+#define inputDefaultRate (1.0 / simPhysicsPeriod)   // One key per physics step
+#define inputMaxForce 4
+#define inputMaxBurst 4096                          // Keys written by one run at most
+#define inputLogPeriod 1.0
+
+static const char inputKeys[] = "wersfxcv";
+
+typedef struct {
+    int pipeKeyboard;
+    InputScript *script;       // NULL for the random walk
+    int line;
+    long hold;                 // Steps left on the current script line
+    Rng rng;
+    int forceDirection[2];     // The force the keyboard manager has after our keys
+    double rate, start;
+    long due, sent, sentLogged;
+    FILE *logFile;
+    int channelKeyboard;
+    Scheduler *scheduler;
+} InputDriver;
+
+static void sendKey(InputDriver *driver, int key) {
+    ssize_t written;
+    do {
+        written = ipcWrite(driver->pipeKeyboard, &key, sizeof(key));
+    } while (written == -1 && errno == EINTR);
+    if (written < 0) {
+        perror("write windowKeyboard");
+        exit(EXIT_FAILURE);
+    }
+    metricsSent(driver->channelKeyboard, written);
+    driver->sent++;
+}
+
+// Next key of the random walk
+static int randomKey(InputDriver *driver) {
+    int key = inputKeys[rngBelow(&driver->rng, sizeof(inputKeys) - 1)];
+    int force[2] = {driver->forceDirection[0], driver->forceDirection[1]};
+    simApplyKey(key, force);
+    if (abs(force[0]) > inputMaxForce || abs(force[1]) > inputMaxForce) {
+        key = 'd';
+    }
+    simApplyKey(key, driver->forceDirection);
+    return key;
+}
+
+// One step: the key of the script line that starts now, if any. Returns 0
+// after the last line.
+static int scriptStep(InputDriver *driver) {
+    while (driver->hold == 0) {
+        if (driver->line == driver->script->count) {
+            return 0;
+        }
+        sendKey(driver, driver->script->keys[driver->line]);
+        driver->hold = driver->script->steps[driver->line++];
+    }
+    driver->hold--;
+    return 1;
+}
+
+static void driveInput(void *argument) {
+    InputDriver *driver = argument;
+
+    metricsLoopBegin();
+    long due = (long)((metricsNow() - driver->start) * driver->rate) + 1;
+    if (due - driver->due > inputMaxBurst) {
+        driver->due = due - inputMaxBurst;        // Held up: drop the backlog instead of a burst
+    }
+    for (; driver->due < due; driver->due++) {
+        if (driver->script == NULL) {
+            sendKey(driver, randomKey(driver));
+        } else if (!scriptStep(driver)) {
+            fprintf(driver->logFile, "End of %s after %ld keys, quitting\n", driver->script->name, driver->sent);
+            fflush(driver->logFile);
+            sendKey(driver, 'q');
+            schedulerStop(driver->scheduler);
+            break;
+        }
+    }
+    metricsLoopEnd();
+}
+
+static void logRate(void *argument) {
+    InputDriver *driver = argument;
+
+    fprintf(driver->logFile, "Keys sent: %ld in %.1f s, %ld in total\n", driver->sent - driver->sentLogged,
+            inputLogPeriod, driver->sent);
+    fflush(driver->logFile);
+    driver->sentLogged = driver->sent;
+}
+
+int main(int argc, char *argv[]) {
+    // Signal handling for watchdog
+    struct sigaction signal_action;
+    signal_action.sa_sigaction = handleSignal;
+    signal_action.sa_flags = SA_SIGINFO;
+    sigaction(SIGINT, &signal_action, NULL);
+    sigaction(SIGUSR1, &signal_action, NULL);
+
+    // Pipes: the window->keyboard channel, shared with the window
+    int pipeWindowKeyboard[2];
+    sscanf(argv[1], "%d %d", &pipeWindowKeyboard[0], &pipeWindowKeyboard[1]);
+    ipcClose(pipeWindowKeyboard[0]);
+
+    InputDriver driver = {.pipeKeyboard = pipeWindowKeyboard[1], .rate = inputDefaultRate};
+    rngSeed(&driver.rng, rngSeedFromEnv(), rngStreamInput);
+
+    const char *rate = getenv(INPUT_RATE_ENV);
+    if (rate != NULL && atof(rate) > 0) {
+        driver.rate = atof(rate);
+    }
+    const char *source = getenv(INPUT_ENV);
+    static InputScript script;
+    if (source != NULL && strcmp(source, "random") != 0) {
+        if (inputScriptLoad(source, &script) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        driver.script = &script;
+    }
+
+    char logFilePath[100];
+    snprintf(logFilePath, sizeof(logFilePath), "log/inputDriverLog.txt");
+    driver.logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
+    if (driver.logFile == NULL) {
+        perror("Error opening log file");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(driver.logFile, "Driving %s at %.1f keys/s\n", driver.script != NULL ? driver.script->name : "random walk",
+            driver.rate);
+
+    metricsAttach(slotInput, "inputDriver");
+    driver.channelKeyboard = metricsChannel("window->keyboard");
+
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    driver.scheduler = &scheduler;
+
+    startupBarrier("inputDriver");
+
+    // A restarted driver has lost its place in the script: end the run
+    if (isRestart(argc, argv) && driver.script != NULL) {
+        driver.line = driver.script->count;
+    }
+    driver.start = metricsNow();
+    double period = 1.0 / driver.rate;
+    schedulerEvery(&scheduler, period > schedulerTick ? period : schedulerTick, driveInput, &driver);
+    schedulerAdd(&scheduler, inputLogPeriod, inputLogPeriod, logRate, &driver);
+    schedulerRun(&scheduler);
+
+    schedulerDestroy(&scheduler);
+    ipcClose(pipeWindowKeyboard[1]);
+    fclose(driver.logFile);
+    return 0;
+}
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <math.h>
+#include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/rng.h"
+#include "../include/placement.h"
+#include "../include/simKernels.h"
+#include "../include/simLog.h"
+#include "../include/dstar.h"
+#include "../include/scheduler.h"
+
+// Micro-benchmarks of the kernels the components run every tick, printed as
+// JSON (make bench). Every case is warmed up, then timed as benchSamples
+// samples of a batch of calls sized to last about benchSampleTime, on one
+// pinned CPU; the per-call times of the samples give the median, the tail
+// percentiles and the spread, so that two runs can be compared case by case.
+
+#define benchSamples 50
+#define benchSampleTime 0.002
+#define benchWarmupTime 0.05
+#define benchLogPath "log/bench.log"
+#define benchPlannerCells (boardSize + 1)
+#define benchFillSize 1000.0       // Area packed by place.fill, at simSpacing
+#define benchFillCapacity 150000
+
+typedef void (*BenchCase)(long iterations);
+
+typedef struct {
+    const char *name;
+    BenchCase run;
+} Bench;
+
+// Results go through here so that the compiler keeps the work
+static volatile double benchSink;
+
+static const SimParams simParams = simDefaultParams;
+static Rng rng;
+static Placement *placement, *fillPlacement;
+static Point obstacles[NUM_OBSTACLES], targets[NUM_TARGETS];
+static SimMotion motion;
+static SimGrid grid;
+static double position[6];
+static FILE *logFile;
+static WorldState *shm;
+static sem_t *sem;
+static History *history;
+static DStar *planner;
+static Scheduler scheduler;
+
+static double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A drone position that moves around the board from one call to the next
+static inline double benchCoordinate(long i) {
+    return (double)((i * 37) % (boardSize * 8)) / 8;
+}
+
+static void benchComputePosition(long iterations) {
+    double sum = 0;
+    for (long i = 0; i < iterations; i++) {
+        sum += simComputePosition(&simParams, (double)(i % 3 - 1), benchCoordinate(i), benchCoordinate(i + 1));
+    }
+    benchSink = sum;
+}
+
+static void benchStepForce(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        simStepForce(&simParams, position, (double)(i % 3 - 1), (double)((i / 3) % 3 - 1));
+    }
+    benchSink = position[4];
+}
+
+static void benchObstacleHits(long iterations) {
+    int hits = 0;
+    for (long i = 0; i < iterations; i++) {
+        hits += simFindHit(obstacles, NUM_OBSTACLES, benchCoordinate(i), benchCoordinate(i + 7), RADIUS) != -1;
+    }
+    benchSink = hits;
+}
+
+static void benchTargetHits(long iterations) {
+    int hits = 0;
+    for (long i = 0; i < iterations; i++) {
+        hits += simFindHit(targets, NUM_TARGETS, benchCoordinate(i), benchCoordinate(i + 7), RADIUS) != -1;
+    }
+    benchSink = hits;
+}
+
+static void benchPredictHit(long iterations) {
+    int hits = 0;
+    for (long i = 0; i < iterations; i++) {
+        hits += simPredictHit(&motion, 0, NUM_OBSTACLES, benchCoordinate(i), benchCoordinate(i + 7), 1.5, -1.5, 1,
+                              RADIUS) != -1;
+    }
+    benchSink = hits;
+}
+
+// What obstacles.c and targets.c do when they place a new set
+static void benchPlaceObstacles(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        simPlacementReset(placement, boardSize / 2, boardSize / 2);
+        simPlaceObstacles(placement, obstacles, NUM_OBSTACLES, &rng);
+    }
+    benchSink = obstacles[0].x;
+}
+
+static void benchPlaceTargets(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        simPlacementReset(placement, boardSize / 2, boardSize / 2);
+        simPlacementKeep(placement, obstacles, NUM_OBSTACLES);
+        simPlaceTargets(placement, targets, NUM_TARGETS, &rng);
+    }
+    benchSink = targets[0].x;
+}
+
+// Bridson's fill of a large area from empty, about 100k points
+static void benchPlaceFill(long iterations) {
+    int added = 0;
+    for (long i = 0; i < iterations; i++) {
+        placementClear(fillPlacement);
+        added += placementFill(fillPlacement, &rng, benchFillCapacity, benchFillSize, benchFillSize);
+    }
+    benchSink = added;
+}
+
+static void benchMoveObstacles(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        simMoveObstacles(&motion, 0, NUM_OBSTACLES, simObstacleBound);
+        simMotionToPoints(&motion, 0, obstacles, NUM_OBSTACLES);
+    }
+    benchSink = obstacles[0].x;
+}
+
+static void benchFieldForce(long iterations) {
+    double fx = 0, fy = 0;
+    for (long i = 0; i < iterations; i++) {
+        simGridBuild(&grid, obstacles, NUM_OBSTACLES);
+        simFieldForce(&grid, targets, NUM_TARGETS, simFieldRepel | simFieldAttract, benchCoordinate(i),
+                      benchCoordinate(i + 7), &fx, &fy);
+    }
+    benchSink = fx + fy;
+}
+
+// The log lines of droneDynamics and targets, to a file rewound every batch
+static void benchLogDrone(long iterations) {
+    rewind(logFile);
+    for (long i = 0; i < iterations; i++) {
+        simLogDrone(logFile, position);
+    }
+}
+
+static void benchLogTargets(long iterations) {
+    rewind(logFile);
+    for (long i = 0; i < iterations; i++) {
+        simLogTargets(logFile, targets, NUM_TARGETS);
+    }
+}
+
+// The world lock round trip of the process build, without the profiler, on a
+// private segment: the drone position, and the whole state as the server reads it
+static void benchShmPosition(long iterations) {
+    double copy[6];
+    for (long i = 0; i < iterations; i++) {
+        sem_wait(sem);
+        memcpy(copy, shm->position, sizeof(copy));
+        sem_post(sem);
+    }
+    benchSink = copy[4];
+}
+
+static void benchShmWorld(long iterations) {
+    static WorldState copy;
+    for (long i = 0; i < iterations; i++) {
+        sem_wait(sem);
+        memcpy(&copy, shm, worldStateSize);
+        sem_post(sem);
+    }
+    benchSink = copy.position[4];
+}
+
+static void benchHistoryPush(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        historyPush(history, (double)i, benchCoordinate(i), benchCoordinate(i + 7));
+    }
+}
+
+static void benchHistoryTrail(long iterations) {
+    HistorySample samples[historyTrail];
+    int copied = 0;
+    for (long i = 0; i < iterations; i++) {
+        copied += historyLatest(history, samples, historyTrail);
+    }
+    benchSink = copied;
+}
+
+// A replan of the autopilot after an obstacle moved by one cell
+static void benchReplan(long iterations) {
+    int x = benchPlannerCells / 2, y = benchPlannerCells / 2;
+    for (long i = 0; i < iterations; i++) {
+        dstarSetBlocked(planner, dstarCell(planner, x + (int)(i & 1), y), 0);
+        dstarSetBlocked(planner, dstarCell(planner, x + (int)((i + 1) & 1), y), 1);
+        dstarPlan(planner);
+    }
+    benchSink = (double)planner->expansions;
+}
+
+static void benchSchedulerTimer(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        schedulerCancel(&scheduler, schedulerAfter(&scheduler, (double)(i % 5000) * schedulerTick, NULL, NULL));
+    }
+}
+
+static const Bench benches[] = {
+    {"physics.computePosition", benchComputePosition},
+    {"physics.stepForce", benchStepForce},
+    {"hits.obstacles", benchObstacleHits},
+    {"hits.targets", benchTargetHits},
+    {"hits.predict", benchPredictHit},
+    {"place.obstacles", benchPlaceObstacles},
+    {"place.targets", benchPlaceTargets},
+    {"place.fill", benchPlaceFill},
+    {"obstacles.move", benchMoveObstacles},
+    {"field.force", benchFieldForce},
+    {"log.drone", benchLogDrone},
+    {"log.targets", benchLogTargets},
+    {"shm.position", benchShmPosition},
+    {"shm.world", benchShmWorld},
+    {"history.push", benchHistoryPush},
+    {"history.trail", benchHistoryTrail},
+    {"autopilot.replan", benchReplan},
+    {"scheduler.timer", benchSchedulerTimer},
+};
+
+#define numBenches (int)(sizeof(benches) / sizeof(benches[0]))
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    double rank = p * (count - 1);
+    int below = (int)rank;
+    if (below + 1 >= count) {
+        return sorted[count - 1];
+    }
+    return sorted[below] + (rank - below) * (sorted[below + 1] - sorted[below]);
+}
+
+// Time one case and print its JSON object
+static void runBench(const Bench *bench, int samples, int last) {
+    // Warm up while finding how many calls fill a sample
+    long iterations = 1;
+    double start = benchNow(), elapsed = 0;
+    while (benchNow() - start < benchWarmupTime || elapsed < benchSampleTime) {
+        double begin = benchNow();
+        bench->run(iterations);
+        elapsed = benchNow() - begin;
+        if (elapsed < benchSampleTime) {
+            iterations *= 2;
+        }
+    }
+
+    double perCall[benchSamples];
+    double mean = 0;
+    for (int s = 0; s < samples; s++) {
+        double begin = benchNow();
+        bench->run(iterations);
+        perCall[s] = (benchNow() - begin) / iterations * 1e9;
+        mean += perCall[s];
+    }
+    mean /= samples;
+    double variance = 0;
+    for (int s = 0; s < samples; s++) {
+        variance += (perCall[s] - mean) * (perCall[s] - mean);
+    }
+    double stddev = samples > 1 ? sqrt(variance / (samples - 1)) : 0;
+    qsort(perCall, samples, sizeof(double), compareDoubles);
+
+    printf("    {\"name\": \"%s\", \"iterations\": %ld, \"samples\": %d, \"ns\": {\"min\": %.2f, \"median\": %.2f, "
+           "\"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f, \"mean\": %.2f, \"stddev\": %.2f}}%s\n",
+           bench->name, iterations, samples, perCall[0], percentile(perCall, samples, 0.5),
+           percentile(perCall, samples, 0.9), percentile(perCall, samples, 0.99), perCall[samples - 1], mean, stddev,
+           last ? "" : ",");
+    fflush(stdout);
+}
+
+static void setup(uint64_t seed) {
+    rngSeed(&rng, seed, rngStreamObstacles);
+    placement = placementCreate(boardSize, boardSize, simSpacing, simPlacementCapacity);
+    fillPlacement = placementCreate(benchFillSize, benchFillSize, simSpacing, benchFillCapacity);
+    planner = dstarCreate(benchPlannerCells, benchPlannerCells);
+    logFile = fopen(benchLogPath, "w");
+    shm = mmap(NULL, sizeof(WorldState) + sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (placement == NULL || fillPlacement == NULL || planner == NULL || logFile == NULL || shm == MAP_FAILED ||
+        simMotionAlloc(&motion, NUM_OBSTACLES) == -1 || simGridAlloc(&grid, NUM_OBSTACLES, boardSize) == -1 ||
+        schedulerCreate(&scheduler) == -1) {
+        perror("kernelBench setup");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 6; i++) {
+        position[i] = boardSize / 2;
+    }
+    simPlacementReset(placement, boardSize / 2, boardSize / 2);
+    simPlaceObstacles(placement, obstacles, NUM_OBSTACLES, &rng);
+    simPlaceTargets(placement, targets, NUM_TARGETS, &rng);
+    simLaunchObstacles(&motion, 0, obstacles, NUM_OBSTACLES, simObstacleSpeed * 0.05, &rng);
+
+    sem = (sem_t *)(shm + 1);
+    sem_init(sem, 1, 1);
+    history = &shm->history;
+
+    // A wall with a gap between the drone and its goal, planned once
+    for (int y = 10; y < benchPlannerCells - 10; y++) {
+        dstarSetBlocked(planner, dstarCell(planner, benchPlannerCells / 2, y), 1);
+    }
+    dstarSetGoal(planner, dstarCell(planner, benchPlannerCells - 5, benchPlannerCells / 2),
+                 dstarCell(planner, 5, benchPlannerCells / 2));
+    dstarPlan(planner);
+}
+
+int main(int argc, char *argv[]) {
+    int cpu = sched_getcpu();
+    int samples = benchSamples;
+    const char *label = "";
+    const char *filter = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--cpu") == 0) {
+            cpu = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            samples = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--label") == 0) {
+            label = argv[i + 1];
+        } else if (strcmp(argv[i], "--only") == 0) {
+            filter = argv[i + 1];
+        }
+    }
+    if (argc % 2 == 0 || samples < 1 || samples > benchSamples) {
+        fprintf(stderr, "usage: %s [--cpu N] [--samples 1-%d] [--label TEXT] [--only PREFIX]\n", argv[0],
+                benchSamples);
+        return EXIT_FAILURE;
+    }
+
+    // One CPU for the whole run, so that no case pays for a migration
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        perror("sched_setaffinity");
+        cpu = -1;
+    }
+
+    setup(1);
+
+    int selected[numBenches], count = 0;
+    for (int b = 0; b < numBenches; b++) {
+        if (filter == NULL || strncmp(benches[b].name, filter, strlen(filter)) == 0) {
+            selected[count++] = b;
+        }
+    }
+
+    printf("{\n  \"label\": \"%s\",\n  \"cpu\": %d,\n  \"unit\": \"ns per call\",\n  \"results\": [\n", label, cpu);
+    for (int i = 0; i < count; i++) {
+        runBench(&benches[selected[i]], samples, i == count - 1);
+    }
+    printf("  ]\n}\n");
+
+    fclose(logFile);
+    remove(benchLogPath);
+    dstarDestroy(planner);
+    placementDestroy(placement);
+    placementDestroy(fillPlacement);
+    simMotionFree(&motion);
+    simGridFree(&grid);
+    schedulerDestroy(&scheduler);
+    return 0;
+}
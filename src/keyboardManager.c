@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +16,11 @@
 #include <signal.h>
 #include <signal.h>
 #include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/simKernels.h"
 #include <errno.h>
 
 int main(int argc, char *argv[]) {
@@ -24,11 +30,11 @@ int main(int argc, char *argv[]) {
     sscanf(argv[1], "%d %d|%d %d|%d %d", &pipeWindowKeyboard[0], &pipeWindowKeyboard[1],
            &pipeKeyboardDrone[0], &pipeKeyboardDrone[1],
            &pipeWatchdogKeyboard[0], &pipeWatchdogKeyboard[1]);
-    close(pipeWindowKeyboard[1]);
-    close(pipeKeyboardDrone[0]);
-    close(pipeWatchdogKeyboard[0]);
-    write(pipeWatchdogKeyboard[1], &keyboardPID, sizeof(keyboardPID));
-    close(pipeWatchdogKeyboard[1]);
+    ipcClose(pipeWindowKeyboard[1]);
+    ipcClose(pipeKeyboardDrone[0]);
+    ipcClose(pipeWatchdogKeyboard[0]);
+    ipcWrite(pipeWatchdogKeyboard[1], &keyboardPID, sizeof(keyboardPID));
+    ipcClose(pipeWatchdogKeyboard[1]);
 
     // Signal handeling for watchdog
     struct sigaction signal_action;
@@ -41,81 +47,108 @@ int main(int argc, char *argv[]) {
     FILE *logFile;
     char logFilePath[100];
     snprintf(logFilePath, sizeof(logFilePath), "log/keyboardLog.txt");
-    logFile = fopen(logFilePath, "w"); 
+    logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
 
     if (logFile == NULL) {
         perror("Error opening log file\n");
         exit(EXIT_FAILURE);
     }
 
+    World world;
+    if (worldAttach(&world) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
     int key;
     int forceDirection[2] = {0, 0};
+    int autopilot;
+
+    metricsAttach(slotKeyboard, "keyboardManager");
+    int channelWindow = metricsChannel("window->keyboard");
+    int channelDrone = metricsChannel("keyboard->drone");
+
+    startupBarrier("keyboardManager");
 
     while (1) {
         ssize_t keyPress;
 
         do {
-            keyPress = read(pipeWindowKeyboard[0], &key, sizeof(key));
+            keyPress = ipcRead(pipeWindowKeyboard[0], &key, sizeof(key));
         } while (keyPress == -1 && errno == EINTR);
 
+        // The loop is driven by key presses, only the handling is timed
+        metricsLoopBegin();
+        traceInstant("key");
+        metricsReceived(channelWindow, keyPress);
+
         if (keyPress < 0) {
             perror("reading error\n");
             fprintf(logFile, "Error reading from pipe\n");
             fclose(logFile);
-            close(pipeKeyboardDrone[1]);
-            close(pipeWindowKeyboard[0]);
+            ipcClose(pipeKeyboardDrone[1]);
+            ipcClose(pipeWindowKeyboard[0]);
             exit(EXIT_FAILURE);
         }
 
         // Updateing force-direction based on user input
-        switch ((char) key) {
-            case 'q': // Enter q to exit
-                close(pipeWindowKeyboard[0]);
-                close(pipeKeyboardDrone[1]);
-                fclose(logFile);
-                exit(EXIT_SUCCESS);
-
-            case 's':
-                forceDirection[0]--; break;
-            case 'r':
-                forceDirection[0]++; forceDirection[1]--; break;
-            case 'e':
-                forceDirection[1]--; break;
-            case 'x':
-                forceDirection[0]--; forceDirection[1]++; break;
-            case 'd':
-                forceDirection[0] = 0; forceDirection[1] = 0; break;  // Stop (no movement)
-            case 'c':
-                forceDirection[1]++; break;
-            case 'w':
-                forceDirection[0]--; forceDirection[1]--; break;
-            case 'f':
-                forceDirection[0]++; break;
-            case 'v':
-                forceDirection[0]++; forceDirection[1]++; break;
+        if ((char) key == 'q') { // Enter q to exit
+            ipcClose(pipeWindowKeyboard[0]);
+            ipcClose(pipeKeyboardDrone[1]);
+            fclose(logFile);
+            exit(EXIT_SUCCESS);
+        }
+
+        // 'a' toggles the autopilot, which writes the force while it is on; a
+        // movement key takes the drone back, starting from no force
+        worldReadField(&world, autopilot, &autopilot);
+        if ((char) key == 'a') {
+            autopilot = !autopilot;
+            worldWriteField(&world, autopilot, &autopilot);
+            fprintf(logFile, "Autopilot %s\n", autopilot ? "on" : "off");
+            if (autopilot) {
+                fflush(logFile);
+                metricsLoopEnd();
+                continue;
+            }
+            forceDirection[0] = forceDirection[1] = 0;
+        } else if (autopilot) {
+            int manual[2] = {0, 0};
+            if (!simApplyKey(key, manual)) {
+                metricsLoopEnd();
+                continue;
+            }
+            autopilot = 0;
+            worldWriteField(&world, autopilot, &autopilot);
+            memcpy(forceDirection, manual, sizeof(manual));
+            fprintf(logFile, "Autopilot off\n");
+        } else {
+            simApplyKey(key, forceDirection);
         }
 
         // Sending the updated force-direction to drone.c
-        int updateForceDirection = write(pipeKeyboardDrone[1], forceDirection, sizeof(forceDirection));
+        int updateForceDirection = ipcWrite(pipeKeyboardDrone[1], forceDirection, sizeof(forceDirection));
         if (updateForceDirection < 0) {
             fclose(logFile);
-            close(pipeWindowKeyboard[0]); 
-            close(pipeKeyboardDrone[1]); //closing unnecessary pipes
+            ipcClose(pipeWindowKeyboard[0]); 
+            ipcClose(pipeKeyboardDrone[1]); //closing unnecessary pipes
             perror("writing error\n");
             exit(EXIT_FAILURE);
         }
 
+        metricsSent(channelDrone, updateForceDirection);
+
         // Writing to the log file
         fprintf(logFile, "Key Press: %c, Force Direction: [%d, %d]\n", (char) key, forceDirection[0], forceDirection[1]);
         fflush(logFile);
+        metricsLoopEnd();
     }
 
     // Closing the log file
     fclose(logFile);
 
     //Cleaning up
-    close(pipeWindowKeyboard[0]);
-    close(pipeKeyboardDrone[1]);
+    ipcClose(pipeWindowKeyboard[0]);
+    ipcClose(pipeKeyboardDrone[1]);
 
     return 0;
 }
@@ -1,155 +1,906 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <errno.h>
 #include <time.h>
-#include <signal.h> 
+#include <signal.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include "../include/constant.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/policy.h"
+#include "../include/rng.h"
+#include "../include/simKernels.h"
+#include "../include/checkpoint.h"
+#include "../include/inputScript.h"
 
-// Function to execute a program with specified arguments and handle errors
-void summon(char **programArgs, int fd1, int fd2, int displayKonsole) {
-    if (displayKonsole) {
-        execvp(programArgs[0], programArgs);
-    } else {
-        dup2(fd1, STDOUT_FILENO);
-        dup2(fd2, STDERR_FILENO);
-        execvp(programArgs[0], programArgs);
+#define TOPOLOGY_PATH "config/topology.conf"
+#define KONSOLE_PATH "/usr/bin/konsole"
+
+#define maxComponents 16
+#define maxChannels 32
+#define maxComponentChannels 8
+#define maxInstances 32
+#define maxNameLength 32
+
+extern char **environ;
+
+// A pipe between two components, as declared in the topology file
+typedef struct {
+    char name[maxNameLength];
+    int heartbeat;           // PID announcements read by the watchdog
+    char writerName[maxNameLength];
+    char readerName[maxNameLength];
+    int writer;
+    int reader;
+    int fds[2];
+} Channel;
+
+// A component of the topology file
+typedef struct {
+    char name[maxNameLength];
+    char executable[100];
+    int konsole;
+    int interactive;
+    int input;               // Only launched with --input
+    int instances;
+    ComponentPolicy policy;
+    int channels[maxComponentChannels];
+    int numChannels;
+} ComponentSpec;
+
+// Supervision state of one child process
+typedef struct {
+    int spec;
+    pid_t pid;
+    int pidFD;               // Becomes readable as soon as the process exits, -1 if unavailable
+    pid_t componentPID;      // Inside konsole: the component itself, 0 until it has reported
+    int componentFD;         // pidfd of componentPID, -1 if unavailable
+    int restarts;            // Restarts spent inside the current budget window
+    double windowStart;      // Start of the current budget window
+    double restartAt;        // Time of a pending restart, 0 when none is scheduled
+    double exitedAt;         // Time the last exit was detected, used to report recovery time
+} Component;
+
+Channel channels[maxChannels];
+int numChannels = 0;
+ComponentSpec specs[maxComponents];
+int numSpecs = 0;
+Component components[maxInstances];
+int numComponents = 0;
+
+int headless = 0;
+int autopilot = 0;
+int forceField = 0;
+char *restorePath = NULL;     // --restore: checkpoint to start from, components resume from it
+char *inputSource = NULL;     // --input: script or "random" for the input driver
+volatile sig_atomic_t shuttingDown = 0;
+StartupBarrier *startup = NULL;
+
+#ifdef THREADED_MODE
+// Single process build: every component runs as a thread of master, the
+// channels are in-process queues and the world is published in memory
+#include <pthread.h>
+
+IpcQueue ipcQueues[ipcMaxQueues];
+atomic_int ipcNumQueues;
+PublishedWorld publishedWorld;
+
+typedef int (*ComponentMain)(int argc, char *argv[]);
+
+// The mains of the components, renamed at compile time
+int serverMain(int argc, char *argv[]);
+int windowMain(int argc, char *argv[]);
+int keyboardManagerMain(int argc, char *argv[]);
+int droneDynamicsMain(int argc, char *argv[]);
+int obstaclesMain(int argc, char *argv[]);
+int targetsMain(int argc, char *argv[]);
+int watchdogMain(int argc, char *argv[]);
+int autopilotMain(int argc, char *argv[]);
+int inputDriverMain(int argc, char *argv[]);
+
+// Topology executables are mapped to entry points by file name
+struct {
+    const char *executable;
+    ComponentMain main;
+} entryPoints[] = {
+    {"server", serverMain},
+    {"window", windowMain},
+    {"keyboardManager", keyboardManagerMain},
+    {"droneDynamics", droneDynamicsMain},
+    {"obstacles", obstaclesMain},
+    {"targets", targetsMain},
+    {"watchdog", watchdogMain},
+    {"autopilot", autopilotMain},
+    {"inputDriver", inputDriverMain},
+};
+
+typedef struct {
+    ComponentMain main;
+    ComponentSpec *spec;
+    char name[maxNameLength];
+    char args[maxMsgLength];
+    char *argv[4];
+} ComponentThread;
+#endif
+
+static double getCurrentTimeInSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// SIGINT/SIGTERM: stop supervising and bring everything down
+void handleShutdown(int signo) {
+    shuttingDown = 1;
+}
+
+int findSpec(const char *name) {
+    for (int i = 0; i < numSpecs; i++) {
+        if (strcmp(specs[i].name, name) == 0) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    perror("Execution failed");
+int findChannel(const char *name) {
+    for (int i = 0; i < numChannels; i++) {
+        if (strcmp(channels[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void topologyError(const char *path, int line, const char *message, const char *token) {
+    fprintf(stderr, "%s:%d: %s '%s'\n", path, line, message, token);
     exit(EXIT_FAILURE);
 }
 
-int main() {
-    // Pipe descriptors for communication between processes
-    int pipeWindowKeyboard[2];
-    int pipeKeyboardDrone[2];
-    int pipeTargetsWindow[2];
-    int pipeObstaclesWindow[2];
+// Parse the comma separated options of a component line
+void parseOptions(ComponentSpec *spec, char *options, const char *path, int line) {
+    spec->instances = 1;
+    spec->policy.policy = SCHED_OTHER;
+    if (strcmp(options, "-") == 0) {
+        return;
+    }
+    for (char *option = strtok(options, ","); option != NULL; option = strtok(NULL, ",")) {
+        int policyOption = policyParseOption(&spec->policy, option);
+        if (policyOption == -1) {
+            topologyError(path, line, "invalid policy option", option);
+        } else if (policyOption == 1) {
+            continue;
+        }
+        if (strcmp(option, "konsole") == 0) {
+            spec->konsole = 1;
+        } else if (strcmp(option, "interactive") == 0) {
+            spec->interactive = 1;
+        } else if (strcmp(option, "input") == 0) {
+            spec->input = 1;
+        } else if (sscanf(option, "instances=%d", &spec->instances) == 1) {
+            if (spec->instances < 1) {
+                topologyError(path, line, "invalid instance count", option);
+            }
+        } else {
+            topologyError(path, line, "unknown option", option);
+        }
+    }
+}
 
-    // Check if pipes are created successfully
-    if (pipe(pipeWindowKeyboard) == -1 || pipe(pipeKeyboardDrone) == -1 || pipe(pipeObstaclesWindow) == -1 || pipe(pipeTargetsWindow) == -1)
-     {
-        perror("pipe creation failed");
+// Load components and channels from the topology file
+void readTopology(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
         exit(EXIT_FAILURE);
     }
 
-    // Additional pipes for communication with the watchdog process
-    int pipeWatchdogServer[2];
-    int pipeWatchdogWindow[2];
-    int pipeWatchdogKeyboard[2];
-    int pipeWatchdogDrone[2];
-    int pipeWatchdogObstacles[2];
-    int pipeWatchdogTargets[2];
+    char buffer[maxMsgLength];
+    int line = 0;
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        line++;
+        char *save;
+        char *keyword = strtok_r(buffer, " \t\n", &save);
+        if (keyword == NULL || keyword[0] == '#') {
+            continue;
+        }
+
+        if (strcmp(keyword, "channel") == 0) {
+            if (numChannels == maxChannels) {
+                topologyError(path, line, "too many channels", keyword);
+            }
+            Channel *channel = &channels[numChannels];
+            char *name = strtok_r(NULL, " \t\n", &save);
+            char *kind = strtok_r(NULL, " \t\n", &save);
+            char *writer = strtok_r(NULL, " \t\n", &save);
+            char *reader = strtok_r(NULL, " \t\n", &save);
+            if (reader == NULL) {
+                topologyError(path, line, "expected: channel <name> <kind> <writer> <reader>", keyword);
+            }
+            if (strcmp(kind, "heartbeat") != 0 && strcmp(kind, "data") != 0) {
+                topologyError(path, line, "unknown channel kind", kind);
+            }
+            snprintf(channel->name, sizeof(channel->name), "%s", name);
+            snprintf(channel->writerName, sizeof(channel->writerName), "%s", writer);
+            snprintf(channel->readerName, sizeof(channel->readerName), "%s", reader);
+            channel->heartbeat = strcmp(kind, "heartbeat") == 0;
+            numChannels++;
+        } else if (strcmp(keyword, "component") == 0) {
+            if (numSpecs == maxComponents) {
+                topologyError(path, line, "too many components", keyword);
+            }
+            ComponentSpec *spec = &specs[numSpecs];
+            char *name = strtok_r(NULL, " \t\n", &save);
+            char *executable = strtok_r(NULL, " \t\n", &save);
+            char *options = strtok_r(NULL, " \t\n", &save);
+            if (options == NULL) {
+                topologyError(path, line, "expected: component <name> <executable> <options> <channel>...", keyword);
+            }
+            snprintf(spec->name, sizeof(spec->name), "%s", name);
+            snprintf(spec->executable, sizeof(spec->executable), "%s", executable);
+            parseOptions(spec, options, path, line);
+
+            for (char *token = strtok_r(NULL, " \t\n", &save); token != NULL; token = strtok_r(NULL, " \t\n", &save)) {
+                int channel = findChannel(token);
+                if (channel == -1) {
+                    topologyError(path, line, "undeclared channel", token);
+                }
+                if (spec->numChannels == maxComponentChannels) {
+                    topologyError(path, line, "too many channels for", spec->name);
+                }
+                spec->channels[spec->numChannels++] = channel;
+            }
+            numSpecs++;
+        } else {
+            topologyError(path, line, "unknown keyword", keyword);
+        }
+    }
+    fclose(file);
+
+    // Resolve channel endpoints now that every component is known
+    for (int i = 0; i < numChannels; i++) {
+        channels[i].writer = findSpec(channels[i].writerName);
+        channels[i].reader = findSpec(channels[i].readerName);
+        if (channels[i].writer == -1 || channels[i].reader == -1) {
+            fprintf(stderr, "%s: channel %s connects unknown components\n", path, channels[i].name);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Create the world shared memory and semaphore before any component starts,
+// so nobody depends on the server having initialised them first
+void createWorld() {
+    WorldState state = {.position = {boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2},
+                        .autopilot = autopilot,
+                        .forceField = forceField};
+
+    // Or the checkpoint, with the modes asked for on this command line
+    if (restorePath != NULL) {
+        double start = getCurrentTimeInSeconds();
+        if (checkpointLoad(&state, restorePath) == -1) {
+            fprintf(stderr, "%s: no valid checkpoint\n", restorePath);
+            exit(EXIT_FAILURE);
+        }
+        state.autopilot |= autopilot;
+        state.forceField |= forceField;
+        printf("Restored %s: drone at (%.2f, %.2f), score %d, in %.2f ms\n", restorePath, state.position[4],
+               state.position[5], state.score, (getCurrentTimeInSeconds() - start) * 1000.0);
+    }
 
-    // Check if additional pipes are created successfully
-    if (pipe(pipeWatchdogDrone) == -1 || pipe(pipeWatchdogKeyboard) == -1 || 
-        pipe(pipeWatchdogServer) == -1 || pipe(pipeWatchdogWindow) == -1 ||
-        pipe(pipeWatchdogObstacles) == -1 ||  pipe(pipeWatchdogTargets) == -1) {
-        perror("pipe creation failed");
+    // Leftovers of a previous run
+    shm_unlink(METRICS_SHM_PATH);
+    shm_unlink(SEMPROF_SHM_PATH);
+    traceReset();
+
+    if (worldCreate(&state, sizeof(state)) == -1) {
         exit(EXIT_FAILURE);
     }
+}
 
-    // Array to store PIDs of all processes
-    pid_t allPID[numberOfProcesses];
-    char *nameOfProcess[numberOfProcesses] = {"Server", "Window", "KeyboardManager", "DroneDynamics", "Watchdog", "Obstacles", "Targets"};
+StartupBarrier *createStartupBarrier() {
+    shm_unlink(STARTUP_SHM_PATH);
+    int fd = shm_open(STARTUP_SHM_PATH, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0 || ftruncate(fd, sizeof(StartupBarrier)) == -1) {
+        perror("shm_open startup barrier");
+        exit(EXIT_FAILURE);
+    }
+    StartupBarrier *barrier = mmap(NULL, sizeof(StartupBarrier), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (barrier == MAP_FAILED) {
+        perror("mmap startup barrier");
+        exit(EXIT_FAILURE);
+    }
+    sem_init(&barrier->ready, 1, 0);
+    sem_init(&barrier->start, 1, 0);
+    return barrier;
+}
 
-    // Loop to fork and launch each process
-    for (int i = 0; i < numberOfProcesses; i++) {
-        pid_t pid = fork();
-        allPID[i] = pid;
-        char args[maxMsgLength];
+// Components run inside konsole: master spawned konsole, the component tells
+// its own PID through its startup slot
+int insideKonsole(int i) {
+    return specs[components[i].spec].konsole && !headless;
+}
 
-        if (pid == 0) { // Child process
-            switch (i) {
-                case 0:
-                    // Server process
-                    sprintf(args, "%d %d", pipeWatchdogServer[0], pipeWatchdogServer[1]);
-                    char *argsServer[] = {"./bin/server", args, NULL};
-                    summon(argsServer, 0, 0, 0);
-                    break;
-                case 1:
-                    // Window process
-                    sprintf(args, "%d %d|%d %d|%d %d|%d %d", pipeWindowKeyboard[0], pipeWindowKeyboard[1], 
-                            pipeWatchdogWindow[0], pipeWatchdogWindow[1],
-                            pipeObstaclesWindow[0], pipeObstaclesWindow[1],
-                            pipeTargetsWindow[0], pipeTargetsWindow[1]);
-                    char *argsWindow[] = {"/usr/bin/konsole", "-e", "./bin/window", args, NULL};
-                    summon(argsWindow, 0, 0, 1);
-                    break;
-                case 2:
-                    // KeyboardManager process
-                    sprintf(args, "%d %d|%d %d|%d %d", pipeWindowKeyboard[0], pipeWindowKeyboard[1], 
-                            pipeKeyboardDrone[0], pipeKeyboardDrone[1], 
-                            pipeWatchdogKeyboard[0], pipeWatchdogKeyboard[1]);
-                    char *argsKeyboard[] = {"./bin/keyboardManager", args, NULL};
-                    summon(argsKeyboard, 0, 0, 0);
-                    break;
-                case 3:
-                    // DroneDynamics process
-                    sprintf(args, "%d %d|%d %d", pipeKeyboardDrone[0], pipeKeyboardDrone[1], 
-                            pipeWatchdogDrone[0], pipeWatchdogDrone[1]);
-                    char *argsDrone[] = {"./bin/droneDynamics", args, NULL};
-                    summon(argsDrone, 0, 0, 0);
-                    break;
-                case 4:
-                    // Obstacles process
-                   sprintf(args, "%d %d|%d %d", pipeObstaclesWindow[0], pipeObstaclesWindow[1], 
-                            pipeWatchdogObstacles[0], pipeWatchdogObstacles[1]);
-                    char *argsObstacles[] = {"./bin/obstacles", args, NULL};
-                    summon(argsObstacles, 0, 0, 0);
-                    break;
-                case 5:
-                    // Targets process
-                    sprintf(args, "%d %d|%d %d", pipeTargetsWindow[0], pipeTargetsWindow[1], 
-                            pipeWatchdogTargets[0], pipeWatchdogTargets[1]);
-                    char *argsTargets[] = {"./bin/targets", args, NULL};
-                    summon(argsTargets, 0, 0, 0);
-                    break;
-                case 6:
-                    // Watchdog process
-                    sprintf(args, "%d %d|%d %d|%d %d|%d %d|%d %d|%d %d|%d", pipeWatchdogServer[0], pipeWatchdogServer[1], 
-                            pipeWatchdogWindow[0], pipeWatchdogWindow[1], 
-                            pipeWatchdogKeyboard[0], pipeWatchdogKeyboard[1], 
-                            pipeWatchdogDrone[0], pipeWatchdogDrone[1], 
-                            pipeWatchdogObstacles[0],  pipeWatchdogObstacles[1],
-                            pipeWatchdogTargets[0] , pipeWatchdogTargets[1],
-                            allPID[6]);
-                    char *argsWatchdog[] = {"/usr/bin/konsole", "-e", "./bin/watchdog", args, NULL};
-                    summon(argsWatchdog, 0, 0, 1);
-                    break;
-                
-            default:
-                fprintf(stderr, "Unknown process index %d\n", i);
-                exit(EXIT_FAILURE);
+// Wait until every launched component is attached, then start the clock
+void startSimulation(StartupBarrier *barrier, int expected, double launchTime, double spawnedTime) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)startupTimeout;
+
+    int ready = 0;
+    while (ready < expected && !shuttingDown) {
+        if (sem_timedwait(&barrier->ready, &deadline) == 0) {
+            ready++;
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+
+    barrier->startTime = getCurrentTimeInSeconds();
+    __atomic_store_n(&barrier->started, 1, __ATOMIC_RELEASE);
+    // Every component registered by now may be waiting, also those that came
+    // after the timeout; a later one sees the flag
+    int waiting = __atomic_load_n(&barrier->numReady, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < waiting; i++) {
+        sem_post(&barrier->start);
+    }
+
+    printf("Startup: %d/%d components ready in %.1f ms (spawned in %.1f ms)\n", ready, expected,
+           (barrier->startTime - launchTime) * 1000.0, (spawnedTime - launchTime) * 1000.0);
+    int count = barrier->numReady < startupMaxEntries ? barrier->numReady : startupMaxEntries;
+    for (int i = 0; i < count; i++) {
+        printf("  %-16s ready after %6.1f ms\n", barrier->entries[i].name,
+               (barrier->entries[i].readyAt - launchTime) * 1000.0);
+    }
+    if (ready < expected) {
+        fprintf(stderr, "Startup: %d components not ready after %.0f s, starting anyway\n",
+                expected - ready, startupTimeout);
+    }
+    fflush(stdout);
+}
+
+// A relaunched watchdog learns the PIDs from its heartbeat channels, but the
+// other components only announce themselves once, so replay their PIDs: the
+// ones they reported in their startup slots, which for a component inside
+// konsole is not the PID master spawned. One that has not reported yet
+// announces itself on the channel anyway.
+void replayHeartbeats(int spec) {
+    for (int i = 0; i < specs[spec].numChannels; i++) {
+        Channel *channel = &channels[specs[spec].channels[i]];
+        if (!channel->heartbeat || channel->reader != spec) {
+            continue;
+        }
+        for (int j = 0; j < numComponents; j++) {
+            pid_t pid = __atomic_load_n(&startup->slots[j].pid, __ATOMIC_ACQUIRE);
+            if (components[j].spec == channel->writer && components[j].pid > 0 && pid > 0) {
+                if (ipcWrite(channel->fds[1], &pid, sizeof(pid_t)) == -1) {
+                    perror("write heartbeat channel");
+                }
             }
-        } else if (pid < 0) {
-            perror("fork failed");
-            exit(EXIT_FAILURE);
-        } else {
-            // Parent process
-            printf("Launched %s, PID: %d\n", nameOfProcess[i], pid);
         }
     }
+}
+
+// Apply the scheduling policy of a component to a new process, or to the
+// calling thread when target is 0. Without the privileges (CAP_SYS_NICE,
+// RLIMIT_RTPRIO) the component still runs, with a warning.
+void applyPolicy(pid_t target, ComponentSpec *spec) {
+    ComponentPolicy *policy = &spec->policy;
+    char message[100];
+
+    if (policy->cpuMask != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < policyMaxCPUs; cpu++) {
+            if (policy->cpuMask & (1ULL << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if (sched_setaffinity(target, sizeof(cpus), &cpus) == -1) {
+            snprintf(message, sizeof(message), "%s: sched_setaffinity", spec->name);
+            perror(message);
+        }
+    }
+
+    if (policy->policy == SCHED_FIFO) {
+        struct sched_param param = {.sched_priority = policy->priority};
+        if (sched_setscheduler(target, SCHED_FIFO, &param) == -1) {
+            snprintf(message, sizeof(message), "%s: SCHED_FIFO %d, keeping SCHED_OTHER", spec->name, policy->priority);
+            perror(message);
+        }
+    } else if (policy->nice != 0 && setpriority(PRIO_PROCESS, target, policy->nice) == -1) {
+        snprintf(message, sizeof(message), "%s: nice %d", spec->name, policy->nice);
+        perror(message);
+    }
+}
+
+#ifdef THREADED_MODE
+// A component returning from its main ends the simulation, like master does
+// when a process exits cleanly
+void *runComponent(void *argument) {
+    ComponentThread *thread = argument;
+    applyPolicy(0, thread->spec);
+    int status = thread->main(restorePath != NULL ? 3 : 2, thread->argv);
+    printf("%s returned %d\n", thread->name, status);
+    exit(status);
+}
+
+int startComponentThread(ComponentSpec *spec, const char *args) {
+    const char *file = strrchr(spec->executable, '/');
+    file = file != NULL ? file + 1 : spec->executable;
+
+    ComponentMain entry = NULL;
+    for (size_t i = 0; i < sizeof(entryPoints) / sizeof(entryPoints[0]); i++) {
+        if (strcmp(entryPoints[i].executable, file) == 0) {
+            entry = entryPoints[i].main;
+        }
+    }
+    if (entry == NULL) {
+        fprintf(stderr, "%s: %s is not linked into the threaded build\n", spec->name, spec->executable);
+        return -1;
+    }
+
+    // Owned by the thread for the whole run
+    ComponentThread *thread = calloc(1, sizeof(ComponentThread));
+    if (thread == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    thread->main = entry;
+    thread->spec = spec;
+    snprintf(thread->name, sizeof(thread->name), "%s", spec->name);
+    snprintf(thread->args, sizeof(thread->args), "%s", args);
+    thread->argv[0] = spec->executable;
+    thread->argv[1] = thread->args;
+    thread->argv[2] = restorePath != NULL ? restartFlag : NULL;
+    thread->argv[3] = NULL;
+
+    pthread_t id;
+    int error = pthread_create(&id, NULL, runComponent, thread);
+    if (error != 0) {
+        fprintf(stderr, "pthread_create %s: %s\n", spec->name, strerror(error));
+        free(thread);
+        return -1;
+    }
+    pthread_setname_np(id, thread->name);
+    pthread_detach(id);
+
+    printf("Started %s thread\n", spec->name);
+    fflush(stdout);
+    return 0;
+}
+#endif
+
+// Spawn one instance and start watching it through a pidfd
+int launchComponent(int i, int restarting) {
+    Component *c = &components[i];
+    ComponentSpec *spec = &specs[c->spec];
 
-    // Wait for any child process to terminate
+    if (restarting) {
+        replayHeartbeats(c->spec);
+    }
+
+    // Pipe descriptors passed as "r w|r w|..." in the order of the topology file
+    char args[maxMsgLength] = "";
+    int length = 0;
+    for (int j = 0; j < spec->numChannels; j++) {
+        Channel *channel = &channels[spec->channels[j]];
+        length += snprintf(args + length, sizeof(args) - length, "%s%d %d", j ? "|" : "",
+                           channel->fds[0], channel->fds[1]);
+    }
+
+#ifdef THREADED_MODE
+    return startComponentThread(spec, args);
+#endif
+
+    char *argv[6];
+    int argc = 0;
+    if (spec->konsole && !headless) {
+        argv[argc++] = KONSOLE_PATH;
+        argv[argc++] = "-e";
+    }
+    argv[argc++] = spec->executable;
+    argv[argc++] = args;
+    if (restarting || restorePath != NULL) {
+        argv[argc++] = restartFlag;
+    }
+    argv[argc] = NULL;
+
+    // The memory policy is applied by the component itself, pass it along
+    // with the startup slot it reports in
+    char memoryPolicy[64], slotIndex[32];
+    snprintf(memoryPolicy, sizeof(memoryPolicy), "%s=%s", POLICY_ENV, policyMemoryString(spec->policy.memory));
+    snprintf(slotIndex, sizeof(slotIndex), "%s=%d", COMPONENT_ENV, i);
+    memset(&startup->slots[i], 0, sizeof(startup->slots[i]));
+    int numEnvironment = 0;
+    while (environ[numEnvironment] != NULL) {
+        numEnvironment++;
+    }
+    char **environment = malloc((numEnvironment + 3) * sizeof(char *));
+    if (environment == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    int n = 0;
+    for (int j = 0; j < numEnvironment; j++) {
+        if (strncmp(environ[j], POLICY_ENV "=", strlen(POLICY_ENV) + 1) != 0 &&
+            strncmp(environ[j], COMPONENT_ENV "=", strlen(COMPONENT_ENV) + 1) != 0) {
+            environment[n++] = environ[j];
+        }
+    }
+    environment[n++] = memoryPolicy;
+    environment[n++] = slotIndex;
+    environment[n] = NULL;
+
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], NULL, NULL, argv, environment);
+    free(environment);
+    if (error != 0) {
+        fprintf(stderr, "posix_spawn %s: %s\n", argv[0], strerror(error));
+        return -1;
+    }
+
+    c->pid = pid;
+    applyPolicy(pid, spec);
+    c->pidFD = syscall(SYS_pidfd_open, pid, 0);
+    if (c->pidFD == -1) {
+        perror("pidfd_open, falling back to polling");
+    }
+
+    if (restarting) {
+        printf("Restarted %s, PID: %d (recovered in %.1f ms)\n", spec->name, pid,
+               (getCurrentTimeInSeconds() - c->exitedAt) * 1000.0);
+    } else {
+        printf("Launched %s, PID: %d\n", spec->name, pid);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+// Pick up the PIDs the components inside konsole reported and watch them
+void collectReports() {
+    for (int i = 0; i < numComponents; i++) {
+        Component *c = &components[i];
+        pid_t pid = __atomic_load_n(&startup->slots[i].pid, __ATOMIC_ACQUIRE);
+        if (!insideKonsole(i) || c->pid <= 0 || c->componentPID > 0 || pid <= 0) {
+            continue;
+        }
+        c->componentPID = pid;
+        c->componentFD = syscall(SYS_pidfd_open, pid, 0);
+        if (c->componentFD == -1) {
+            perror("pidfd_open component, falling back to polling");
+        }
+        printf("%s runs as PID %d inside konsole %d\n", specs[c->spec].name, pid, c->pid);
+        fflush(stdout);
+    }
+}
+
+int componentExited(Component *c) {
+    if (c->componentFD != -1) {
+        struct pollfd fd = {.fd = c->componentFD, .events = POLLIN};
+        return poll(&fd, 1, 0) == 1;
+    }
+    return kill(c->componentPID, 0) == -1 && errno == ESRCH;
+}
+
+// Whether component i ended by quitting, after its process (or the konsole
+// it ran in, with its wait status) is gone. konsole exits with 0 however its
+// component ended, so its status only counts for a component that never
+// reported; otherwise the component's own exit status in its slot decides,
+// and without one it was killed.
+int exitedCleanly(int i, int status) {
+    Component *c = &components[i];
+    char *name = specs[c->spec].name;
+
+    if (c->componentPID > 0) {
+        StartupSlot *slot = &startup->slots[i];
+        if (!componentExited(c)) {
+            printf("%s lost its konsole\n", name);
+            kill(c->componentPID, SIGKILL);
+            return 0;
+        }
+        if (__atomic_load_n(&slot->exited, __ATOMIC_ACQUIRE)) {
+            printf("%s exited with status %d\n", name, slot->status);
+            return slot->status == EXIT_SUCCESS;
+        }
+        printf("%s (PID %d) was killed\n", name, c->componentPID);
+        return 0;
+    }
+
+    if (WIFEXITED(status)) {
+        printf("%s exited with status %d\n", name, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        printf("%s killed by signal %d\n", name, WTERMSIG(status));
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+// Decide what to do after component i exited: schedule a restart inside the
+// budget, or return -1 to escalate to a full shutdown
+int scheduleRestart(int i, int clean) {
+    Component *c = &components[i];
+    char *name = specs[c->spec].name;
+    double now = getCurrentTimeInSeconds();
+
+    c->exitedAt = now;
+    if (c->pidFD != -1) {
+        close(c->pidFD);
+        c->pidFD = -1;
+    }
+    if (c->componentFD != -1) {
+        close(c->componentFD);
+        c->componentFD = -1;
+    }
+    c->pid = 0;
+    c->componentPID = 0;
+
+    // A clean exit is the user quitting ('q'), not a failure
+    if (clean) {
+        return -1;
+    }
+
+    if (now - c->windowStart > restartWindow) {
+        c->windowStart = now;
+        c->restarts = 0;
+    }
+    if (c->restarts >= maxRestarts) {
+        fprintf(stderr, "%s exceeded its restart budget (%d in %d s)\n", name, maxRestarts, restartWindow);
+        return -1;
+    }
+
+    double backoffMs = restartBackoffMs;
+    for (int n = 0; n < c->restarts && backoffMs < restartBackoffMaxMs; n++) {
+        backoffMs *= 2;
+    }
+    if (backoffMs > restartBackoffMaxMs) {
+        backoffMs = restartBackoffMaxMs;
+    }
+
+    c->restarts++;
+    c->restartAt = now + backoffMs / 1000.0;
+    return 0;
+}
+
+// Reap every exited child; returns -1 when the system must shut down. A
+// component inside konsole that exited takes its konsole down with it.
+int reapChildren() {
     int status;
-    pid_t terminatedPid = wait(&status);
-    if (terminatedPid == -1) {
-        perror("waitpid failed");
-        exit(EXIT_FAILURE);
+    pid_t pid;
+
+    for (int i = 0; i < numComponents; i++) {
+        Component *c = &components[i];
+        if (c->componentPID > 0 && c->pid > 0 && componentExited(c)) {
+            int clean = exitedCleanly(i, 0);
+            kill(c->pid, SIGTERM);
+            while (waitpid(c->pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+            if (shuttingDown || scheduleRestart(i, clean) == -1) {
+                return -1;
+            }
+        }
     }
 
-    // Terminate all other processes if one process exits
-    for (int i = 0; i < numberOfProcesses; i++) {
-        if (allPID[i] != terminatedPid) {
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < numComponents; i++) {
+            if (components[i].pid == pid) {
+                if (shuttingDown || scheduleRestart(i, exitedCleanly(i, status)) == -1) {
+                    return -1;
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+// Terminate all processes still running
+void terminateAll() {
+    for (int i = 0; i < numComponents; i++) {
+        if (components[i].pid > 0) {
             // Kill process and check for errors
-            if (kill(allPID[i], SIGTERM) == -1) {
+            if (kill(components[i].pid, SIGTERM) == -1 && errno != ESRCH) {
                 perror("kill failed");
+            }
+        }
+        if (components[i].componentPID > 0) {
+            kill(components[i].componentPID, SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char *topologyPath = TOPOLOGY_PATH;
+    char *seed = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            topologyPath = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = argv[++i];
+        } else if (strcmp(argv[i], "--autopilot") == 0) {
+            autopilot = 1;
+        } else if (strcmp(argv[i], "--field") == 0 && i + 1 < argc && strcmp(argv[i + 1], "repel") == 0) {
+            forceField = simFieldRepel;
+            i++;
+        } else if (strcmp(argv[i], "--field") == 0 && i + 1 < argc && strcmp(argv[i + 1], "attract") == 0) {
+            forceField = simFieldRepel | simFieldAttract;
+            i++;
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restorePath = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            inputSource = argv[++i];
+            setenv(INPUT_ENV, inputSource, 1);
+        } else if (strcmp(argv[i], "--input-rate") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0) {
+            setenv(INPUT_RATE_ENV, argv[++i], 1);
+        } else {
+            fprintf(stderr, "Usage: %s [--headless] [--config topology.conf] [--seed N] [--autopilot] "
+                    "[--field repel|attract] [--restore checkpoint] [--input script|random] [--input-rate N]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Every component seeds its generators from the run seed, printed so that
+    // the run can be replayed with --seed
+    char seedText[32];
+    if (seed == NULL) {
+        snprintf(seedText, sizeof(seedText), "%llu",
+                 (unsigned long long)time(NULL) << 20 ^ (unsigned long long)getpid());
+        seed = seedText;
+    }
+    setenv(RNG_SEED_ENV, seed, 1);
+    printf("Seed: %s\n", seed);
+
+    double launchTime = getCurrentTimeInSeconds();
+    readTopology(topologyPath);
+
+    // One pipe per channel, master keeps every end open so that a restarted
+    // component is handed the same channels
+    for (int i = 0; i < numChannels; i++) {
+        if (ipcPipe(channels[i].fds) == -1) {
+            perror("pipe creation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    createWorld();
+    StartupBarrier *barrier = createStartupBarrier();
+    barrier->launchTime = launchTime;
+    startup = barrier;
+
+    // Signal handling for an orderly shutdown
+    struct sigaction sig_act;
+    sig_act.sa_handler = handleShutdown;
+    sig_act.sa_flags = 0;
+    sigemptyset(&sig_act.sa_mask);
+    sigaction(SIGINT, &sig_act, NULL);
+    sigaction(SIGTERM, &sig_act, NULL);
+
+    // Spawn every instance without waiting, the barrier orders the start
+    for (int s = 0; s < numSpecs; s++) {
+        if (headless && specs[s].interactive) {
+            printf("Headless: not launching %s\n", specs[s].name);
+            continue;
+        }
+        if (specs[s].input && inputSource == NULL) {
+            continue;
+        }
+        for (int n = 0; n < specs[s].instances; n++) {
+            if (numComponents == maxInstances) {
+                fprintf(stderr, "Too many instances, %s not launched\n", specs[s].name);
+                break;
+            }
+            Component *c = &components[numComponents++];
+            memset(c, 0, sizeof(*c));
+            c->spec = s;
+            c->pidFD = -1;
+            c->componentFD = -1;
+            c->windowStart = launchTime;
+            if (launchComponent(numComponents - 1, 0) == -1) {
+                terminateAll();
                 exit(EXIT_FAILURE);
             }
         }
     }
 
+    startSimulation(barrier, numComponents, launchTime, getCurrentTimeInSeconds());
+
+#ifdef THREADED_MODE
+    // Memory policy is per process here: honour the strictest one asked for
+    int memory = 0;
+    for (int s = 0; s < numSpecs; s++) {
+        memory |= specs[s].policy.memory;
+    }
+    policyApplyMemory(&publishedWorld, sizeof(publishedWorld), memory);
+
+    // Threads are not supervised one by one: the watchdog thread or a
+    // component exiting ends the whole process
+    while (!shuttingDown) {
+        pause();
+    }
+#endif
+
+    // Supervision loop: sleep until a child exits or a restart is due
+    while (!shuttingDown) {
+        struct pollfd fds[2 * maxInstances];
+        int nfds = 0, timeoutMs = -1;
+
+        collectReports();
+        double now = getCurrentTimeInSeconds();
+        for (int i = 0; i < numComponents; i++) {
+            if (components[i].pidFD != -1) {
+                fds[nfds].fd = components[i].pidFD;
+                fds[nfds].events = POLLIN;
+                nfds++;
+            } else if (components[i].pid > 0) {
+                timeoutMs = 100; // No pidfd, fall back to periodic reaping
+            }
+            if (components[i].componentFD != -1) {
+                fds[nfds].fd = components[i].componentFD;
+                fds[nfds].events = POLLIN;
+                nfds++;
+            } else if (insideKonsole(i) && components[i].pid > 0) {
+                timeoutMs = 100; // Not reported yet, or no pidfd for it
+            }
+            if (components[i].restartAt > 0) {
+                int dueMs = (int)((components[i].restartAt - now) * 1000.0) + 1;
+                if (dueMs < 0) {
+                    dueMs = 0;
+                }
+                if (timeoutMs == -1 || dueMs < timeoutMs) {
+                    timeoutMs = dueMs;
+                }
+            }
+        }
+
+        if (poll(fds, nfds, timeoutMs) == -1 && errno != EINTR) {
+            perror("poll failed");
+            break;
+        }
+
+        if (shuttingDown || reapChildren() == -1) {
+            break;
+        }
+
+        now = getCurrentTimeInSeconds();
+        for (int i = 0; i < numComponents; i++) {
+            if (components[i].restartAt > 0 && components[i].restartAt <= now) {
+                components[i].restartAt = 0;
+                if (launchComponent(i, 1) == -1) {
+                    shuttingDown = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Terminate all other processes
+    terminateAll();
+
+    shm_unlink(STARTUP_SHM_PATH);
+    worldDestroy();
+
     return EXIT_SUCCESS;
 }
@@ -18,27 +18,43 @@
 #include <semaphore.h>
 #include <math.h> 
 #include "../include/constant.h"
-
-// Function to get the current time in seconds
-double getCurrentTimeInSeconds() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#include "../include/metrics.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/simKernels.h"
+#include "../include/scheduler.h"
+
+// Obstacles move every tick and are sent to the window (and logged) every
+// windowTicks ticks, the pace at which the window reads them
+#define obstacleTick 0.1
+#define windowTicks 10
+#define targetsPoll 0.01           // How often the first targets are looked for
+#define targetsPolls 100
+
+// Place the obstacles away from the drone and the targets currently in the
+// world and send them off in random directions
+void launchObstacles(Point *obstacles_location, SimMotion *motion, World *world, Placement *placement, Rng *rng) {
+    double position[6];
+    Point targets[NUM_TARGETS];
+    worldRead(world, position, sizeof(position));
+    worldReadField(world, targets, targets);
+
+    simPlacementReset(placement, position[4], position[5]);
+    simPlacementKeep(placement, targets, NUM_TARGETS);
+    simPlaceObstacles(placement, obstacles_location, NUM_OBSTACLES, rng);
+    simLaunchObstacles(motion, 0, obstacles_location, NUM_OBSTACLES, simObstacleSpeed * obstacleTick, rng);
+    simMotionToPoints(motion, 0, obstacles_location, NUM_OBSTACLES);
 }
 
-// Update the targets' location with a generation timer
-void updateObstacles(Point *obstacles_location, double *lastGenerationTime) {
-    double currentTime = getCurrentTimeInSeconds();
-    int GENERATION_INTERVAL = 10;
-    // Generate new targets if enough time has passed
-    if ((currentTime - *lastGenerationTime) >= GENERATION_INTERVAL) {
-        for (int i = 0; i < NUM_OBSTACLES; ++i) {
-            obstacles_location[i].x = rand() % (boardSize-5);
-            obstacles_location[i].y = rand() % (boardSize-5);
-        }
-
-        // Update the last generation time
-        *lastGenerationTime = currentTime;
+// Raise the hit flag and count the hit when the drone has just entered an obstacle
+void recordObstacleHit(WorldState *state, void *argument) {
+    int obstacleHit = -1; // Indicates an obstacle was hit
+    memcpy(state->position, &obstacleHit, sizeof(obstacleHit));
+    if (*(bool *)argument) {
+        state->obstacleHits++;
+        state->score -= 2;
     }
 }
 
@@ -59,6 +75,92 @@ void logObstacleData(FILE *logFile, Point *obstacles) {
     fflush(logFile);
 }
 
+// What the obstacle loop keeps between ticks
+typedef struct {
+    Scheduler scheduler;
+    World world;
+    FILE *logFile;
+    int pipeWindow;
+    int channelWindow, channelShm;
+    Point obstacles[NUM_OBSTACLES];
+    bool droneWasInside;
+    Rng rng;
+    Placement *placement;
+    SimMotion motion;
+    unsigned long tick;
+    int polls;
+    bool resume;                       // Restarted or restored: go on from the obstacles in the world
+} ObstacleLoop;
+
+// Move the obstacles by one tick and check them against the drone
+static void moveObstacles(void *argument) {
+    ObstacleLoop *loop = argument;
+    double position[6];
+
+    metricsLoopBegin();
+    worldWriteField(&loop->world, obstacles, loop->obstacles);
+    metricsSent(loop->channelShm, sizeof(loop->obstacles));
+
+    if (loop->tick++ % windowTicks == 0) {
+        // Logging obstacles positions to the file
+        logObstacleData(loop->logFile, loop->obstacles);
+
+        // Sending obstacles to window.c via pipe
+        metricsSent(loop->channelWindow, ipcWrite(loop->pipeWindow, loop->obstacles, sizeof(loop->obstacles)));
+    }
+
+   // Reading from shared memory
+    worldRead(&loop->world, position, sizeof(position));
+    metricsReceived(loop->channelShm, sizeof(position));
+
+    // Check if the drone reaches any of the obstacles before the next tick:
+    // its velocity per tick from the last physics step
+    double scale = obstacleTick / simPhysicsPeriod;
+    traceBegin("obstacleHits");
+    bool droneReachedObstacle = simPredictHit(&loop->motion, 0, NUM_OBSTACLES, position[4], position[5],
+                                              (position[4] - position[2]) * scale,
+                                              (position[5] - position[3]) * scale, 1, RADIUS) != -1;
+    traceEnd("obstacleHits");
+
+     // Write to shared memory only if an obstacle was reached
+    if (droneReachedObstacle) {
+        traceInstant("obstacleHit");
+        bool entered = !loop->droneWasInside;
+        worldUpdate(&loop->world, recordObstacleHit, &entered);
+        metricsSent(loop->channelShm, sizeof(int));
+    }
+    loop->droneWasInside = droneReachedObstacle;
+
+    simMoveObstacles(&loop->motion, 0, NUM_OBSTACLES, simObstacleBound);
+    simMotionToPoints(&loop->motion, 0, loop->obstacles, NUM_OBSTACLES);
+
+    metricsLoopEnd();
+}
+
+// The first obstacles keep away from the first targets: give targets a
+// moment to place them, so that a seed always gives the same board
+static void waitForTargets(void *argument) {
+    ObstacleLoop *loop = argument;
+    Point targets[NUM_TARGETS];
+
+    worldReadField(&loop->world, targets, targets);
+    if (loop->resume) {
+        // Where they were, in new directions: velocities are not in the world
+        worldReadField(&loop->world, obstacles, loop->obstacles);
+        simLaunchObstacles(&loop->motion, 0, loop->obstacles, NUM_OBSTACLES, simObstacleSpeed * obstacleTick,
+                           &loop->rng);
+        simMotionToPoints(&loop->motion, 0, loop->obstacles, NUM_OBSTACLES);
+        schedulerEvery(&loop->scheduler, obstacleTick, moveObstacles, loop);
+        return;
+    }
+    if (targets[0].number == 0 && ++loop->polls < targetsPolls) {
+        schedulerAfter(&loop->scheduler, targetsPoll, waitForTargets, loop);
+        return;
+    }
+    launchObstacles(loop->obstacles, &loop->motion, &loop->world, loop->placement, &loop->rng);
+    schedulerEvery(&loop->scheduler, obstacleTick, moveObstacles, loop);
+}
+
 int main(int argc, char *argv[]) {
     // Signal handling for watchdog
     struct sigaction signal_action;
@@ -71,86 +173,53 @@ int main(int argc, char *argv[]) {
     int pipeObstaclesWindow[2], pipeWatchdogObstacles[2];
     pid_t obstaclesPID = getpid();
     sscanf(argv[1], "%d %d|%d %d", &pipeObstaclesWindow[0], &pipeObstaclesWindow[1], &pipeWatchdogObstacles[0], &pipeWatchdogObstacles[1]);
-    close(pipeObstaclesWindow[0]);
-    close(pipeWatchdogObstacles[0]);  // Closing unnecessary pipes
-    write(pipeWatchdogObstacles[1], &obstaclesPID, sizeof(obstaclesPID));
-    close(pipeWatchdogObstacles[1]);
+    ipcClose(pipeObstaclesWindow[0]);
+    ipcClose(pipeWatchdogObstacles[0]);  // Closing unnecessary pipes
+    ipcWrite(pipeWatchdogObstacles[1], &obstaclesPID, sizeof(obstaclesPID));
+    ipcClose(pipeWatchdogObstacles[1]);
+
+    ObstacleLoop loop = {.pipeWindow = pipeObstaclesWindow[1], .resume = isRestart(argc, argv)};
 
     // Open the log file for obstacles
-    FILE *logObstacleFile;
     char logObstacleFilePath[100];
     snprintf(logObstacleFilePath, sizeof(logObstacleFilePath), "log/obstaclesLog.txt");
-    logObstacleFile = fopen(logObstacleFilePath, "w");
+    loop.logFile = fopen(logObstacleFilePath, isRestart(argc, argv) ? "a" : "w");
 
-    if (logObstacleFile == NULL) {
+    if (loop.logFile == NULL) {
         perror("Error opening log file for obstacles");
         exit(EXIT_FAILURE);
     }
 
-    double lastGenerationTime = getCurrentTimeInSeconds();
-
+    if (worldAttach(&loop.world) == -1) {
+        exit(EXIT_FAILURE);
+    }
 
+    metricsAttach(slotObstacles, "obstacles");
+    loop.channelWindow = metricsChannel("obstacles->window");
+    loop.channelShm = metricsChannel("shm");
 
-    // Shared memory setup
-    double position[6] = {boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2};
-    int sharedSegSize = sizeof(position);
+    // Never block on a window that is slow or not running (headless mode),
+    // a list that cannot be delivered now is stale by the next one anyway
+    ipcSetNonBlocking(pipeObstaclesWindow[1]);
 
-    sem_t *semID = sem_open(SEM_PATH, 0);
-    if (semID == SEM_FAILED) {
-        perror("sem_open");
+    rngSeed(&loop.rng, rngSeedFromEnv(), rngStreamObstacles);
+    loop.placement = placementCreate(boardSize, boardSize, simSpacing, simPlacementCapacity);
+    if (loop.placement == NULL || simMotionAlloc(&loop.motion, NUM_OBSTACLES) == -1) {
+        perror("Error allocating the obstacles");
         exit(EXIT_FAILURE);
     }
-    int shmfd = shm_open(SHM_PATH, O_RDWR, S_IRWXU | S_IRWXG);
-    if (shmfd < 0) {
-        perror("shm_open");
+    if (schedulerCreate(&loop.scheduler) == -1) {
         exit(EXIT_FAILURE);
     }
-    void *shmPointer = mmap(NULL, sharedSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
-    if (shmPointer == MAP_FAILED) {
-        perror("mmap");
-        exit(EXIT_FAILURE);
-    }
-
 
-    while (1) {
-        Point obstacles[NUM_OBSTACLES];
-        updateObstacles(obstacles, &lastGenerationTime);
+    startupBarrier("obstacles");
 
-        // Logging obstacles positions to the file
-        logObstacleData(logObstacleFile, obstacles);
-
-        // Sending targets to window.c via pipe
-        write(pipeObstaclesWindow[1], obstacles, sizeof(obstacles));
-
-       // Reading from shared memory
-        sem_wait(semID);
-        memcpy(position, shmPointer, sharedSegSize);
-        sem_post(semID);
-
-        // Check if the drone reaches any of the obstacles
-        bool droneReachedObstacle = false;
-        for (int i = 0; i < NUM_OBSTACLES; ++i) {
-        double distance = sqrt(pow(position[4] - obstacles[i].x, 2) + pow(position[5] - obstacles[i].y, 2));
-        if (distance < RADIUS) {
-        droneReachedObstacle = true;
-        break; 
-       }
-      }
-            
-         // Write to shared memory only if an obstacle was reached
-        if (droneReachedObstacle) {
-            int obstacleHit = -1; // Indicates an obstacle was hit
-            sem_wait(semID);
-            memcpy(shmPointer, &obstacleHit, sizeof(obstacleHit));
-            sem_post(semID);
-        }
-
-
-        sleep(1);
-    }
+    schedulerAfter(&loop.scheduler, 0, waitForTargets, &loop);
+    schedulerRun(&loop.scheduler);
 
     // Close pipes
-    close(pipeObstaclesWindow[1]);
+    schedulerDestroy(&loop.scheduler);
+    ipcClose(pipeObstaclesWindow[1]);
 
     return 0;
 }
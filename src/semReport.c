@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/constant.h"
+#include "../include/semProfiler.h"
+
+// Per-process totals, folded from the call site entries
+typedef struct {
+    char component[metricsNameLength];
+    pid_t pid;
+    uint64_t acquisitions;
+    uint64_t contended;
+    double waitTotal;
+    double holdTotal;
+} ProcessTotals;
+
+// Strip the directory from a "src/file.c:line" call site
+const char *shortSite(const char *site) {
+    const char *slash = strrchr(site, '/');
+    return slash != NULL ? slash + 1 : site;
+}
+
+int compareByWait(const void *a, const void *b) {
+    const SemProfSite *x = *(const SemProfSite **)a;
+    const SemProfSite *y = *(const SemProfSite **)b;
+    return (x->waitTotal < y->waitTotal) - (x->waitTotal > y->waitTotal);
+}
+
+// Zero the statistics while holding the lock, so no process is updating
+// them. The site registrations stay: the running processes cache their
+// indices, and would otherwise keep recording into entries that new sites
+// of other processes are given.
+void resetTable(SemProfTable *table) {
+    sem_t *semID = sem_open(SEM_PATH, 0);
+    if (semID != SEM_FAILED) {
+        sem_wait(semID);
+    }
+    int count = table->numSites < semProfSites ? table->numSites : semProfSites;
+    size_t statistics = offsetof(SemProfSite, acquisitions);
+    for (int i = 0; i < count; i++) {
+        memset((char *)&table->sites[i] + statistics, 0, sizeof(SemProfSite) - statistics);
+    }
+    table->startTime = metricsNow();
+    if (semID != SEM_FAILED) {
+        sem_post(semID);
+        sem_close(semID);
+    }
+    printf("Semaphore profile reset\n");
+}
+
+void printReport(SemProfTable *table) {
+    double elapsed = metricsNow() - table->startTime;
+    int count = table->numSites < semProfSites ? table->numSites : semProfSites;
+
+    SemProfSite *sites[semProfSites];
+    ProcessTotals processes[semProfSites];
+    int numSites = 0, numProcesses = 0;
+    double holdTotal = 0, holdAverage = 0;
+    uint64_t acquisitions = 0;
+
+    for (int i = 0; i < count; i++) {
+        SemProfSite *site = &table->sites[i];
+        if (!site->used || site->acquisitions == 0) {
+            continue;
+        }
+        sites[numSites++] = site;
+        acquisitions += site->acquisitions;
+        holdTotal += site->holdTotal;
+
+        int p = 0;
+        while (p < numProcesses && strcmp(processes[p].component, site->component) != 0) {
+            p++;
+        }
+        if (p == numProcesses) {
+            memset(&processes[p], 0, sizeof(processes[p]));
+            snprintf(processes[p].component, sizeof(processes[p].component), "%s", site->component);
+            numProcesses++;
+        }
+        processes[p].pid = site->pid;
+        processes[p].acquisitions += site->acquisitions;
+        processes[p].contended += site->contended;
+        processes[p].waitTotal += site->waitTotal;
+        processes[p].holdTotal += site->holdTotal;
+    }
+
+    if (numSites == 0) {
+        printf("No lock acquisitions recorded yet\n");
+        return;
+    }
+    holdAverage = holdTotal / acquisitions;
+
+    printf("SEM_PATH lock over %.1f s: %llu acquisitions (%.1f/s), held %.3f%% of the time\n",
+           elapsed, (unsigned long long)acquisitions, acquisitions / elapsed, 100.0 * holdTotal / elapsed);
+    printf("Average hold %.3f us, the lock saturates at about %.0f acquisitions/s\n\n",
+           holdAverage * 1e6, holdAverage > 0 ? 1.0 / holdAverage : 0);
+
+    printf("By process\n");
+    printf("%-16s %7s %10s %8s %12s %12s\n", "component", "pid", "acquired", "contend%", "wait_ms", "hold_ms");
+    for (int p = 0; p < numProcesses; p++) {
+        printf("%-16s %7d %10llu %8.2f %12.3f %12.3f\n",
+               processes[p].component, processes[p].pid, (unsigned long long)processes[p].acquisitions,
+               100.0 * processes[p].contended / processes[p].acquisitions,
+               processes[p].waitTotal * 1000.0, processes[p].holdTotal * 1000.0);
+    }
+
+    // Call sites, the ones that waited the longest first
+    qsort(sites, numSites, sizeof(sites[0]), compareByWait);
+
+    printf("\nBy call site\n");
+    printf("%-16s %-22s %9s %8s %9s %9s %9s %9s %9s %9s\n", "component", "site", "acquired", "contend%",
+           "wait_avg", "wait_p99", "wait_max", "hold_avg", "hold_p99", "hold_max");
+    for (int i = 0; i < numSites; i++) {
+        SemProfSite *site = sites[i];
+        printf("%-16s %-22s %9llu %8.2f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               site->component, shortSite(site->site), (unsigned long long)site->acquisitions,
+               100.0 * site->contended / site->acquisitions,
+               site->waitTotal / site->acquisitions * 1000.0,
+               metricsHistogramPercentile(site->waitHistogram, site->acquisitions, site->waitMax, 0.99),
+               site->waitMax * 1000.0,
+               site->holdTotal / site->acquisitions * 1000.0,
+               metricsHistogramPercentile(site->holdHistogram, site->acquisitions, site->holdMax, 0.99),
+               site->holdMax * 1000.0);
+    }
+    printf("(times in ms)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int shmFD = shm_open(SEMPROF_SHM_PATH, O_RDWR, S_IRUSR | S_IWUSR);
+    if (shmFD < 0) {
+        perror("shm_open " SEMPROF_SHM_PATH " (is the system running?)");
+        exit(EXIT_FAILURE);
+    }
+    SemProfTable *table = mmap(NULL, sizeof(SemProfTable), PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
+    close(shmFD);
+    if (table == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--reset") == 0) {
+        resetTable(table);
+    } else {
+        printReport(table);
+    }
+
+    munmap(table, sizeof(SemProfTable));
+    return 0;
+}
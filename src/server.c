@@ -1,18 +1,246 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <semaphore.h>
 #include <sys/mman.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/worldStream.h"
+#include "../include/telemetry.h"
+#include "../include/checkpoint.h"
+#include "../include/heatmap.h"
+
+// Tags of the epoll events, subscriber i is tagged tagSubscriber + i
+#define tagMetrics 0
+#define tagWorld 1
+#define tagChanged 2
+#define tagSubscriber 3
+#define hubMaxEvents 32
+
+// A world-state subscriber. At most one message is in flight: while it is
+// still being written the updates are dropped, and the subscriber is brought
+// up to date with a snapshot once the socket drains.
+typedef struct {
+    int fd;                    // -1 when the slot is free
+    unsigned char pending[streamMaxMessage];
+    size_t pendingLength;
+    size_t pendingOffset;
+    int needSnapshot;
+    uint32_t dropped;
+} Subscriber;
+
+Subscriber subscribers[streamMaxClients];
+int channelSubscribers = -1;
+static Heatmap heatmap;
+
+// Listening Unix socket, -1 if it could not be created
+int openListener(const char *path) {
+    int listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFD == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+
+    if (bind(listenFD, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listenFD, 8) == -1) {
+        perror(path);
+        close(listenFD);
+        return -1;
+    }
+    return listenFD;
+}
+
+// Answer a metrics client with a snapshot of the table and hang up
+void answerMetrics(int listenFD, MetricsTable *table, const Telemetry *telemetry) {
+    int clientFD = accept(listenFD, NULL, NULL);
+    if (clientFD == -1) {
+        return;
+    }
+    if (table != NULL) {
+        // Every part is cut to what is left of the buffer, like the formatters
+        // do, so that a truncated part never leaves length past the end
+        char snapshot[8192];
+        int last = (int)sizeof(snapshot) - 1;
+        int length = metricsFormat(table, snapshot, sizeof(snapshot));
+        length += snprintf(snapshot + length, sizeof(snapshot) - length, "\ntelemetry\n");
+        length = length < last ? length : last;
+        length += telemetryFormat(telemetry, snapshot + length, sizeof(snapshot) - length);
+        length = length < last ? length : last;
+        if (send(clientFD, snapshot, length, MSG_NOSIGNAL) == -1) {
+            perror("write metrics snapshot");
+        }
+    }
+    close(clientFD);
+}
+
+void closeSubscriber(int epollFD, int i) {
+    epoll_ctl(epollFD, EPOLL_CTL_DEL, subscribers[i].fd, NULL);
+    close(subscribers[i].fd);
+    subscribers[i].fd = -1;
+}
+
+// Write what is pending without blocking. Returns 1 when drained, 0 when the
+// socket is full, -1 when the subscriber went away.
+int flushSubscriber(Subscriber *subscriber) {
+    while (subscriber->pendingOffset < subscriber->pendingLength) {
+        ssize_t written = send(subscriber->fd, subscriber->pending + subscriber->pendingOffset,
+                               subscriber->pendingLength - subscriber->pendingOffset, MSG_NOSIGNAL);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        subscriber->pendingOffset += written;
+        metricsSent(channelSubscribers, written);
+    }
+    subscriber->pendingLength = subscriber->pendingOffset = 0;
+    return 1;
+}
+
+// Queue a message for subscriber i, or drop it if the previous one is still
+// in flight. The socket is watched for EPOLLOUT only while it is backed up.
+// Deltas go from before, the state every subscriber was last sent.
+void sendToSubscriber(int epollFD, int i, int sections, const WorldState *before, const WorldState *state) {
+    Subscriber *subscriber = &subscribers[i];
+
+    if (subscriber->pendingLength > 0) {
+        subscriber->dropped++;
+        subscriber->needSnapshot = 1;
+        return;
+    }
+    if (subscriber->needSnapshot) {
+        sections = sectionAll;
+    }
+    subscriber->pendingLength = streamEncode(subscriber->pending,
+                                             sections == sectionAll ? streamSnapshot : streamDelta,
+                                             sections, before, state, subscriber->dropped);
+    subscriber->pendingOffset = 0;
+    subscriber->needSnapshot = 0;
+
+    int result = flushSubscriber(subscriber);
+    if (result == -1) {
+        closeSubscriber(epollFD, i);
+    } else if (result == 0) {
+        struct epoll_event event = {.events = EPOLLIN | EPOLLOUT, .data.u32 = tagSubscriber + i};
+        epoll_ctl(epollFD, EPOLL_CTL_MOD, subscriber->fd, &event);
+    }
+}
+
+void acceptSubscriber(int epollFD, int listenFD, const WorldState *state) {
+    int clientFD = accept(listenFD, NULL, NULL);
+    if (clientFD == -1) {
+        return;
+    }
+
+    int i = 0;
+    while (i < streamMaxClients && subscribers[i].fd != -1) {
+        i++;
+    }
+    if (i == streamMaxClients) {
+        close(clientFD);
+        return;
+    }
+
+    fcntl(clientFD, F_SETFL, fcntl(clientFD, F_GETFL) | O_NONBLOCK);
+    memset(&subscribers[i], 0, sizeof(subscribers[i]));
+    subscribers[i].fd = clientFD;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = tagSubscriber + i};
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, clientFD, &event) == -1) {
+        perror("epoll_ctl subscriber");
+        close(clientFD);
+        subscribers[i].fd = -1;
+        return;
+    }
+    sendToSubscriber(epollFD, i, sectionAll, NULL, state);
+}
+
+// Socket events of subscriber i: drain its backlog or notice it hung up
+void handleSubscriber(int epollFD, int i, uint32_t events, const WorldState *state) {
+    Subscriber *subscriber = &subscribers[i];
+    if (subscriber->fd == -1) {
+        return;
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        closeSubscriber(epollFD, i);
+        return;
+    }
+    if (events & EPOLLIN) {
+        // Subscribers do not talk, anything read is discarded
+        char discard[256];
+        ssize_t length = recv(subscriber->fd, discard, sizeof(discard), 0);
+        if (length == 0 || (length == -1 && errno != EAGAIN && errno != EINTR)) {
+            closeSubscriber(epollFD, i);
+            return;
+        }
+    }
+    if (events & EPOLLOUT) {
+        int result = flushSubscriber(subscriber);
+        if (result == -1) {
+            closeSubscriber(epollFD, i);
+        } else if (result == 1) {
+            struct epoll_event event = {.events = EPOLLIN, .data.u32 = tagSubscriber + i};
+            epoll_ctl(epollFD, EPOLL_CTL_MOD, subscriber->fd, &event);
+            // Catch up on what was dropped meanwhile
+            if (subscriber->needSnapshot) {
+                sendToSubscriber(epollFD, i, sectionAll, NULL, state);
+            }
+        }
+    }
+}
+
+// Hits counted in shared memory since the previous sample. Positions are no
+// longer logged here, they go to the telemetry aggregates.
+void logHits(FILE *logFile, const WorldState *before, const WorldState *after) {
+    int obstacleHits = after->obstacleHits - before->obstacleHits;
+    int targetHits = after->targetHits - before->targetHits;
+    if (obstacleHits == 0 && targetHits == 0) {
+        return;
+    }
+
+    time_t rawtime;
+    struct tm *timeinfo;
+    time(&rawtime);
+    timeinfo = localtime(&rawtime);
+
+    for (int i = 0; i < obstacleHits; i++) {
+        fprintf(logFile, "[%02d:%02d:%02d] Obstacle hit!\n",
+                timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    }
+    if (targetHits > 0) {
+        // An obstacle hit costs 2 points, the rest of the change is the target values
+        int value = after->score - before->score + 2 * obstacleHits;
+        fprintf(logFile, "[%02d:%02d:%02d] Target hit with value: %d\n",
+                timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, value);
+    }
+
+    fflush(logFile); // Ensure the data is written to the file immediately
+}
 
 int main(int argc, char *argv[]) {
     // Signal handling for watchdog
@@ -28,19 +256,19 @@ int main(int argc, char *argv[]) {
     int pipeWatchdogServer[2];
     sscanf(argv[1], "%d %d", &pipeWatchdogServer[0], &pipeWatchdogServer[1]);
 
-    close(pipeWatchdogServer[0]);
-    if (write(pipeWatchdogServer[1], &serverPID, sizeof(serverPID)) == -1) {
+    ipcClose(pipeWatchdogServer[0]);
+    if (ipcWrite(pipeWatchdogServer[1], &serverPID, sizeof(serverPID)) == -1) {
         perror("write pipeWatchdogServer");
         exit(EXIT_FAILURE);
     }
     printf("%d\n", serverPID);
-    close(pipeWatchdogServer[1]); // Closing unnecessary pipes
+    ipcClose(pipeWatchdogServer[1]); // Closing unnecessary pipes
 
     // LOG FILE SETUP
     FILE *logFile;
     char logFilePath[100];
     snprintf(logFilePath, sizeof(logFilePath), "log/ServerLog.txt");
-    logFile = fopen(logFilePath, "w"); 
+    logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
 
     if (logFile == NULL) {
         perror("Error opening log file");
@@ -48,94 +276,193 @@ int main(int argc, char *argv[]) {
     }
 
     // SHARED MEMORY AND SEMAPHORE SETUP
-    double position[6];
-    int sharedSegSize = sizeof(position);
-
-    sem_t *semaphoreID = sem_open(SEM_PATH, O_CREAT, S_IRUSR | S_IWUSR, 1);
-    if (semaphoreID == SEM_FAILED) {
-        perror("sem_open");
+    // Created and initialised by master before any component starts
+    World world;
+    if (worldAttach(&world) == -1) {
         fclose(logFile);
         exit(EXIT_FAILURE);
     }
-    sem_init(semaphoreID, 1, 0);
 
-    int shmFD = shm_open(SHM_PATH, O_CREAT | O_RDWR, S_IRWXU | S_IRWXG);
-    if (shmFD < 0) {
-        perror("shm_open");
-        fclose(logFile);
-        sem_close(semaphoreID);
-        sem_unlink(SEM_PATH);
+    // METRICS SETUP
+    metricsAttach(slotServer, "server");
+    int channelShm = metricsChannel("shm");
+    channelSubscribers = metricsChannel("subscribers");
+    MetricsTable *metricsTable = metricsOpenTable();
+
+    // HUB SETUP: metrics snapshots and the world-state stream
+    int epollFD = epoll_create1(0);
+    if (epollFD == -1) {
+        perror("epoll_create1");
         exit(EXIT_FAILURE);
     }
-    if (ftruncate(shmFD, sharedSegSize) == -1) {
-        perror("ftruncate");
-        fclose(logFile);
-        sem_close(semaphoreID);
-        sem_unlink(SEM_PATH);
-        shm_unlink(SHM_PATH);
-        exit(EXIT_FAILURE);
+    int metricsSocket = openListener(METRICS_SOCKET_PATH);
+    int worldSocket = openListener(WORLD_SOCKET_PATH);
+    struct epoll_event event = {.events = EPOLLIN};
+    if (metricsSocket != -1) {
+        event.data.u32 = tagMetrics;
+        epoll_ctl(epollFD, EPOLL_CTL_ADD, metricsSocket, &event);
     }
-    void *shmPointer = mmap(NULL, sharedSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
-    if (shmPointer == MAP_FAILED) {
-        perror("mmap");
-        fclose(logFile);
-        sem_close(semaphoreID);
-        sem_unlink(SEM_PATH);
-        shm_unlink(SHM_PATH);
-        exit(EXIT_FAILURE);
+    if (worldSocket != -1) {
+        event.data.u32 = tagWorld;
+        epoll_ctl(epollFD, EPOLL_CTL_ADD, worldSocket, &event);
+    }
+    for (int i = 0; i < streamMaxClients; i++) {
+        subscribers[i].fd = -1;
     }
-    sem_post(semaphoreID);
 
-    while (1) {
-    // Get current time
-    time_t rawtime;
-    struct tm *timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    
-    // COPY POSITION OF THE DRONE FROM SHARED MEMORY
-    sem_wait(semaphoreID);
-    memcpy(position, shmPointer, sharedSegSize);
-    sem_post(semaphoreID);
-
-    // Write to the log file with time
-    fprintf(logFile, "[%02d:%02d:%02d] Drone Position: %.2f, %.2f\n",
-            timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec,
-            position[4], position[5]);
-
-    // Read obstacles reached or not
-    int obstacleHit;
-    sem_wait(semaphoreID);
-    memcpy(&obstacleHit, shmPointer, sizeof(obstacleHit));
-    sem_post(semaphoreID);
-
-    // Check if an obstacle was hit
-    if (obstacleHit == -1) {
-        fprintf(logFile, "[%02d:%02d:%02d] Obstacle hit!\n",
-                timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    // World changes wake the hub up, without master there is nothing to wait
+    // for and it samples on every period
+    int worldChanged = 1;
+    double changedAt = 0;
+    if (world.notifyFD != -1) {
+        event.data.u32 = tagChanged;
+        epoll_ctl(epollFD, EPOLL_CTL_ADD, world.notifyFD, &event);
     }
 
-    // Read target with value from shared memory
-    int targetHitValue;
-    sem_wait(semaphoreID);
-    memcpy(&targetHitValue, shmPointer, sizeof(targetHitValue));
-    sem_post(semaphoreID);
+    WorldState latest = {0}, published, sampled;
+    worldRead(&world, &latest, worldStateSize);
+    published = sampled = latest;
 
-    // Check if a target with value was hit
-    if (targetHitValue >= 1 && targetHitValue <= 10) {
-        fprintf(logFile, "[%02d:%02d:%02d] Target hit with value: %d\n",
-                timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, targetHitValue);
+    // TELEMETRY SETUP
+    Telemetry telemetry;
+    telemetryOpen(&telemetry, TELEMETRY_PATH, isRestart(argc, argv), metricsNow());
+
+    // HEATMAP SETUP: a restarted server goes on from its last snapshot
+    if (!isRestart(argc, argv) || heatmapLoad(&heatmap, HEATMAP_PATH) == -1) {
+        heatmapInit(&heatmap);
     }
 
-    fflush(logFile); // Ensure the data is written to the file immediately
-    sleep(1);
-}
+    startupBarrier("server");
+
+    double nextSample = metricsNow();
+    double nextPublish = nextSample;
+    double nextHeatmap = nextSample + heatmapPeriod;
+    double nextCheckpoint = nextSample + checkpointPeriod;
+    uint64_t checkpointed = latest.generation;
+
+    while (1) {
+        // Asleep until the world changes, then sampled at most once per
+        // telemetryPeriod; a change not streamed yet wakes it at nextPublish
+        double now = metricsNow();
+        double wakeAt = worldChanged ? nextSample : latest.generation != published.generation ? nextPublish : 0;
+        int timeoutMs = -1;
+        if (wakeAt > 0) {
+            timeoutMs = wakeAt > now ? (int)((wakeAt - now) * 1000.0) + 1 : 0;
+        }
+
+        // The watchdog takes the hub waiting for a change as idle
+        struct epoll_event events[hubMaxEvents];
+        metricsSelf->blocked = timeoutMs == -1;
+        int ready = epoll_wait(epollFD, events, hubMaxEvents, timeoutMs);
+        metricsSelf->blocked = 0;
+        if (ready == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int e = 0; e < ready; e++) {
+            uint32_t tag = events[e].data.u32;
+            if (tag == tagMetrics) {
+                answerMetrics(metricsSocket, metricsTable, &telemetry);
+            } else if (tag == tagWorld) {
+                // Snapshots of the published state, the next delta starts from it
+                acceptSubscriber(epollFD, worldSocket, &published);
+            } else if (tag == tagChanged) {
+                uint64_t changes;
+                if (read(world.notifyFD, &changes, sizeof(changes)) == sizeof(changes) && !worldChanged) {
+                    worldChanged = 1;
+                    changedAt = metricsNow();
+                }
+            } else {
+                handleSubscriber(epollFD, tag - tagSubscriber, events[e].events, &published);
+            }
+        }
+
+        now = metricsNow();
+        int sampleDue = worldChanged && now >= nextSample;
+        int publishDue = now >= nextPublish && latest.generation != published.generation;
+        if (!sampleDue && !publishDue) {
+            continue;
+        }
+        metricsLoopBegin();
+
+        if (sampleDue) {
+            metricsRecordWakeup(now - fmax(nextSample, changedAt));
+
+            // COPY THE WORLD FROM SHARED MEMORY
+            worldRead(&world, &latest, worldStateSize);
+            metricsReceived(channelShm, worldStateSize);
+            worldChanged = world.notifyFD == -1;
+
+            // Every physics step is a telemetry sample, the step counter tells
+            // how many were published since the last check
+            if (latest.droneSteps != sampled.droneSteps) {
+                uint64_t steps = latest.droneSteps - sampled.droneSteps;
+                telemetrySample(&telemetry, latest.position[4], latest.position[5], now, (uint32_t)(steps - 1));
+                heatmapAdd(&heatmap, heatmapVisits, latest.position[4], latest.position[5]);
+            }
+            telemetryHits(&telemetry, latest.obstacleHits - sampled.obstacleHits, latest.targetHits - sampled.targetHits);
+            for (int i = sampled.obstacleHits; i < latest.obstacleHits; i++) {
+                heatmapAdd(&heatmap, heatmapObstacleHits, latest.position[4], latest.position[5]);
+            }
+            for (int i = sampled.targetHits; i < latest.targetHits; i++) {
+                heatmapAdd(&heatmap, heatmapTargetHits, latest.position[4], latest.position[5]);
+            }
+            logHits(logFile, &sampled, &latest);
+            sampled = latest;
+            telemetryTick(&telemetry, now);
+
+            if (now >= nextHeatmap) {
+                if (heatmapSave(&heatmap, HEATMAP_PATH) == -1) {
+                    perror(HEATMAP_PATH);
+                }
+                nextHeatmap = now + heatmapPeriod;
+            }
+
+            // Checkpoint from the private copy, the world itself is not held
+            if (now >= nextCheckpoint) {
+                if (latest.generation != checkpointed) {
+                    if (checkpointSave(&latest, CHECKPOINT_PATH) == -1) {
+                        perror(CHECKPOINT_PATH);
+                    }
+                    checkpointed = latest.generation;
+                }
+                nextCheckpoint = now + checkpointPeriod;
+            }
+
+            nextSample += telemetryPeriod;
+            if (nextSample < now) {
+                nextSample = now + telemetryPeriod;
+            }
+        }
+
+        // Publish what changed to the subscribers
+        if (now >= nextPublish && latest.generation != published.generation) {
+            int sections = streamChangedSections(&published, &latest);
+            for (int i = 0; i < streamMaxClients && sections != 0; i++) {
+                if (subscribers[i].fd != -1) {
+                    sendToSubscriber(epollFD, i, sections, &published, &latest);
+                }
+            }
+            published = latest;
+            nextPublish += streamPeriod;
+            if (nextPublish < now) {
+                nextPublish = now + streamPeriod;
+            }
+        }
+        metricsLoopEnd();
+    }
 
     // CLEANUP
-    shm_unlink(SHM_PATH);
-    sem_close(semaphoreID);
-    sem_unlink(SEM_PATH);
-    munmap(shmPointer, sharedSegSize);
+    close(metricsSocket);
+    close(worldSocket);
+    close(epollFD);
+    unlink(METRICS_SOCKET_PATH);
+    unlink(WORLD_SOCKET_PATH);
+    shm_unlink(METRICS_SHM_PATH);
+    worldDetach(&world);
+    telemetryClose(&telemetry);
+    heatmapSave(&heatmap, HEATMAP_PATH);
 
     // Close the log file
     fclose(logFile);
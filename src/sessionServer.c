@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../include/constant.h"
+#include "../include/simKernels.h"
+#include "../include/session.h"
+
+// Many independent simulations in one process. The sessions are split into
+// contiguous blocks, one per shard; a shard is a thread pinned to its own CPU
+// that steps its whole block every physics period, moves the obstacles of
+// the block in one pass and publishes each world to the session's segment.
+// Clients set the force of a session and read its world through
+// include/session.h.
+
+typedef struct {
+    SessionSegment *segment;
+    WorldState state;
+    Rng rng;
+    int first;                 // Its obstacles in the motion arrays
+    bool insideObstacle;
+} Session;
+
+typedef struct {
+    pthread_t thread;
+    int index;
+    int cpu;                   // -1 to leave the thread unpinned
+    Session *sessions;
+    int count;
+    Placement *placement;      // Scratch for the placements of the block
+    SimMotion *motion;
+    double period;
+    uint64_t ticks;
+    uint64_t overruns;         // Ticks that took longer than the period
+    double busy;               // Seconds spent stepping
+} Shard;
+
+static const SimParams simParams = simDefaultParams;
+static atomic_int stopRequested;
+
+static void requestStop(int signo) {
+    (void)signo;
+    atomic_store(&stopRequested, 1);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void initSession(Session *session, Placement *placement, SimMotion *motion, uint64_t seed, int stream) {
+    memset(&session->state, 0, sizeof(session->state));
+    for (int i = 0; i < 6; ++i) {
+        session->state.position[i] = boardSize / 2;
+    }
+    rngSeed(&session->rng, seed, stream);
+    session->insideObstacle = false;
+    simPlacementReset(placement, session->state.position[4], session->state.position[5]);
+    simPlaceObstacles(placement, session->state.obstacles, NUM_OBSTACLES, &session->rng);
+    simPlaceTargets(placement, session->state.targets, NUM_TARGETS, &session->rng);
+    simLaunchObstacles(motion, session->first, session->state.obstacles, NUM_OBSTACLES,
+                       simObstacleSpeed * simPhysicsPeriod, &session->rng);
+    simMotionToPoints(motion, session->first, session->state.obstacles, NUM_OBSTACLES);
+    sessionSetForce(session->segment, 0, 0);
+    sessionPublish(session->segment, &session->state);
+}
+
+// One physics step of a session, what droneDynamics, obstacles and targets do
+// between them for the shared world. The obstacles are still where the step
+// started, runShard moves them afterwards.
+static void stepSession(Session *session, Placement *placement, const SimMotion *motion) {
+    WorldState *state = &session->state;
+    int force[2] = {
+        atomic_load_explicit(&session->segment->force[0], memory_order_relaxed),
+        atomic_load_explicit(&session->segment->force[1], memory_order_relaxed)
+    };
+
+    simStep(&simParams, state->position, force);
+    state->droneSteps++;
+
+    // Obstacles the drone met on the way, from where it was before the step
+    int obstacle = simPredictHit(motion, session->first, NUM_OBSTACLES, state->position[2], state->position[3],
+                                 state->position[4] - state->position[2], state->position[5] - state->position[3],
+                                 1, RADIUS);
+    if (obstacle != -1) {
+        int obstacleHit = -1;
+        memcpy(state->position, &obstacleHit, sizeof(obstacleHit));
+        if (!session->insideObstacle) {
+            state->obstacleHits++;
+            state->score -= 2;
+        }
+    }
+    session->insideObstacle = obstacle != -1;
+
+    int target = simFindHit(state->targets, NUM_TARGETS, state->position[4], state->position[5], RADIUS);
+    if (target != -1) {
+        simPlacementReset(placement, state->position[4], state->position[5]);
+        simPlacementKeep(placement, state->obstacles, NUM_OBSTACLES);
+        simPlacementKeep(placement, state->targets, NUM_TARGETS);
+        int value = simReplaceTarget(placement, state->targets, NUM_TARGETS, target, &session->rng);
+        memcpy(state->position, &value, sizeof(value));
+        state->targetHits++;
+        state->score += value;
+    }
+}
+
+// Publish a session with its obstacles moved
+static void publishSession(Session *session, const SimMotion *motion) {
+    simMotionToPoints(motion, session->first, session->state.obstacles, NUM_OBSTACLES);
+    session->state.generation++;
+    sessionPublish(session->segment, &session->state);
+}
+
+static void *runShard(void *argument) {
+    Shard *shard = argument;
+
+    if (shard->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            fprintf(stderr, "sessionServer: shard %d not pinned to CPU %d\n", shard->index, shard->cpu);
+        }
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "shard%d", shard->index);
+    pthread_setname_np(pthread_self(), name);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!atomic_load(&stopRequested)) {
+        double start = now();
+        for (int i = 0; i < shard->count; ++i) {
+            stepSession(&shard->sessions[i], shard->placement, shard->motion);
+        }
+        simMoveObstacles(shard->motion, shard->sessions[0].first, shard->count * NUM_OBSTACLES, simObstacleBound);
+        for (int i = 0; i < shard->count; ++i) {
+            publishSession(&shard->sessions[i], shard->motion);
+        }
+        double elapsed = now() - start;
+        shard->busy += elapsed;
+        shard->ticks++;
+        if (elapsed > shard->period) {
+            shard->overruns++;
+        }
+
+        // Absolute deadlines, so the stepping time does not add up as drift
+        long nanoseconds = next.tv_nsec + (long)(shard->period * 1e9);
+        next.tv_sec += nanoseconds / 1000000000L;
+        next.tv_nsec = nanoseconds % 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR &&
+               !atomic_load(&stopRequested)) {
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [--sessions N] [--shards N] [--period seconds] [--duration seconds] [--seed N]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int numSessions = 64;
+    int numShards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double period = simPhysicsPeriod;
+    double duration = 0;       // 0 runs until SIGINT or SIGTERM
+    uint64_t seed = rngSeedFromEnv();
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--sessions") == 0) {
+            numSessions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shards") == 0) {
+            numShards = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--period") == 0) {
+            period = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (numSessions < 1 || numSessions > sessionMaxSessions || numShards < 1 || period <= 0) {
+        usage(argv[0]);
+    }
+    if (numShards > numSessions) {
+        numShards = numSessions;
+    }
+
+    struct sigaction stopAction;
+    memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = requestStop;
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGTERM, &stopAction, NULL);
+
+    // SESSIONS SETUP: session i draws from stream i of the seed
+    Session *sessions = calloc(numSessions, sizeof(Session));
+    Shard *shards = calloc(numShards, sizeof(Shard));
+    Placement *placement = placementCreate(boardSize, boardSize, simSpacing, simPlacementCapacity);
+    SimMotion motion;
+    if (sessions == NULL || shards == NULL || placement == NULL ||
+        simMotionAlloc(&motion, numSessions * NUM_OBSTACLES) == -1) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numSessions; ++i) {
+        sessions[i].segment = sessionOpen(i, 1);
+        if (sessions[i].segment == NULL) {
+            for (int j = 0; j < i; ++j) {
+                sessionUnlink(j);
+            }
+            exit(EXIT_FAILURE);
+        }
+        sessions[i].first = i * NUM_OBSTACLES;
+        initSession(&sessions[i], placement, &motion, seed, i);
+    }
+
+    // SHARDS SETUP: contiguous blocks, one thread per CPU
+    int numCPUs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < numShards; ++i) {
+        int first = (int)((long)numSessions * i / numShards);
+        int last = (int)((long)numSessions * (i + 1) / numShards);
+        shards[i].index = i;
+        shards[i].cpu = numShards <= numCPUs ? i : -1;
+        shards[i].sessions = &sessions[first];
+        shards[i].count = last - first;
+        shards[i].placement = placementCreate(boardSize, boardSize, simSpacing, simPlacementCapacity);
+        shards[i].motion = &motion;
+        shards[i].period = period;
+        if (shards[i].placement == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&shards[i].thread, NULL, runShard, &shards[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("sessionServer: %d sessions on %d shards, segments %s0..%d\n",
+           numSessions, numShards, SESSION_SHM_PREFIX, numSessions - 1);
+    fflush(stdout);
+
+    double start = now();
+    while (!atomic_load(&stopRequested) && (duration <= 0 || now() - start < duration)) {
+        usleep(100000);
+    }
+    atomic_store(&stopRequested, 1);
+    for (int i = 0; i < numShards; ++i) {
+        pthread_join(shards[i].thread, NULL);
+    }
+    double elapsed = now() - start;
+
+    // REPORT
+    uint64_t steps = 0;
+    printf("%-6s %4s %8s %8s %9s %12s %6s\n", "shard", "cpu", "sessions", "ticks", "overruns", "busy_ms/tick", "load");
+    for (int i = 0; i < numShards; ++i) {
+        Shard *shard = &shards[i];
+        double perTick = shard->ticks ? shard->busy / shard->ticks : 0;
+        printf("%-6d %4d %8d %8llu %9llu %12.3f %5.1f%%\n", i, shard->cpu, shard->count,
+               (unsigned long long)shard->ticks, (unsigned long long)shard->overruns,
+               perTick * 1000.0, perTick / period * 100.0);
+        steps += shard->ticks * shard->count;
+    }
+    printf("%llu session steps in %.1f s (%.0f steps/s)\n", (unsigned long long)steps, elapsed, steps / elapsed);
+
+    // CLEANUP
+    for (int i = 0; i < numSessions; ++i) {
+        sessionClose(sessions[i].segment);
+        sessionUnlink(i);
+    }
+    for (int i = 0; i < numShards; ++i) {
+        placementDestroy(shards[i].placement);
+    }
+    placementDestroy(placement);
+    simMotionFree(&motion);
+    free(sessions);
+    free(shards);
+    return 0;
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include "../include/constant.h"
+#include "../include/simKernels.h"
+#include "../include/dronesim.h"
+#include "../include/inputScript.h"
+
+// Parameter sweep and Monte Carlo runner on libdronesim. Every combination of
+// the parameter ranges, seeds and input scripts is one run; the runs are
+// spread over a pool of threads that steal work from each other, and each
+// gives one CSV row.
+//
+// A range is "value" or "start:stop:step". The input scripts are those of
+// include/inputScript.h, held for that many physics steps. After the last line
+// the force is kept until the run ends; without scripts the drone gets no input.
+
+#define maxScripts 64
+#define maxWorkers 256
+
+typedef struct {
+    double start, stop, step;
+} Range;
+
+typedef struct {
+    DroneSimConfig config;
+    unsigned int seed;
+    int script;
+    DroneSimState state;
+    double wallTime;
+    int worker;
+} Run;
+
+// Runs [begin, end) still to do. The owner takes from the front, thieves take
+// the back half.
+typedef struct {
+    pthread_mutex_t lock;
+    long begin, end;
+} WorkQueue;
+
+typedef struct {
+    pthread_t thread;
+    int index;
+    long runsDone;
+    long steals;
+} Worker;
+
+static Range massRange, frictionRange, timeStepRange, radiusRange, obstaclesRange, targetsRange;
+static InputScript scripts[maxScripts];
+static int numScripts;
+static long numSteps = 1000;
+static unsigned int firstSeed = 1;
+static int numSeeds = 1;
+
+static Run *runs;
+static long numRuns;
+static WorkQueue queues[maxWorkers];
+static Worker workers[maxWorkers];
+static int numWorkers;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parseRange(const char *text, Range *range) {
+    int fields = sscanf(text, "%lf:%lf:%lf", &range->start, &range->stop, &range->step);
+    if (fields == 1) {
+        range->stop = range->start;
+        range->step = 1;
+        return 0;
+    }
+    return fields == 3 && range->step > 0 && range->stop >= range->start ? 0 : -1;
+}
+
+static long rangeCount(const Range *range) {
+    return (long)((range->stop - range->start) / range->step + 1e-9) + 1;
+}
+
+static double rangeValue(const Range *range, long i) {
+    return range->start + i * range->step;
+}
+
+// The run with the given number, the last dimension varying fastest
+static void describeRun(long index, Run *run) {
+    droneSimDefaultConfig(&run->config);
+    run->script = index % numScripts;
+    index /= numScripts;
+    run->seed = firstSeed + index % numSeeds;
+    index /= numSeeds;
+    run->config.numTargets = (int)rangeValue(&targetsRange, index % rangeCount(&targetsRange));
+    index /= rangeCount(&targetsRange);
+    run->config.numObstacles = (int)rangeValue(&obstaclesRange, index % rangeCount(&obstaclesRange));
+    index /= rangeCount(&obstaclesRange);
+    run->config.radius = rangeValue(&radiusRange, index % rangeCount(&radiusRange));
+    index /= rangeCount(&radiusRange);
+    run->config.timeStep = rangeValue(&timeStepRange, index % rangeCount(&timeStepRange));
+    index /= rangeCount(&timeStepRange);
+    run->config.friction = rangeValue(&frictionRange, index % rangeCount(&frictionRange));
+    index /= rangeCount(&frictionRange);
+    run->config.mass = rangeValue(&massRange, index);
+}
+
+static void execute(Run *run) {
+    double start = now();
+    DroneSim *sim = droneSimCreate(&run->config, 1, run->seed);
+    if (sim == NULL) {
+        memset(&run->state, 0, sizeof(run->state));
+        run->wallTime = -1;
+        return;
+    }
+
+    const InputScript *script = &scripts[run->script];
+    int forceDirection[2] = {0, 0};
+    DroneSimForce force = {0, 0};
+    int line = 0;
+    long hold = 0;
+    for (long step = 0; step < numSteps; ++step) {
+        while (hold == 0 && line < script->count) {
+            simApplyKey(script->keys[line], forceDirection);
+            force = (DroneSimForce){forceDirection[0], forceDirection[1]};
+            hold = script->steps[line++];
+        }
+        if (hold > 0) {
+            hold--;
+        }
+        droneSimStep(sim, &force, 1, &run->state, NULL, 0);
+    }
+
+    droneSimDestroy(sim);
+    run->wallTime = now() - start;
+}
+
+// Next run for a worker: its own queue first, then half of another one's
+static long nextRun(Worker *worker, unsigned int *seed) {
+    WorkQueue *own = &queues[worker->index];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->begin < own->end) {
+        long run = own->begin++;
+        pthread_mutex_unlock(&own->lock);
+        return run;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    // Start from a random victim so the thieves spread out
+    int first = rand_r(seed) % numWorkers;
+    for (int k = 0; k < numWorkers; ++k) {
+        int victim = (first + k) % numWorkers;
+        if (victim == worker->index) {
+            continue;
+        }
+        WorkQueue *queue = &queues[victim];
+        long begin = 0, end = 0;
+
+        pthread_mutex_lock(&queue->lock);
+        long left = queue->end - queue->begin;
+        if (left > 0) {
+            end = queue->end;
+            begin = end - (left + 1) / 2;
+            queue->end = begin;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if (end > begin) {
+            worker->steals++;
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return begin;
+        }
+    }
+    // No work is ever added, so empty queues everywhere means done
+    return -1;
+}
+
+static void *runWorker(void *argument) {
+    Worker *worker = argument;
+    unsigned int seed = worker->index + 1;
+    long run;
+
+    while ((run = nextRun(worker, &seed)) != -1) {
+        execute(&runs[run]);
+        runs[run].worker = worker->index;
+        worker->runsDone++;
+    }
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [--mass R] [--friction R] [--timestep R] [--radius R] [--obstacles R] [--targets R]\n"
+            "          [--seeds N | --seeds first:count] [--script file]... [--steps N] [--threads N] [--output file]\n"
+            "       R is a value or start:stop:step\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    DroneSimConfig defaults;
+    droneSimDefaultConfig(&defaults);
+    massRange = (Range){defaults.mass, defaults.mass, 1};
+    frictionRange = (Range){defaults.friction, defaults.friction, 1};
+    timeStepRange = (Range){defaults.timeStep, defaults.timeStep, 1};
+    radiusRange = (Range){defaults.radius, defaults.radius, 1};
+    obstaclesRange = (Range){defaults.numObstacles, defaults.numObstacles, 1};
+    targetsRange = (Range){defaults.numTargets, defaults.numTargets, 1};
+    numWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *outputPath = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        int error = 0;
+
+        if (strcmp(option, "--mass") == 0) {
+            error = parseRange(value, &massRange);
+        } else if (strcmp(option, "--friction") == 0) {
+            error = parseRange(value, &frictionRange);
+        } else if (strcmp(option, "--timestep") == 0) {
+            error = parseRange(value, &timeStepRange);
+        } else if (strcmp(option, "--radius") == 0) {
+            error = parseRange(value, &radiusRange);
+        } else if (strcmp(option, "--obstacles") == 0) {
+            error = parseRange(value, &obstaclesRange);
+        } else if (strcmp(option, "--targets") == 0) {
+            error = parseRange(value, &targetsRange);
+        } else if (strcmp(option, "--seeds") == 0) {
+            if (sscanf(value, "%u:%d", &firstSeed, &numSeeds) != 2) {
+                firstSeed = 1;
+                numSeeds = atoi(value);
+            }
+            error = numSeeds < 1;
+        } else if (strcmp(option, "--script") == 0) {
+            error = numScripts == maxScripts || inputScriptLoad(value, &scripts[numScripts++]) == -1;
+        } else if (strcmp(option, "--steps") == 0) {
+            numSteps = atol(value);
+            error = numSteps < 1;
+        } else if (strcmp(option, "--threads") == 0) {
+            numWorkers = atoi(value);
+            error = numWorkers < 1 || numWorkers > maxWorkers;
+        } else if (strcmp(option, "--output") == 0) {
+            outputPath = value;
+        } else {
+            error = 1;
+        }
+        if (error) {
+            fprintf(stderr, "%s: bad value for %s: %s\n", argv[0], option, value);
+            usage(argv[0]);
+        }
+    }
+    if (numScripts == 0) {
+        snprintf(scripts[0].name, sizeof(scripts[0].name), "none");
+        numScripts = 1;
+    }
+
+    numRuns = rangeCount(&massRange) * rangeCount(&frictionRange) * rangeCount(&timeStepRange) *
+              rangeCount(&radiusRange) * rangeCount(&obstaclesRange) * rangeCount(&targetsRange) *
+              numSeeds * numScripts;
+    runs = calloc(numRuns, sizeof(Run));
+    if (runs == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < numRuns; ++i) {
+        describeRun(i, &runs[i]);
+    }
+
+    FILE *output = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+    if (output == NULL) {
+        perror(outputPath);
+        exit(EXIT_FAILURE);
+    }
+
+    // Contiguous blocks to start with, stealing evens out the rest
+    if (numWorkers > numRuns) {
+        numWorkers = (int)numRuns;
+    }
+    double start = now();
+    for (int i = 0; i < numWorkers; ++i) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].begin = numRuns * i / numWorkers;
+        queues[i].end = numRuns * (i + 1) / numWorkers;
+        workers[i].index = i;
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    long steals = 0;
+    for (int i = 0; i < numWorkers; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        steals += workers[i].steals;
+    }
+    double elapsed = now() - start;
+
+    // One row per run, in run order whatever the thread that did it
+    fprintf(output, "run,mass,friction,timestep,radius,obstacles,targets,seed,script,steps,"
+                    "score,obstacle_hits,target_hits,path_length,wall_ms,worker\n");
+    long invalid = 0;
+    for (long i = 0; i < numRuns; ++i) {
+        const Run *run = &runs[i];
+        if (run->wallTime < 0) {
+            invalid++;
+        }
+        fprintf(output, "%ld,%g,%g,%g,%g,%d,%d,%u,%s,%llu,%d,%d,%d,%.3f,%.3f,%d\n", i,
+                run->config.mass, run->config.friction, run->config.timeStep, run->config.radius,
+                run->config.numObstacles, run->config.numTargets, run->seed, scripts[run->script].name,
+                (unsigned long long)run->state.steps, run->state.score, run->state.obstacleHits,
+                run->state.targetHits, run->state.distance, run->wallTime * 1000.0, run->worker);
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    fprintf(stderr, "%ld runs of %ld steps on %d threads in %.3f s (%.0f runs/s, %ld steals", numRuns,
+            numSteps, numWorkers, elapsed, numRuns / elapsed, steals);
+    if (invalid > 0) {
+        fprintf(stderr, ", %ld invalid configurations with wall_ms -1", invalid);
+    }
+    fprintf(stderr, ")\n");
+
+    free(runs);
+    return 0;
+}
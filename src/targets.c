@@ -19,42 +19,107 @@
 #include <math.h>
 #include <semaphore.h>
 #include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/simKernels.h"
+#include "../include/simLog.h"
+#include "../include/scheduler.h"
 
 
 
-// Update the target's location
-void updateTargets(Point *targets_location) {
+// Update the target's location, away from the drone
+void updateTargets(Point *targets_location, const double *position, Placement *placement, Rng *rng) {
     static bool initialized = false;
 
     if (!initialized) {
-        // Use the process ID as the seed for the random number generator
-        srand((unsigned int)getpid());
-
-        // Generate new targets only once
-        for (int i = 0; i < NUM_TARGETS; ++i) {
-            targets_location[i].x = rand() % (boardSize-10);
-            targets_location[i].y = rand() % (boardSize-10);
-            targets_location[i].number = rand() % 10 + 1;
+        // The run seed from master, on the targets' own stream
+        rngSeed(rng, rngSeedFromEnv(), rngStreamTargets);
+
+        // Generate new targets only once, unless resumed from the world
+        if (targets_location[0].number == 0) {
+            simPlacementReset(placement, position[4], position[5]);
+            simPlaceTargets(placement, targets_location, NUM_TARGETS, rng);
         }
         initialized = true;
     }
 }
 
-// Logging function
-void logData(FILE *logFile, Point *targets) {
-    time_t rawtime;
-    struct tm *info;
-    char buffer[80];
-
-    time(&rawtime);
-    info = localtime(&rawtime);
+// Raise the hit flag with the value of the reached target and add it to the score
+void recordTargetHit(WorldState *state, void *argument) {
+    int value = *(int *)argument;
+    memcpy(state->position, &value, sizeof(value));
+    state->targetHits++;
+    state->score += value;
+}
 
-    for (int i = 0; i < NUM_TARGETS; ++i) {
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
-        fprintf(logFile, "[%s] Target %d position: (%.2f, %.2f) | Generated Number: %d\n", buffer, i + 1, targets[i].x, targets[i].y, targets[i].number);
+// What the targets loop keeps between runs
+typedef struct {
+    World world;
+    FILE *logFile;
+    int pipeWindow;
+    int channelWindow, channelShm;
+    double position[6];
+    Point targets[NUM_TARGETS];        // updateTargets only fills it once
+    Rng rng;
+    Placement *placement;
+} TargetLoop;
+
+// Publish the targets and replace the one the drone reached, every second
+static void checkTargets(void *argument) {
+    TargetLoop *loop = argument;
+    Point *targets = loop->targets;
+    double *position = loop->position;
+
+    metricsLoopBegin();
+    updateTargets(targets, position, loop->placement, &loop->rng);
+    worldWriteField(&loop->world, targets, targets);
+    metricsSent(loop->channelShm, sizeof(loop->targets));
+
+    // Logging targets positions and generated numbers to the file
+    simLogTargets(loop->logFile, targets, NUM_TARGETS);
+
+    // Sending targets to window.c via pipe
+    metricsSent(loop->channelWindow, ipcWrite(loop->pipeWindow, targets, sizeof(loop->targets)));
+
+    // Reading from shared memory
+    worldRead(&loop->world, position, sizeof(loop->position));
+    metricsReceived(loop->channelShm, sizeof(loop->position));
+
+    // Check if the drone reaches any of the targets
+    traceBegin("targetHits");
+    int targetReachedIndex = simFindHit(targets, NUM_TARGETS, position[4], position[5], RADIUS);
+    traceEnd("targetHits");
+
+    // If the drone reached any target, update targets
+    if (targetReachedIndex != -1) {
+        traceInstant("targetHit");
+        // Remove the reached target and generate a new one for the last position,
+        // away from the drone, the obstacles and the other targets
+        Point obstacles[NUM_OBSTACLES];
+        worldReadField(&loop->world, obstacles, obstacles);
+        metricsReceived(loop->channelShm, sizeof(obstacles));
+        simPlacementReset(loop->placement, position[4], position[5]);
+        simPlacementKeep(loop->placement, obstacles, NUM_OBSTACLES);
+        simPlacementKeep(loop->placement, targets, NUM_TARGETS);
+        int removedTargetValue = simReplaceTarget(loop->placement, targets, NUM_TARGETS, targetReachedIndex,
+                                                  &loop->rng);
+
+        // Logging updated targets positions and generated numbers to the file
+        simLogTargets(loop->logFile, targets, NUM_TARGETS);
+
+        // Sending updated targets to window.c via pipe
+        metricsSent(loop->channelWindow, ipcWrite(loop->pipeWindow, targets, sizeof(loop->targets)));
+
+        // Write the removed target value and the new targets to shared memory
+        worldUpdate(&loop->world, recordTargetHit, &removedTargetValue);
+        worldWriteField(&loop->world, targets, targets);
+        metricsSent(loop->channelShm, sizeof(removedTargetValue) + sizeof(loop->targets));
     }
 
-    fflush(logFile);
+    metricsLoopEnd();
 }
 
 int main(int argc, char *argv[]) {
@@ -69,108 +134,61 @@ int main(int argc, char *argv[]) {
     int pipeTargetsWindow[2], pipeWatchdogTargets[2];
     pid_t obstaclePID = getpid();
     sscanf(argv[1], "%d %d|%d %d", &pipeTargetsWindow[0], &pipeTargetsWindow[1], &pipeWatchdogTargets[0], &pipeWatchdogTargets[1]);
-    close(pipeTargetsWindow[0]);
-    close(pipeWatchdogTargets[0]);  // Closing unnecessary pipes
-    write(pipeWatchdogTargets[1], &obstaclePID, sizeof(obstaclePID));
-    close(pipeWatchdogTargets[1]);
+    ipcClose(pipeTargetsWindow[0]);
+    ipcClose(pipeWatchdogTargets[0]);  // Closing unnecessary pipes
+    ipcWrite(pipeWatchdogTargets[1], &obstaclePID, sizeof(obstaclePID));
+    ipcClose(pipeWatchdogTargets[1]);
+
+    TargetLoop loop = {.pipeWindow = pipeTargetsWindow[1]};
 
     // Open the log file
-    FILE *logFile;
     char logFilePath[100];
     snprintf(logFilePath, sizeof(logFilePath), "log/targetsLog.txt");
-    logFile = fopen(logFilePath, "w");
+    loop.logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
 
-    if (logFile == NULL) {
+    if (loop.logFile == NULL) {
         perror("Error opening log file");
         exit(EXIT_FAILURE);
     }
 
     // Shared memory setup
-    double position[6] = {boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2};
-    int sharedSegSize = sizeof(position);
-
-    sem_t *semID = sem_open(SEM_PATH, 0);
-    if (semID == SEM_FAILED) {
-        perror("sem_open");
-        exit(EXIT_FAILURE);
-    }
-    int shmfd = shm_open(SHM_PATH, O_RDWR, S_IRWXU | S_IRWXG);
-    if (shmfd < 0) {
-        perror("shm_open");
+    if (worldAttach(&loop.world) == -1) {
         exit(EXIT_FAILURE);
     }
-    void *shmPointer = mmap(NULL, sharedSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
-    if (shmPointer == MAP_FAILED) {
-        perror("mmap");
+
+    metricsAttach(slotTargets, "targets");
+    loop.channelWindow = metricsChannel("targets->window");
+    loop.channelShm = metricsChannel("shm");
+
+    // Never block on a window that is slow or not running (headless mode),
+    // a list that cannot be delivered now is stale by the next one anyway
+    ipcSetNonBlocking(pipeTargetsWindow[1]);
+
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1) {
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        Point targets[NUM_TARGETS];
-        updateTargets(targets);
-
-        // Logging targets positions and generated numbers to the file
-        logData(logFile, targets);
-
-        // Sending targets to window.c via pipe
-        write(pipeTargetsWindow[1], targets, sizeof(targets));
-
-        // Reading from shared memory
-        sem_wait(semID);
-        memcpy(position, shmPointer, sharedSegSize);
-        sem_post(semID);
-
-        // Check if the drone reaches any of the targets
-        bool droneReachedTarget = false;
-        int targetReachedIndex = -1;
-        for (int i = 0; i < NUM_TARGETS; ++i) {
-            double distance = sqrt(pow(position[4] - targets[i].x, 2) + pow(position[5] - targets[i].y, 2));
-            if (distance < RADIUS) {
-                droneReachedTarget = true;
-                targetReachedIndex = i;
-                break;
-            }
-        }
+    startupBarrier("targets");
 
-        // If the drone reached any target, update targets
-        if (droneReachedTarget) {
-            // Store the value of the removed target
-            int removedTarget,removedTargetValue;
-            removedTarget = targets[targetReachedIndex].number;
-            
-            if (1 <= removedTarget && removedTarget<= 10 )
-             {
-                removedTargetValue = removedTarget ;
-             }
-
-            // Update targets (remove the target reached by the drone)
-            for (int i = targetReachedIndex; i < NUM_TARGETS - 1; ++i) {
-                targets[i] = targets[i + 1];
-            }
-
-
-            // Generate a new target for the last position
-            targets[NUM_TARGETS - 1].x = rand() % (boardSize-10);
-            targets[NUM_TARGETS - 1].y = rand() % (boardSize-10);
-            targets[NUM_TARGETS - 1].number = rand() % 10 + 1;
-
-            // Logging updated targets positions and generated numbers to the file
-            logData(logFile, targets);
-
-            // Sending updated targets to window.c via pipe
-            write(pipeTargetsWindow[1], targets, sizeof(targets));
-
-            // Write the removed target value to shared memory
-            sem_wait(semID);
-            memcpy(shmPointer, &removedTargetValue, sizeof(removedTargetValue));
-            sem_post(semID);
-        }
+    loop.placement = placementCreate(boardSize, boardSize, simSpacing, simPlacementCapacity);
+    if (loop.placement == NULL) {
+        perror("Error allocating the targets placement");
+        exit(EXIT_FAILURE);
+    }
+    worldRead(&loop.world, loop.position, sizeof(loop.position));
 
-        sleep(1);
+    // Restarted or restored: go on with the targets in the world
+    if (isRestart(argc, argv)) {
+        worldReadField(&loop.world, targets, loop.targets);
     }
 
+    schedulerEvery(&scheduler, 1.0, checkTargets, &loop);
+    schedulerRun(&scheduler);
+
     // Close pipes
-    close(pipeTargetsWindow[1]);
+    schedulerDestroy(&scheduler);
+    ipcClose(pipeTargetsWindow[1]);
 
     return 0;
 }
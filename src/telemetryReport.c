@@ -0,0 +1,57 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "../include/constant.h"
+#include "../include/telemetry.h"
+
+// Print the aggregates server wrote to TELEMETRY_PATH, all of them or only
+// those of one resolution (--resolution 1|10|60)
+int main(int argc, char *argv[]) {
+    const char *path = TELEMETRY_PATH;
+    uint32_t resolution = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+            resolution = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--resolution seconds] [file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    TelemetryFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != telemetryMagic ||
+        header.version != telemetryVersion || header.recordSize != sizeof(TelemetryAggregate)) {
+        fprintf(stderr, "%s: not a telemetry file of this version\n", path);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    char line[256];
+    telemetryFormatHeader(line, sizeof(line));
+    printf("%12s %s", "start", line);
+
+    TelemetryAggregate aggregate;
+    while (fread(&aggregate, sizeof(aggregate), 1, file) == 1) {
+        if (resolution != 0 && aggregate.resolution != resolution) {
+            continue;
+        }
+        telemetryFormatAggregate(&aggregate, line, sizeof(line));
+        printf("%12.2f %s", aggregate.start, line);
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/trace.h"
+
+// Merge the trace buffers of a run (make TRACE=1) into one Chrome trace
+// event file, to open in chrome://tracing or ui.perfetto.dev. Every buffer
+// is a thread track named after its component; in the process build every
+// component is a process of its own, in the threaded build they are the
+// threads of one. Times are microseconds from the earliest event recorded.
+// A buffer that wrapped around starts with the ends of spans it lost the
+// beginning of, which are dropped.
+
+#define maxBuffers 64
+
+typedef struct {
+    const TraceBuffer *buffer;
+    uint64_t first, head;
+} Track;
+
+static Track tracks[maxBuffers];
+static int numTracks;
+
+static void openBuffer(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+    const TraceBuffer *buffer = mmap(NULL, sizeof(TraceBuffer), PROT_READ, MAP_SHARED, fd, 0);
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    if (buffer == MAP_FAILED || size != (off_t)sizeof(TraceBuffer) || buffer->magic != traceMagic ||
+        buffer->capacity != traceCapacity) {
+        fprintf(stderr, "%s: not a trace buffer of this build\n", path);
+        if (buffer != MAP_FAILED) {
+            munmap((void *)buffer, sizeof(TraceBuffer));
+        }
+        return;
+    }
+    Track *track = &tracks[numTracks++];
+    track->buffer = buffer;
+    track->head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    track->first = track->head > traceCapacity ? track->head - traceCapacity : 0;
+}
+
+static int sharesProcess(const Track *track) {
+    for (int i = 0; i < numTracks; i++) {
+        if (&tracks[i] != track && tracks[i].buffer->pid == track->buffer->pid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *directoryPath = TRACE_DIR;
+    const char *outputPath = "log/trace.json";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (argv[i][0] != '-') {
+            directoryPath = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--output trace.json] [directory]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    DIR *directory = opendir(directoryPath);
+    if (directory == NULL) {
+        perror(directoryPath);
+        return EXIT_FAILURE;
+    }
+    char path[512];
+    for (struct dirent *entry = readdir(directory); entry != NULL && numTracks < maxBuffers;
+         entry = readdir(directory)) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && strcmp(entry->d_name + length - 4, ".bin") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", directoryPath, entry->d_name);
+            openBuffer(path);
+        }
+    }
+    closedir(directory);
+    if (numTracks == 0) {
+        fprintf(stderr, "%s: no trace buffers, build with make TRACE=1 and run the simulation first\n",
+                directoryPath);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t origin = UINT64_MAX;
+    for (int t = 0; t < numTracks; t++) {
+        if (tracks[t].head > tracks[t].first) {
+            uint64_t time = tracks[t].buffer->events[tracks[t].first & (traceCapacity - 1)].time;
+            origin = time < origin ? time : origin;
+        }
+    }
+
+    FILE *output = fopen(outputPath, "w");
+    if (output == NULL) {
+        perror(outputPath);
+        return EXIT_FAILURE;
+    }
+    fprintf(output, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    long events = 0;
+    for (int t = 0; t < numTracks; t++) {
+        const TraceBuffer *buffer = tracks[t].buffer;
+        fprintf(output,
+                "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n"
+                "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                buffer->pid, buffer->tid, sharesProcess(&tracks[t]) ? "droneSimThreaded" : buffer->component,
+                buffer->pid, buffer->tid, buffer->component);
+
+        int depth = 0;
+        for (uint64_t i = tracks[t].first; i < tracks[t].head; i++) {
+            const TraceEvent *event = &buffer->events[i & (traceCapacity - 1)];
+            double ts = (double)(event->time - origin) / 1000.0;
+
+            if (event->type == traceSpanEnd && depth == 0) {
+                continue;
+            }
+            depth += event->type == traceSpanBegin ? 1 : event->type == traceSpanEnd ? -1 : 0;
+
+            fprintf(output, "{\"name\": \"%.*s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d", traceNameLength - 1,
+                    event->name, event->type, ts, buffer->pid, buffer->tid);
+            if (event->type == traceCounterEvent) {
+                fprintf(output, ", \"args\": {\"value\": %lld}", (long long)event->value);
+            } else if (event->type == traceInstantEvent) {
+                fprintf(output, ", \"s\": \"t\"");
+            }
+            fprintf(output, "},\n");
+            events++;
+        }
+    }
+    // A last event without a comma after it
+    fprintf(output, "{\"name\": \"merged\", \"ph\": \"i\", \"s\": \"g\", \"ts\": 0, \"pid\": 0, \"tid\": 0}\n]}\n");
+    fclose(output);
+
+    printf("%ld events from %d buffers written to %s\n", events, numTracks, outputPath);
+    return 0;
+}
@@ -11,7 +11,14 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <time.h>  
+#include <fcntl.h>
+#include <errno.h>
 #include "../include/constant.h"
+#include "../include/metrics.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/scheduler.h"
+#include "../include/deadline.h"
 
 int serverCounter, windowCounter, keyboardCounter, droneCounter, targetsCounter, obstaclesCounter;
 pid_t serverPID, windowPID, keyboardPID, dronePID, watchdogPID, targetsPID, obstaclesPID, pidKB;
@@ -112,59 +119,321 @@ void handler_Signal(int signo, siginfo_t *siginfo, void *context) {
     }
 }
 
+// Pick up the PID a restarted process announces on its pipe
+void checkRegistration(int fd, pid_t *pid, int *counter, char *name) {
+    pid_t newPID;
+    while (ipcRead(fd, &newPID, sizeof(newPID)) == sizeof(newPID)) {
+        if (newPID > 0 && newPID != *pid) {
+            printf("%s registered with PID %d\n", name, newPID);
+            *pid = newPID;
+            *counter = 0;
+        }
+    }
+}
+
+// Send the heartbeat request, a process that is being restarted is skipped
+void pingProcess(pid_t pid, char *name) {
+    if (pid <= 0) {
+        return;
+    }
+    if (kill(pid, SIGUSR1) == -1 && errno != ESRCH) {
+        char msg[100];
+        snprintf(msg, sizeof(msg), "kill %s", name);
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Kill only the process that stalled, master restarts it and the new
+// instance registers itself again through checkRegistration
+void requestRestart(pid_t *pid, int *counter, char *name, FILE *logFile, const char *reason) {
+    time_t rawtime;
+    struct tm *info;
+    char buffer[80];
+
+    time(&rawtime);
+    info = localtime(&rawtime);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
+    fprintf(logFile, "[%s] %s(%d) %s, requesting restart\n", buffer, name, *pid, reason);
+    fflush(logFile);
+    printf("%s stalled, requesting restart\n", name);
+
+    kill(*pid, SIGKILL);
+    *pid = 0;
+    *counter = 0;
+}
+
+void restartIfStalled(pid_t *pid, int *counter, char *name, FILE *logFile) {
+    if (*counter <= counterThresold || *pid <= 0) {
+        return;
+    }
+    char reason[64];
+    snprintf(reason, sizeof(reason), "missed %d heartbeats", *counter);
+    requestRestart(pid, counter, name, logFile, reason);
+}
+
+#ifdef THREADED_MODE
+// Every component is a thread of this process, so it can neither be signalled
+// nor restarted alone: the heartbeat is the loop of its metrics block, and a
+// component that makes no progress for longer than its deadline ends the
+// whole simulation. Until its deadline is learned it gets the old fixed one,
+// counterThresold checks of the former 0.6 s period.
+#define threadCheckPeriod 0.05
+#define threadLogChecks 12
+#define threadFallbackDeadline (counterThresold * 0.6)
+
+typedef struct {
+    MetricsTable *table;
+    FILE *logFile;
+    Deadline deadlines[metricsSlots];
+    int checks;
+} ThreadMonitor;
+
+static void checkThreads(void *argument) {
+    ThreadMonitor *monitor = argument;
+    FILE *logFile = monitor->logFile;
+    double now = metricsNow();
+    bool logging = monitor->checks++ % threadLogChecks == 0;
+
+    metricsLoopBegin();
+
+    time_t rawtime;
+    struct tm *info;
+    char buffer[80];
+
+    time(&rawtime);
+    info = localtime(&rawtime);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
+    if (logging) {
+        fprintf(logFile, "[%s] Heartbeats (silent/deadline):", buffer);
+    }
+
+    for (int i = 0; i < metricsSlots; i++) {
+        ComponentMetrics *component = &monitor->table->components[i];
+        if (i == slotWatchdog || component->pid == 0) {
+            continue;
+        }
+        Deadline *deadline = &monitor->deadlines[i];
+        double silent = deadlineObserve(deadline, component, now);
+        double limit = deadlineSeconds(deadline, threadFallbackDeadline);
+        if (logging) {
+            fprintf(logFile, " %s(%.2f/%.2f)", component->name, silent, limit);
+        }
+
+        if (silent > limit) {
+            fprintf(logFile, "\n[%s] %s made no progress for %.2f s (deadline %.2f s), watchdog terminated all threads\n",
+                    buffer, component->name, silent, limit);
+            fflush(logFile);
+            printf("%s stalled, terminating\n", component->name);
+            exit(1);
+        }
+    }
+    if (logging) {
+        fprintf(logFile, "\n");
+        fflush(logFile);
+    }
+
+    metricsLoopEnd();
+}
+
+void monitorThreads(FILE *logFile) {
+    ThreadMonitor monitor = {.table = metricsOpenTable(), .logFile = logFile};
+    Scheduler scheduler;
+    if (monitor.table == NULL || schedulerCreate(&scheduler) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    schedulerEvery(&scheduler, threadCheckPeriod, checkThreads, &monitor);
+    schedulerRun(&scheduler);
+    exit(EXIT_FAILURE);
+}
+#endif
+
+// A heartbeat round takes heartbeatPhases phases of heartbeatPhasePeriod:
+// the processes are pinged one phase apart, with a pause after the keyboard
+// manager and after targets, and the last phase logs and restarts
+#define heartbeatPhasePeriod 0.05
+#define heartbeatPhases 10
+
+// The supervised processes in the order of their registration pipes, with
+// their block in the metrics table
+typedef struct {
+    pid_t *pid;
+    int *counter;
+    char *name;
+    int slot;
+} Supervised;
+
+static Supervised supervised[6] = {
+    {&serverPID, &serverCounter, "Server", slotServer},
+    {&windowPID, &windowCounter, "Window", slotWindow},
+    {&keyboardPID, &keyboardCounter, "KeyboardManager", slotKeyboard},
+    {&dronePID, &droneCounter, "DroneDynamics", slotDrone},
+    {&obstaclesPID, &obstaclesCounter, "Obstacles", slotObstacles},
+    {&targetsPID, &targetsCounter, "Targets", slotTargets},
+};
+
+typedef struct {
+    FILE *logFile;
+    int registration[6];               // Pipes on which the processes announce their PIDs
+    int phase;
+    MetricsTable *table;               // NULL leaves only the heartbeat signals
+    Deadline deadlines[6];
+} Heartbeat;
+
+// Every phase: a process whose loop has made no progress for longer than its
+// learned deadline is restarted without waiting for counterThresold rounds of
+// unanswered signals, which stay the check of last resort. A process is only
+// judged once its metrics block carries its PID and it has run an iteration
+// since it registered, so a slow start is left to the signals as well.
+static void checkProgress(Heartbeat *heartbeat) {
+    if (heartbeat->table == NULL) {
+        return;
+    }
+    double now = metricsNow();
+    for (int i = 0; i < 6; i++) {
+        Supervised *process = &supervised[i];
+        ComponentMetrics *component = &heartbeat->table->components[process->slot];
+        Deadline *deadline = &heartbeat->deadlines[i];
+        if (*process->pid <= 0 || __atomic_load_n(&component->pid, __ATOMIC_RELAXED) != *process->pid) {
+            deadlineRestart(deadline, now);
+            continue;
+        }
+        double silent = deadlineObserve(deadline, component, now);
+        double limit = deadlineSeconds(deadline, INFINITY);
+        if (deadline->lastStart > 0 && silent > limit) {
+            char reason[80];
+            snprintf(reason, sizeof(reason), "made no progress for %.2f s (deadline %.2f s)", silent, limit);
+            requestRestart(process->pid, process->counter, process->name, heartbeat->logFile, reason);
+            deadlineRestart(deadline, now);
+        }
+    }
+}
+
+static void heartbeatPhase(void *argument) {
+    Heartbeat *heartbeat = argument;
+    FILE *logFile = heartbeat->logFile;
+    int phase = heartbeat->phase;
+    heartbeat->phase = (phase + 1) % heartbeatPhases;
+
+    checkProgress(heartbeat);
+
+    switch (phase) {
+        case 0:
+            metricsLoopBegin();
+            checkRegistration(heartbeat->registration[0], &serverPID, &serverCounter, "Server");
+            checkRegistration(heartbeat->registration[1], &windowPID, &windowCounter, "Window");
+            checkRegistration(heartbeat->registration[2], &keyboardPID, &keyboardCounter, "KeyboardManager");
+            checkRegistration(heartbeat->registration[3], &dronePID, &droneCounter, "DroneDynamics");
+            checkRegistration(heartbeat->registration[4], &obstaclesPID, &obstaclesCounter, "Obstacles");
+            checkRegistration(heartbeat->registration[5], &targetsPID, &targetsCounter, "Targets");
+
+            serverCounter++;
+            windowCounter++;
+            droneCounter++;
+            keyboardCounter++;
+            targetsCounter++;
+            obstaclesCounter++;
+
+            // Sending signals to other processes
+            pingProcess(serverPID, "server");
+            break;
+        case 1:
+            pingProcess(windowPID, "window");
+            break;
+        case 2:
+            pingProcess(keyboardPID, "keyboardManager");
+            break;
+        case 5:
+            pingProcess(dronePID, "droneDynamics");
+            break;
+        case 6:
+            pingProcess(obstaclesPID, "obstacles");
+            break;
+        case 7:
+            pingProcess(targetsPID, "targets");
+            break;
+        case heartbeatPhases - 1: {
+            // Logging the sent signals
+            time_t rawtime;
+            struct tm *info;
+            char buffer[80];
+
+            time(&rawtime);
+            info = localtime(&rawtime);
+
+            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
+            fprintf(logFile, "[%s] Signals sent to processes: Server(%d), Window(%d), KeyboardManager(%d), DroneDynamics(%d), Obstacles(%d), Targets(%d)\n",
+                    buffer, serverCounter, windowCounter, keyboardCounter, droneCounter, obstaclesCounter, targetsCounter);
+            fprintf(logFile, "[%s] Deadlines:", buffer);
+            for (int i = 0; i < 6; i++) {
+                double limit = deadlineSeconds(&heartbeat->deadlines[i], 0);
+                if (limit > 0) {
+                    fprintf(logFile, " %s(%.2f s)", supervised[i].name, limit);
+                } else {
+                    fprintf(logFile, " %s(learning)", supervised[i].name);
+                }
+            }
+            fprintf(logFile, "\n");
+            fflush(logFile);
+
+            // Restart only the processes that exceeded the threshold
+            restartIfStalled(&serverPID, &serverCounter, "Server", logFile);
+            restartIfStalled(&windowPID, &windowCounter, "Window", logFile);
+            restartIfStalled(&keyboardPID, &keyboardCounter, "KeyboardManager", logFile);
+            restartIfStalled(&dronePID, &droneCounter, "DroneDynamics", logFile);
+            restartIfStalled(&obstaclesPID, &obstaclesCounter, "Obstacles", logFile);
+            restartIfStalled(&targetsPID, &targetsCounter, "Targets", logFile);
+            metricsLoopEnd();
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 int main(int argc, char *argv[]) {
     // Pipes
     int pipeWatchdogServer[2], pipeWatchdogWindow[2], pipeWatchdogDrone[2], pipeWatchdogKeyboard[2], pipeWatchdogObstacles[2], pipeWatchdogTargets[2];
     serverCounter = windowCounter = droneCounter = keyboardCounter = obstaclesCounter = targetsCounter = 0;
 
-    // Get PID from all other processes
+    // Pipes of all other processes, optionally followed by the process group
+    // signalled by TerminateAll (0, the group of master, when absent)
          sscanf(argv[1], "%d %d|%d %d|%d %d|%d %d|%d %d|%d %d|%d", 
            &pipeWatchdogServer[0], &pipeWatchdogServer[1], 
            &pipeWatchdogWindow[0], &pipeWatchdogWindow[1], 
            &pipeWatchdogKeyboard[0], &pipeWatchdogKeyboard[1], 
            &pipeWatchdogDrone[0], &pipeWatchdogDrone[1],
+           &pipeWatchdogObstacles[0], &pipeWatchdogObstacles[1],
            &pipeWatchdogTargets[0], &pipeWatchdogTargets[1],
-           &pipeWatchdogObstacles[0], &pipeWatchdogObstacles[1], 
            &pidKB);
            
-    close(pipeWatchdogServer[1]);
-    close(pipeWatchdogDrone[1]);
-    close(pipeWatchdogKeyboard[1]);
-    close(pipeWatchdogWindow[1]);
-    close(pipeWatchdogTargets[1]);
-    close(pipeWatchdogObstacles[1]);
+    ipcClose(pipeWatchdogServer[1]);
+    ipcClose(pipeWatchdogDrone[1]);
+    ipcClose(pipeWatchdogKeyboard[1]);
+    ipcClose(pipeWatchdogWindow[1]);
+    ipcClose(pipeWatchdogTargets[1]);
+    ipcClose(pipeWatchdogObstacles[1]);
 
     watchdogPID = getpid();
-    read(pipeWatchdogDrone[0], &dronePID, sizeof(dronePID));
-    read(pipeWatchdogKeyboard[0], &keyboardPID, sizeof(keyboardPID));
-    read(pipeWatchdogWindow[0], &windowPID, sizeof(windowPID));
-    read(pipeWatchdogObstacles[0], &obstaclesPID, sizeof(obstaclesPID));
-    read(pipeWatchdogTargets[0], &targetsPID, sizeof(targetsPID));
-    read(pipeWatchdogServer[0], &serverPID, sizeof(serverPID));
-
-    printf("window: %d\n", windowPID);
-    printf("server: %d\n", serverPID);
-    printf("droneDynamics: %d\n", dronePID);
-    printf("keyboardManager: %d\n", keyboardPID);
-    printf("obstacles: %d\n", obstaclesPID);
-    printf("targets: %d\n", targetsPID);
     printf("watchdog: %d\n", watchdogPID);
 
+    // Keep the read ends open without blocking: every process announces its
+    // PID on its pipe before the simulation clock starts, and a restarted
+    // process announces the new one on the same pipe
+    int registrationFDs[] = {pipeWatchdogServer[0], pipeWatchdogWindow[0], pipeWatchdogKeyboard[0],
+                             pipeWatchdogDrone[0], pipeWatchdogObstacles[0], pipeWatchdogTargets[0]};
+    for (int i = 0; i < 6; i++) {
+        ipcSetNonBlocking(registrationFDs[i]);
+    }
 
-   // Closing unnecessary pipes
-    close(pipeWatchdogServer[0]);
-    close(pipeWatchdogDrone[0]);
-    close(pipeWatchdogKeyboard[0]);
-    close(pipeWatchdogTargets[0]);
-    close(pipeWatchdogObstacles[0]);
-    close(pipeWatchdogWindow[0]);  
-
+#ifndef THREADED_MODE
     // Signal handling
     struct sigaction sig_act;
     sig_act.sa_sigaction = handler_Signal;
     sig_act.sa_flags = SA_SIGINFO;
     sigaction(SIGINT, &sig_act, NULL);
     sigaction(SIGUSR2, &sig_act, NULL);
+#endif
 
     // Open the log file
     FILE *logFile;
@@ -177,80 +446,23 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        serverCounter++;
-        windowCounter++;
-        droneCounter++;
-        keyboardCounter++;
-        targetsCounter++;
-        obstaclesCounter++; 
-
-        // Sending signals to other processes
-        if (kill(serverPID, SIGUSR1) == -1) {
-            perror("kill server");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-
-        if (kill(windowPID, SIGUSR1) == -1) {
-            perror("kill window");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-
-        if (kill(keyboardPID, SIGUSR1) == -1) {
-            perror("kill keyboardManager");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-        usleep(50000);
-        usleep(50000);
-
-        if (kill(dronePID, SIGUSR1) == -1) {
-            perror("kill droneDynamics");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-
-        if (kill(obstaclesPID, SIGUSR1) == -1) {
-            perror("kill obstacles");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-
-        if (kill(targetsPID, SIGUSR1) == -1) {
-            perror("kill targets");
-            exit(EXIT_FAILURE);
-        }
-        usleep(50000);
-        usleep(50000);
-        usleep(50000);
-        
-        // Logging the sent signals
-        time_t rawtime;
-        struct tm *info;
-        char buffer[80];
-
-        time(&rawtime);
-        info = localtime(&rawtime);
-
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
-            fprintf(logFile, "[%s] Signals sent to processes: Server(%d), Window(%d), KeyboardManager(%d), DroneDynamics(%d), Obstacles(%d), Targets(%d)\n",
-            buffer, serverCounter, windowCounter, keyboardCounter, droneCounter, obstaclesCounter, targetsCounter);        
-            
-            fflush(logFile);
+    metricsAttach(slotWatchdog, "watchdog");
+    startupBarrier("watchdog");
 
-        if (serverCounter > counterThresold || windowCounter > counterThresold || droneCounter > counterThresold || keyboardCounter > counterThresold || obstaclesCounter > counterThresold || targetsCounter > counterThresold) {
-            watchdogPID = getpid();
-            TerminateAll();
+#ifdef THREADED_MODE
+    monitorThreads(logFile);
+#endif
 
-            // Logging the termination event
-            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", info);
-            fprintf(logFile, "[%s] Watchdog terminated due to process counters exceeding the threshold\n", buffer);
-            fflush(logFile);
-            exit(1);
-        }
+    Heartbeat heartbeat = {.logFile = logFile, .table = metricsOpenTable()};
+    memcpy(heartbeat.registration, registrationFDs, sizeof(registrationFDs));
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1) {
+        exit(EXIT_FAILURE);
     }
+    schedulerEvery(&scheduler, heartbeatPhasePeriod, heartbeatPhase, &heartbeat);
+    schedulerRun(&scheduler);
+
+    schedulerDestroy(&scheduler);
 
     // Closing the log file
     fclose(logFile);
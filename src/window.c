@@ -14,15 +14,36 @@
 #include <sys/stat.h>
 #include <signal.h>
 #include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "../include/constant.h"
-
-// Function for creating a new window
-WINDOW *createBoard(int height, int width, int starty, int startx)
+#include "../include/metrics.h"
+#include "../include/semProfiler.h"
+#include "../include/startup.h"
+#include "../include/ipc.h"
+#include "../include/world.h"
+#include "../include/heatmap.h"
+#include "../include/scheduler.h"
+
+// The window runs three threads. The main one collects a frame every
+// windowFramePeriod: the newest obstacles and targets queued on their pipes,
+// and the drone, score and trail from the world, and hands it to the render
+// thread through a sequence-locked slot it alone writes. The render thread
+// draws the newest frame every windowRenderPeriod and is the only one to call
+// ncurses once they run. The input thread waits on the terminal and forwards
+// every key to the keyboard manager as it arrives, so key latency no longer
+// depends on the frame time.
+
+#define windowFramePeriod 0.05
+#define windowRenderPeriod 0.05
+#define windowLogPeriod 1.0
+#define windowHeatmapPeriod 1.0        // The heatmap snapshot is reloaded at most this often
+
+// Function for drawing the borders of a window
+void drawBorders(WINDOW *displayWindow, int height, int width)
 {
-    WINDOW *displayWindow;
-
-    displayWindow = newwin(height, width, starty, startx);
-
     // Left border
     for (int i = 0; i < height * 0.9; ++i)
     {
@@ -48,7 +69,15 @@ WINDOW *createBoard(int height, int width, int starty, int startx)
     {
         mvwaddch(displayWindow, bottomBorderY, i, '=');
     }
+}
 
+// Function for creating a new window
+WINDOW *createBoard(int height, int width, int starty, int startx)
+{
+    WINDOW *displayWindow;
+
+    displayWindow = newwin(height, width, starty, startx);
+    drawBorders(displayWindow, height, width);
     wrefresh(displayWindow);
 
     return displayWindow;
@@ -68,16 +97,13 @@ void setupNcursesWindows(WINDOW **display, WINDOW **scoreboard)
     *scoreboard = createBoard(scoreboardHeight, scoreboardWidth, inPos[2], inPos[3]);
     *display = createBoard(displayHeight, displayWidth, inPos[0], inPos[1]);
 }
-// Global variables for ncurses windows
-WINDOW *display = NULL;
-WINDOW *scoreboard = NULL;
+// Set on SIGWINCH, the render thread rebuilds the windows at its next frame
+static atomic_int resized;
+
 // Signal handler function for SIGWINCH
 void handleResize(int sig)
 {
-    endwin(); 
-    refresh(); 
-    setupNcursesWindows(&display, &scoreboard);  
-    refresh(); 
+    atomic_store(&resized, 1);
 }
 
 void displayObstacles(WINDOW *win, Point *obstacles, double scalex, double scaley) {
@@ -88,6 +114,13 @@ void displayObstacles(WINDOW *win, Point *obstacles, double scalex, double scale
     wattroff(win, COLOR_PAIR(3));
 }
 
+// Where the drone has been, oldest samples first so the newest stay on top
+void displayTrail(WINDOW *win, const HistorySample *samples, int count, double scalex, double scaley) {
+    for (int i = count - 1; i > 0; i--) {
+        mvwaddch(win, (int)(samples[i].y / scaley), (int)(samples[i].x / scalex), '.');
+    }
+}
+
 // Function to display targets with fixed numbers
 void displayTargets(WINDOW *win, Point *targets, double scalex, double scaley) {
     wattron(win, COLOR_PAIR(4)); // Set color to green
@@ -97,8 +130,46 @@ void displayTargets(WINDOW *win, Point *targets, double scalex, double scaley) {
     wattroff(win, COLOR_PAIR(4));
 }
 
+// Heatmap overlay, toggled with 'h' and read from the snapshot server writes
+static Heatmap heatmap;
+static atomic_int showHeatmap;
+
+// Shade every board cell by the steps the drone spent there (log scale) and
+// mark where obstacles (X) and targets (o) were hit
+void displayHeatmap(WINDOW *win, const Heatmap *heatmap, double scalex, double scaley) {
+    static const char shades[] = " .:-=+*%@";
+    int levels = sizeof(shades) - 2;
+    int rows = (int)(boardSize / scaley);
+    int columns = (int)(boardSize / scalex);
+    double scale = heatmap->header.max[heatmapVisits] > 0 ? log1p(heatmap->header.max[heatmapVisits]) : 1;
+
+    for (int row = 1; row < rows; ++row) {
+        for (int column = 1; column < columns; ++column) {
+            double x0 = column * scalex, y0 = row * scaley;
+            double x1 = x0 + scalex * 0.999, y1 = y0 + scaley * 0.999;
+
+            if (heatmapSum(heatmap, heatmapObstacleHits, x0, y0, x1, y1) > 0) {
+                wattron(win, COLOR_PAIR(1));
+                mvwaddch(win, row, column, 'X');
+                wattroff(win, COLOR_PAIR(1));
+            } else if (heatmapSum(heatmap, heatmapTargetHits, x0, y0, x1, y1) > 0) {
+                wattron(win, COLOR_PAIR(4));
+                mvwaddch(win, row, column, 'o');
+                wattroff(win, COLOR_PAIR(4));
+            } else {
+                uint32_t visits = heatmapSum(heatmap, heatmapVisits, x0, y0, x1, y1);
+                if (visits > 0) {
+                    int level = 1 + (int)(log1p(visits) / scale * (levels - 1));
+                    wattron(win, COLOR_PAIR(5));
+                    mvwaddch(win, row, column, shades[level > levels ? levels : level]);
+                    wattroff(win, COLOR_PAIR(5));
+                }
+            }
+        }
+    }
+}
 
-void logData(FILE *logFile, double *position, int sharedSegSize, int score)
+static void logData(FILE *logFile, const double *position, int score)
 {
     time_t rawtime;
     struct tm *timeinfo;
@@ -113,15 +184,239 @@ void logData(FILE *logFile, double *position, int sharedSegSize, int score)
     fflush(logFile);
 }
 
+// What the render thread draws
+typedef struct {
+    Point obstacles[NUM_OBSTACLES];
+    Point targets[NUM_TARGETS];
+    double position[6];
+    int score;
+    int autopilot;
+    HistorySample trail[historyTrail];
+    int trailLength;
+    double speed;
+} Frame;
+
+// One writer, the main thread; the render thread copies the frame out and
+// retries if the sequence moved meanwhile, as worldRead does
+typedef struct {
+    atomic_uint sequence;      // Odd while a frame is being copied in
+    Frame frame;
+} FrameHandoff;
+
+static void framePublish(FrameHandoff *handoff, const Frame *frame) {
+    unsigned int sequence = atomic_load_explicit(&handoff->sequence, memory_order_relaxed);
+    atomic_store_explicit(&handoff->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&handoff->frame, frame, sizeof(*frame));
+    atomic_store_explicit(&handoff->sequence, sequence + 2, memory_order_release);
+}
+
+static void frameLatest(FrameHandoff *handoff, Frame *frame) {
+    for (;;) {
+        unsigned int before = atomic_load_explicit(&handoff->sequence, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(frame, &handoff->frame, sizeof(*frame));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&handoff->sequence, memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
+
+typedef struct {
+    World world;
+    int pipeKeyboard, pipeObstacles, pipeTargets;
+    int channelKeyboard, channelObstacles, channelTargets, channelShm;
+    FILE *logFile;
+    Frame frame;               // Being collected by the main thread
+    FrameHandoff handoff;
+} WindowLoop;
+
+// Keep the newest of the fixed size messages queued on a non-blocking pipe
+static void readLatest(int fd, void *message, size_t size, int channel, const char *name) {
+    ssize_t bytesRead;
+    while ((bytesRead = ipcRead(fd, message, size)) > 0) {
+        metricsReceived(channel, bytesRead);
+    }
+    if (bytesRead == -1 && errno != EAGAIN && errno != EINTR) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Main thread: gather a frame and hand it over
+static void collectFrame(void *argument) {
+    WindowLoop *loop = argument;
+    Frame *frame = &loop->frame;
+
+    metricsLoopBegin();
+    readLatest(loop->pipeObstacles, frame->obstacles, sizeof(frame->obstacles), loop->channelObstacles,
+               "read pipeObstaclesWindow");
+    readLatest(loop->pipeTargets, frame->targets, sizeof(frame->targets), loop->channelTargets,
+               "read pipeTargetsWindow");
+
+    // Reading from shared memory
+    worldRead(&loop->world, frame->position, sizeof(frame->position));
+    worldReadField(&loop->world, score, &frame->score);
+    worldReadField(&loop->world, autopilot, &frame->autopilot);
+    metricsReceived(loop->channelShm, sizeof(frame->position) + 2 * sizeof(int));
+
+    // Trail and speed from the drone history, read without the lock
+    frame->trailLength = historyLatest(worldHistory(&loop->world), frame->trail, historyTrail);
+    double velocity[2], acceleration[2];
+    historyMotion(frame->trail, frame->trailLength, velocity, acceleration);
+    frame->speed = hypot(velocity[0], velocity[1]);
+
+    framePublish(&loop->handoff, frame);
+    metricsLoopEnd();
+}
+
+static void logFrame(void *argument) {
+    WindowLoop *loop = argument;
+
+    // Writing to the log file
+    logData(loop->logFile, loop->frame.position, loop->frame.score);
+}
+
+static void drawFrame(WINDOW *win, WINDOW *scoreboard, const Frame *frame) {
+    double scalex, scaley;
+
+    scalex = (double)boardSize / ((double)COLS * (windowWidth - 0.1));
+    scaley = (double)boardSize / ((double)LINES * (windowHeight - 0.1));
+
+    // Print the position, speed and score in the scoreboard window
+    wattron(scoreboard, COLOR_PAIR(1));
+    mvwprintw(scoreboard, 1, 1, "Position of the drone: %.2f,%.2f", frame->position[4], frame->position[5]);
+    mvwprintw(scoreboard, 1, 40, "Speed: %.2f", frame->speed);
+    mvwprintw(scoreboard, 2, 1, "Score: %d", frame->score);
+    wattroff(scoreboard, COLOR_PAIR(1));
+
+    if (frame->autopilot) {
+        wprintw(scoreboard, "   Autopilot (a or a move key to take over)");
+    }
+
+    // Heatmap under everything else, as of the last snapshot
+    if (atomic_load(&showHeatmap)) {
+        static double lastLoad = 0;
+        if (metricsNow() - lastLoad >= windowHeatmapPeriod) {
+            if (heatmapLoad(&heatmap, HEATMAP_PATH) == -1) {
+                heatmapInit(&heatmap);
+            }
+            lastLoad = metricsNow();
+        }
+        displayHeatmap(win, &heatmap, scalex, scaley);
+        mvwprintw(scoreboard, 3, 1, "Heatmap (h to hide): %llu steps, %llu obstacle hits, %llu target hits",
+                  (unsigned long long)heatmap.header.total[heatmapVisits],
+                  (unsigned long long)heatmap.header.total[heatmapObstacleHits],
+                  (unsigned long long)heatmap.header.total[heatmapTargetHits]);
+    }
+
+    // Display obstacles on the window
+    displayObstacles(win, (Point *)frame->obstacles, scalex, scaley);
+
+    // Display targets on the window
+    displayTargets(win, (Point *)frame->targets, scalex, scaley);
+
+    displayTrail(win, frame->trail, frame->trailLength, scalex, scaley);
+
+    // Showing the drone and position in the konsole
+    wattron(win, COLOR_PAIR(2));
+    mvwprintw(win, (int)(frame->position[5] / scaley), (int)(frame->position[4] / scalex), "+");
+    wattroff(win, COLOR_PAIR(2));
+}
+
+// Render thread: the windows are rebuilt only when the terminal is resized
+static void *renderFrames(void *argument) {
+    WindowLoop *loop = argument;
+    traceAttach("windowRender");
+
+    WINDOW *win, *scoreboard;
+    setupNcursesWindows(&win, &scoreboard);
+    struct timespec period = {0, (long)(windowRenderPeriod * 1e9)};
+    Frame frame;
+
+    while (1) {
+        if (atomic_exchange(&resized, 0)) {
+            delwin(win);
+            delwin(scoreboard);
+            endwin();
+            clear();
+            refresh();
+            setupNcursesWindows(&win, &scoreboard);
+        }
+        frameLatest(&loop->handoff, &frame);
+
+        traceBegin("draw");
+        int height, width;
+        werase(win);
+        werase(scoreboard);
+        getmaxyx(win, height, width);
+        drawBorders(win, height, width);
+        getmaxyx(scoreboard, height, width);
+        drawBorders(scoreboard, height, width);
+        drawFrame(win, scoreboard, &frame);
+        wnoutrefresh(win);
+        wnoutrefresh(scoreboard);
+        doupdate();
+        traceEnd("draw");
+
+        while (nanosleep(&period, &period) == -1 && errno == EINTR) {
+        }
+        period.tv_nsec = (long)(windowRenderPeriod * 1e9);
+    }
+    return NULL;
+}
+
+// Input thread: sending user input to keyboardManager.c as it is typed
+static void *forwardKeys(void *argument) {
+    WindowLoop *loop = argument;
+    traceAttach("windowInput");
+
+    while (1) {
+        unsigned char character;
+        ssize_t bytesRead = read(STDIN_FILENO, &character, 1);
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            // No terminal to read from, the window only draws
+            return NULL;
+        }
+        int key = character;
+        traceInstant("key");
+
+        if ((char)key == 'h')
+        {
+            // Handled here, the keyboard manager never sees it
+            atomic_fetch_xor(&showHeatmap, 1);
+            continue;
+        }
+        int keypress = ipcWrite(loop->pipeKeyboard, &key, sizeof(key));
+        if (keypress < 0)
+        {
+            perror("writing error");
+            ipcClose(loop->pipeKeyboard);
+            exit(EXIT_FAILURE);
+        }
+        metricsSent(loop->channelKeyboard, keypress);
+        if ((char)key == 'q')
+        {
+            ipcClose(loop->pipeKeyboard);
+            fflush(loop->logFile);
+            exit(EXIT_SUCCESS);
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    // Initializing ncurses
+    // Initializing ncurses, keys are read one at a time by the input thread
     initscr();
-    int key, initial;
-    initial = 0;
-    int totalScore;
-    int lastObstacleHit = 0; 
-
+    cbreak();
+    noecho();
+    curs_set(0);
 
     // Setting up colors
     start_color();
@@ -129,6 +424,7 @@ int main(int argc, char *argv[])
     init_pair(2, COLOR_BLUE, COLOR_BLACK);
     init_pair(3, COLOR_YELLOW, COLOR_BLACK);
     init_pair(4, COLOR_GREEN, COLOR_BLACK);
+    init_pair(5, COLOR_MAGENTA, COLOR_BLACK);
 
     // Setting up signal handling for window resize
     signal(SIGWINCH, handleResize);
@@ -144,183 +440,104 @@ int main(int argc, char *argv[])
     // Extracting pipe information from command line arguments
     int pipeWindowKeyboard[2], pipeWatchdogWindow[2], pipeObstaclesWindow[2], pipeTargetsWindow[2];
     sscanf(argv[1], "%d %d|%d %d|%d %d|%d %d", &pipeWindowKeyboard[0], &pipeWindowKeyboard[1], &pipeWatchdogWindow[0], &pipeWatchdogWindow[1], &pipeObstaclesWindow[0], &pipeObstaclesWindow[1], &pipeTargetsWindow[0], &pipeTargetsWindow[1]);
-    close(pipeWindowKeyboard[0]);
-    close(pipeWatchdogWindow[0]);
-    close(pipeObstaclesWindow[1]);
-    close(pipeTargetsWindow[1]);
+    ipcClose(pipeWindowKeyboard[0]);
+    ipcClose(pipeWatchdogWindow[0]);
+    ipcClose(pipeObstaclesWindow[1]);
+    ipcClose(pipeTargetsWindow[1]);
 
     // Sending PID to watchdog
     pid_t windowPID;
     windowPID = getpid();
-    if (write(pipeWatchdogWindow[1], &windowPID, sizeof(windowPID)) == -1)
+    if (ipcWrite(pipeWatchdogWindow[1], &windowPID, sizeof(windowPID)) == -1)
     {
         perror("write pipeWatchdogWindow");
         exit(EXIT_FAILURE);
     }
     printf("%d\n", windowPID);
-    close(pipeWatchdogWindow[1]);
+    ipcClose(pipeWatchdogWindow[1]);
+
+    static WindowLoop loop;
+    loop.pipeKeyboard = pipeWindowKeyboard[1];
+    loop.pipeObstacles = pipeObstaclesWindow[0];
+    loop.pipeTargets = pipeTargetsWindow[0];
 
     // Shared memory setup
     double position[6] = {boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2, boardSize / 2};
     int sharedSegSize = (sizeof(position));
 
-    sem_t *semID = sem_open(SEM_PATH, 0);
-    if (semID == SEM_FAILED)
+    if (worldAttach(&loop.world) == -1)
     {
-        perror("sem_open");
         exit(EXIT_FAILURE);
     }
-    int shmfd = shm_open(SHM_PATH, O_RDWR, S_IRWXU | S_IRWXG);
-    if (shmfd < 0)
-    {
-        perror("shm_open");
-        exit(EXIT_FAILURE);
-    }
-    void *shmPointer = mmap(NULL, sharedSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
-    if (shmPointer == MAP_FAILED)
-    {
-        perror("mmap");
-        exit(EXIT_FAILURE);
-    }
-     
+
+    metricsAttach(slotWindow, "window");
+    loop.channelKeyboard = metricsChannel("window->keyboard");
+    loop.channelObstacles = metricsChannel("obstacles->window");
+    loop.channelTargets = metricsChannel("targets->window");
+    loop.channelShm = metricsChannel("shm");
+
     // Open the log files
-    FILE *logFile;
     char logFilePath[100];
     snprintf(logFilePath, sizeof(logFilePath), "log/windowLog.txt");
-    logFile = fopen(logFilePath, "w");
+    loop.logFile = fopen(logFilePath, isRestart(argc, argv) ? "a" : "w");
 
-    if (logFile == NULL)
+    if (loop.logFile == NULL)
     {
         perror("Error opening log file");
         exit(EXIT_FAILURE);
     }
 
-    while (1)
+    Scheduler scheduler;
+    if (schedulerCreate(&scheduler) == -1)
     {
-        // Refreshing windows
-        WINDOW *win, *scoreboard;
-        setupNcursesWindows(&win, &scoreboard);
-        curs_set(0);
-        nodelay(win, TRUE);
-
-        double scalex, scaley;
-
-        scalex = (double)boardSize / ((double)COLS * (windowWidth - 0.1));
-        scaley = (double)boardSize / ((double)LINES * (windowHeight - 0.1));
-
-        // Reading obstacles from the pipe
-        Point obstacles[NUM_OBSTACLES];
-        if (read(pipeObstaclesWindow[0], obstacles, sizeof(obstacles)) == -1) {
-            perror("read pipeObstaclesWindow");
-            exit(EXIT_FAILURE);
-        }
-
-        // Reading targets from the pipe
-        Point targets[NUM_TARGETS];
-
-        read(pipeTargetsWindow[0], targets, sizeof(targets));
-
-        // Print the score in the scoreboard window
-        wattron(scoreboard, COLOR_PAIR(1));
-        mvwprintw(scoreboard, 1, 1, "Position of the drone: %.2f,%.2f", position[4], position[5]);
-        wattroff(scoreboard, COLOR_PAIR(1));
-
-
-      // Read the removed target value from shared memory
-        int sharedValue; 
-        sem_wait(semID);
-        memcpy(&sharedValue, shmPointer, sizeof(sharedValue));
-        sem_post(semID);
-
-      
-       // Check if there's a new obstacle hit
-        if (sharedValue == -1 && lastObstacleHit == 0) {
-            // New obstacle hit detected
-            totalScore -= 2;
-            lastObstacleHit = 1; // Update the last obstacle hit state
-        } else if (sharedValue != -1) {
-            // If the current value is not an obstacle hit, reset the last obstacle hit state
-            lastObstacleHit = 0;
-        }
-
-        // Handle valid target score updates
-        if (1 <= sharedValue && sharedValue <= 10) {
-            totalScore += sharedValue;
-        }
-
-            // Display the score
-             wattron(scoreboard, COLOR_PAIR(1));
-             mvwprintw(scoreboard, 2, 1, "Score: %d", totalScore); // Display cumulative score
-             wattroff(scoreboard, COLOR_PAIR(1));
-        
-
-        // Display obstacles on the window
-        displayObstacles(win, obstacles, scalex, scaley);
-        
-        // Display targets on the window
-        displayTargets(win, targets, scalex, scaley);
-
-        // Sending the first drone position to drone.c via shared memory
-        if (initial == 0)
-        {
-            sem_wait(semID);
-            memcpy(shmPointer, position, sharedSegSize);
-            sem_post(semID);
-
-            initial++;
-        }
-
-        // Showing the drone and position in the konsole
-        wattron(win, COLOR_PAIR(2));
-        mvwprintw(win, (int)(position[5] / scaley), (int)(position[4] / scalex), "+");
-        wattroff(win, COLOR_PAIR(2));
-
-        wrefresh(win);
-        wrefresh(scoreboard);
-        noecho();
+        exit(EXIT_FAILURE);
+    }
 
-        // Sending user input to keyboardManager.c
-        key = wgetch(win);
-        if (key != ERR)
-        {
-            int keypress = write(pipeWindowKeyboard[1], &key, sizeof(key));
-            if (keypress < 0)
-            {
-                perror("writing error");
-                close(pipeWindowKeyboard[1]);
-                exit(EXIT_FAILURE);
-            }
-            if ((char)key == 'q')
-            {
-                close(pipeWindowKeyboard[1]);
-                fclose(logFile);
-                exit(EXIT_SUCCESS);
-            }
-        }
-        usleep(200000);
+    startupBarrier("window");
 
-        // Reading from shared memory
-        sem_wait(semID);
-        memcpy(position, shmPointer, sharedSegSize);
-        sem_post(semID);
+    if (isRestart(argc, argv))
+    {
+        // After a restart show the world as it is, the pipes only bring changes
+        worldReadField(&loop.world, obstacles, loop.frame.obstacles);
+        worldReadField(&loop.world, targets, loop.frame.targets);
+    }
+    else
+    {
+        // Wait for the first obstacles and targets, then sending the first
+        // drone position to drone.c via shared memory
+        metricsReceived(loop.channelObstacles, ipcRead(loop.pipeObstacles, loop.frame.obstacles, sizeof(loop.frame.obstacles)));
+        metricsReceived(loop.channelTargets, ipcRead(loop.pipeTargets, loop.frame.targets, sizeof(loop.frame.targets)));
+        worldWrite(&loop.world, position, sharedSegSize);
+        metricsSent(loop.channelShm, sharedSegSize);
+    }
+    ipcSetNonBlocking(loop.pipeObstacles);
+    ipcSetNonBlocking(loop.pipeTargets);
+    collectFrame(&loop);
 
-        // Writing to the log file
-        logData(logFile, position, sharedSegSize, totalScore);
-        clear();
-        sleep(1);
+    pthread_t renderThread, inputThread;
+    if (pthread_create(&renderThread, NULL, renderFrames, &loop) != 0 ||
+        pthread_create(&inputThread, NULL, forwardKeys, &loop) != 0)
+    {
+        perror("pthread_create window");
+        exit(EXIT_FAILURE);
     }
+    pthread_detach(renderThread);
+    pthread_detach(inputThread);
+
+    schedulerEvery(&scheduler, windowFramePeriod, collectFrame, &loop);
+    schedulerAdd(&scheduler, windowLogPeriod, windowLogPeriod, logFrame, &loop);
+    schedulerRun(&scheduler);
 
     // Cleaning up
-    close(pipeObstaclesWindow[0]);
-    close(pipeTargetsWindow[0]);
-    shm_unlink(SHM_PATH);
-    sem_close(semID);
-    sem_unlink(SEM_PATH);
+    schedulerDestroy(&scheduler);
+    ipcClose(pipeObstaclesWindow[0]);
+    ipcClose(pipeTargetsWindow[0]);
+    worldDetach(&loop.world);
 
     endwin();
 
     // Closing the log file
-    fclose(logFile);
+    fclose(loop.logFile);
 
     return 0;
 }
@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../include/constant.h"
+#include "../include/worldStream.h"
+
+// Read exactly size bytes, 0 when the server hung up
+int readFully(int fd, void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t length = read(fd, (char *)buffer + done, size - done);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return 0;
+        }
+        done += length;
+    }
+    return 1;
+}
+
+// Subscribe to the world stream of a running simulation and print every
+// update. With --slow N the reader sleeps N seconds between messages, to watch
+// the server drop to the latest state.
+int main(int argc, char *argv[]) {
+    double slow = 0;
+    if (argc == 3 && strcmp(argv[1], "--slow") == 0) {
+        slow = atof(argv[2]);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--slow seconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, WORLD_SOCKET_PATH, sizeof(address.sun_path) - 1);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror(WORLD_SOCKET_PATH);
+        return EXIT_FAILURE;
+    }
+
+    WorldState state;
+    memset(&state, 0, sizeof(state));
+    unsigned char payload[streamMaxPayload];
+    StreamHeader header;
+
+    while (readFully(fd, &header, sizeof(header))) {
+        if (header.magic != streamMagic || header.length > streamMaxPayload ||
+            !readFully(fd, payload, header.length) || streamDecode(&header, payload, &state) == -1) {
+            fprintf(stderr, "malformed message\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("%-8s gen %-8llu drone (%6.2f, %6.2f) score %d (%d targets, %d obstacles) dropped %u%s%s%s\n",
+               header.type == streamSnapshot ? "snapshot" : "delta",
+               (unsigned long long)header.generation, state.position[4], state.position[5],
+               state.score, state.targetHits, state.obstacleHits, header.dropped,
+               header.sections & sectionObstacles ? " +obstacles" : "",
+               header.sections & sectionObstacleMoves ? " +moves" : "",
+               header.sections & sectionTargets ? " +targets" : "");
+        fflush(stdout);
+
+        if (slow > 0) {
+            usleep((useconds_t)(slow * 1e6));
+        }
+    }
+
+    close(fd);
+    return 0;
+}